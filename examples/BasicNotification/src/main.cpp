@@ -4,6 +4,7 @@
 #include <BLESecure.h>
 #include <BLENotify.h>
 #include "PicoFCMNotifier.h"
+#include "FCMRulesEngine.h"
 
 // Define the GPIO pin for the FCM notification button
 const int NOTIFY_BUTTON_PIN = 18;
@@ -156,6 +157,11 @@ void onProvisionStatus(PicoWiFiProvisioningStatus status)
 
     case PROVISION_CONNECTED:
       Serial.println("Provisioning: connected to WiFi");
+      if (PicoFCMNotifier.getLastProvisioningDurationMs() > 0) {
+        Serial.print("Provisioning time: ");
+        Serial.print(PicoFCMNotifier.getLastProvisioningDurationMs());
+        Serial.println(" ms");
+      }
       break;
 
     case PROVISION_COMPLETE:
@@ -196,11 +202,29 @@ void onPairingStatus(BLEPairingStatus status, BLEDevice *device)
 
 }
 
+// Callback for the final outcome of queued notifications
+void onNotificationResult(uint32_t id, FCMSendResult result, uint8_t attempts)
+{
+  if (result == FCM_SEND_OK)
+  {
+    Serial.println("Notification sent successfully.");
+  }
+  else
+  {
+    Serial.print("Failed to send notification: ");
+    Serial.println(fcmSendResultToString(result));
+  }
+}
+
 // Function to initialize the WiFi provisioning
 bool startProvisioning()
 {
   if (PicoFCMNotifier.begin("PicoFCM", SECURITY_MEDIUM, IO_CAPABILITY_NO_INPUT_NO_OUTPUT))
   {
+    // Also accept provisioning over USB from tools/serial_provision.py
+    PicoFCMNotifier.beginSerialProvisioning();
+    // Move to a stronger stored network before the signal is lost
+    PicoFCMNotifier.enableRoaming();
     // Serial.println("WiFi provisioning service started");
     return true;
   }
@@ -211,6 +235,23 @@ bool startProvisioning()
   }
 }
 
+// Print signal strength and roaming counters; run from PicoFCMNotifier.loop() every 10 seconds
+void printSignal(void *context)
+{
+  if (!wifiConnected)
+    return;
+  FCMRoamingStats roaming = PicoFCMNotifier.getRoamingStats();
+  Serial.print("WiFi signal strength (RSSI): ");
+  Serial.print(PicoFCMNotifier.getRSSI());
+  Serial.print(" dBm, smoothed ");
+  Serial.print(roaming.smoothedRssi);
+  Serial.print(" dBm, roams ");
+  Serial.print(roaming.roams);
+  Serial.print(", disconnected ");
+  Serial.print((uint32_t)(roaming.disconnectedMs / 1000));
+  Serial.println(" s");
+}
+
 void setup()
 {
   // Initialize serial for debugging
@@ -227,13 +268,27 @@ void setup()
   pinMode(BLE_LED_PIN, OUTPUT);
   digitalWrite(BLE_LED_PIN, LOW);
 
-  // Initialize the notification button pin
-  pinMode(NOTIFY_BUTTON_PIN, INPUT_PULLUP);
+  // Notify when the button is pressed (active low). Edges are captured by
+  // interrupt; bounces within 50 ms are ignored and presses closer than 2 s
+  // apart are rate limited.
+  uint8_t button = FCMRules.addDigitalSource(NOTIFY_BUTTON_PIN, INPUT_PULLUP);
+  FCMRule buttonRule = {FCM_RULE_EDGE, button, LOW, 0, 50, 2000, "Hello from Pico!", "The button was pressed.", 0};
+  FCMRules.addRule(buttonRule);
 
   // Set callbacks before initialization
   PicoFCMNotifier.setBLEConnectionStateCallback(handleBleConnectionChange);
   PicoFCMNotifier.setWiFiStatusCallback(onWiFiStatus);
   PicoFCMNotifier.setStatusCallback(onProvisionStatus);
+  PicoFCMNotifier.setNotificationResultCallback(onNotificationResult);
+
+  // Keep the phone connected during the WiFi join so it sees the result live
+  PicoFCMNotifier.setBLECoexistence(true);
+
+  // Stamp notifications with wall-clock time for end-to-end latency tracking
+  PicoFCMNotifier.enableTimeSync(true);
+
+  // Provisioned units start joining WiFi right away; BLE comes up only if it is needed
+  PicoFCMNotifier.setStartupMode(FCM_STARTUP_STAGED);
 
   // Set pairing status callback directly to BLESecure
   BLESecure.setPairingStatusCallback(onPairingStatus);
@@ -241,11 +296,11 @@ void setup()
   // Initialize WiFi provisioning
   if (startProvisioning())
   {
-    // Try to connect to any stored WiFi networks
+    // Try to connect to any stored WiFi networks (staged startup may already be joining)
     Serial.println("Attempting to connect to stored networks...");
-    if (PicoFCMNotifier.connectToStoredNetworks())
+    if (PicoFCMNotifier.getStatus() == PROVISION_CONNECTING || PicoFCMNotifier.connectToStoredNetworks())
     {
-      Serial.println("Connected to a stored network!");
+      Serial.println("Joining a stored network...");
     }
     else
     {
@@ -254,14 +309,24 @@ void setup()
     }
   }
 
+  PicoFCMNotifier.scheduleTimer(10000, printSignal, nullptr, 10000);
+
   Serial.println("Press BOOTSEL button to clear all WiFi networks");
   Serial.println("RESET (short pin RUN to GND) to reinitialize WiFi provisioning");
 }
 
 void loop()
 {
-  // Process WiFi and BLE events
-  PicoFCMNotifier.loop();
+  // Process WiFi and BLE events; returns how long nothing needs the library
+  uint32_t idleMs = PicoFCMNotifier.loop();
+
+  // Show how long startup took, once the first notification has gone out
+  static bool bootTimelinePrinted = false;
+  if (!bootTimelinePrinted && PicoFCMNotifier.getBootPhaseUs(FCM_BOOT_FIRST_NOTIFICATION) != 0)
+  {
+    PicoFCMNotifier.printBootTimeline();
+    bootTimelinePrinted = true;
+  }
 
   // Check if we need to perform a reset after BOOTSEL was pressed
   if (needReset)
@@ -294,32 +359,8 @@ void loop()
     }
   }
 
-  // Check for notification button press
-  static unsigned long lastNotifyButtonPressTime = 0;
-  static bool notifyButtonPressed = false;
-  const unsigned long notifyDebounceDelay = 50; // 50ms debounce
-
-  if (digitalRead(NOTIFY_BUTTON_PIN) == LOW) // Button is pressed (active low)
-  {
-      unsigned long currentTime = millis();
-      if (!notifyButtonPressed && (currentTime - lastNotifyButtonPressTime > notifyDebounceDelay))
-      {
-          notifyButtonPressed = true;
-          lastNotifyButtonPressTime = currentTime;
-          Serial.println("Notify Button Pressed!");
-
-          // Send the notification
-          if(PicoFCMNotifier.sendNotification("Hello from Pico!", "The button was pressed.")) {
-              Serial.println("Notification sent successfully.");
-          } else {
-              Serial.println("Failed to send notification.");
-          }
-      }
-  }
-  else
-  {
-      notifyButtonPressed = false;
-  }
+  // Turn button events into queued notifications; the library retries them from loop() if needed
+  FCMRules.loop();
 
   // Check BOOTSEL button state with debouncing
   static unsigned long lastButtonPressTime = 0;
@@ -348,17 +389,8 @@ void loop()
     buttonPressed = false;
   }
 
-  // Print signal strength every 10 seconds if connected
-  static unsigned long lastRssiPrint = 0;
-  if (wifiConnected && millis() - lastRssiPrint > 10000)
-  {
-    Serial.print("WiFi signal strength (RSSI): ");
-    Serial.print(PicoFCMNotifier.getRSSI());
-    Serial.println(" dBm");
-    lastRssiPrint = millis();
-  }
-
   updateLed();
 
-  delay(10);
+  // The LED and BOOTSEL are polled, so do not idle longer than the blink needs
+  delay(idleMs < 10 ? idleMs : 10);
 }
\ No newline at end of file
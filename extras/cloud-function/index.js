@@ -0,0 +1,212 @@
+/**
+ * Reference Cloud Function for pico-fcm-notifier.
+ *
+ * Receives {token, title, body, seq, ts} from the device, forwards the
+ * notification through FCM, and measures server-receive latency: the time
+ * between the device enqueueing the notification (ts, wall-clock ms from
+ * SNTP) and this function receiving it. The latency is logged as a
+ * structured entry and passed on to the app in the data payload together
+ * with the receive time, so the app can compute the remaining hop to the
+ * phone.
+ *
+ * An optional base64 "attachment" (with "attachment_name") is stored in the
+ * project's default Cloud Storage bucket, and its path and size are passed
+ * on in the data payload; FCM messages are too small to carry it.
+ *
+ * Devices using the compact wire format (setWireFormat(FCM_WIRE_MSGPACK))
+ * send MessagePack maps with integer keys and no Content-Type header; the
+ * format is recognised by the first byte of the body. The device first
+ * registers its token ({0: token}) and gets back a short {"tokenId"} that is
+ * stored in Firestore; notifications ({1: tokenId, 2: title, 3: body,
+ * 4: seq, 5: ts}) then name the token by that ID and get an empty 200 back.
+ * An unknown ID is answered with 412 so the device registers again.
+ *
+ * Downstream commands for a device are kept in Firestore, in the "cmd"
+ * array of deviceCommands/<sha256 of its FCM token, hex>, e.g.
+ * ["rate 30000", "flush"]. The next answered request of that device takes
+ * them and returns them as {"cmd": [...]} (next to the usual fields in JSON
+ * answers). Idle devices post heartbeats ({token, heartbeat: true}, or
+ * {1: tokenId, 6: 1} in the compact format), which are answered without
+ * sending a notification.
+ *
+ * Deploy:
+ *   cd extras/cloud-function && npm install
+ *   firebase deploy --only functions
+ */
+
+const { onRequest } = require("firebase-functions/v2/https");
+const logger = require("firebase-functions/logger");
+const admin = require("firebase-admin");
+const crypto = require("crypto");
+const { decode } = require("@msgpack/msgpack");
+
+admin.initializeApp();
+
+// Compact request keys (keep in sync with src/FCMMsgPack.h)
+const KEY = { token: 0, tokenId: 1, title: 2, body: 3, seq: 4, ts: 5, heartbeat: 6 };
+
+// Registered tokens, cached per instance so a send does not read Firestore
+const tokenCache = new Map();
+const tokenIds = () => admin.firestore().collection("deviceTokenIds");
+
+// Derive the ID from the token so re-registering returns the same one;
+// collisions move on to the next free ID
+async function registerToken(token) {
+  const hash = crypto.createHash("sha256").update(token).digest();
+  let id = hash.readUInt32BE(0) || 1;
+  for (;;) {
+    const ref = tokenIds().doc(String(id));
+    const taken = await admin.firestore().runTransaction(async (tx) => {
+      const doc = await tx.get(ref);
+      if (doc.exists && doc.get("token") !== token) return true;
+      if (!doc.exists) tx.set(ref, { token, registeredAt: Date.now() });
+      return false;
+    });
+    if (!taken) break;
+    id = (id % 0xffffffff) + 1;
+  }
+  tokenCache.set(id, token);
+  return id;
+}
+
+async function lookupToken(id) {
+  if (tokenCache.has(id)) return tokenCache.get(id);
+  const doc = await tokenIds().doc(String(id)).get();
+  const token = doc.exists ? doc.get("token") : null;
+  if (token) tokenCache.set(id, token);
+  return token;
+}
+
+// Take the pending commands of a device; each is delivered at most once.
+// A failure here must not fail a notification that FCM already accepted.
+async function takeCommands(token) {
+  const id = crypto.createHash("sha256").update(token).digest("hex");
+  const ref = admin.firestore().collection("deviceCommands").doc(id);
+  try {
+    return await admin.firestore().runTransaction(async (tx) => {
+      const doc = await tx.get(ref);
+      const commands = doc.exists ? doc.get("cmd") || [] : [];
+      if (commands.length > 0) tx.delete(ref);
+      return commands.map(String);
+    });
+  } catch (error) {
+    logger.warn("could not read pending commands", { message: error.message });
+    return [];
+  }
+}
+
+// Answer a handled request; compact clients get an empty body unless commands are pending
+function answer(res, compact, payload, commands) {
+  if (commands.length > 0) {
+    res.status(200).json(compact ? { cmd: commands } : { ...payload, cmd: commands });
+  } else if (compact) {
+    res.status(200).end();
+  } else {
+    res.status(200).json(payload);
+  }
+}
+
+// MessagePack fixmap, map16 or map32
+function isMsgPack(raw) {
+  return raw && raw.length > 0 && ((raw[0] & 0xf0) === 0x80 || raw[0] === 0xde || raw[0] === 0xdf);
+}
+
+exports.sendNotification = onRequest(async (req, res) => {
+  const receivedAt = Date.now();
+
+  if (req.method !== "POST") {
+    res.status(405).json({ error: "POST required" });
+    return;
+  }
+
+  const compact = isMsgPack(req.rawBody);
+  let request;
+  if (compact) {
+    let map;
+    try {
+      map = decode(req.rawBody);
+    } catch (error) {
+      res.status(400).json({ error: "invalid MessagePack body" });
+      return;
+    }
+    if (map[KEY.token] !== undefined) {
+      if (typeof map[KEY.token] !== "string" || map[KEY.token].length === 0) {
+        res.status(400).json({ error: "token required" });
+        return;
+      }
+      const tokenId = await registerToken(map[KEY.token]);
+      logger.info("token registered", { tokenId });
+      res.status(200).json({ tokenId });
+      return;
+    }
+    const token = await lookupToken(Number(map[KEY.tokenId]));
+    if (!token) {
+      res.status(412).json({ error: "unknown tokenId" });
+      return;
+    }
+    request = {
+      token, title: map[KEY.title], body: map[KEY.body], seq: map[KEY.seq], ts: map[KEY.ts],
+      heartbeat: Boolean(map[KEY.heartbeat]),
+    };
+  } else {
+    request = req.body || {};
+  }
+
+  const { token, title, body, seq, ts, attachment, attachment_name: attachmentName } = request;
+  if (request.heartbeat && token) {
+    const commands = await takeCommands(token);
+    logger.info("heartbeat", { compact, commands: commands.length });
+    answer(res, compact, { success: true }, commands);
+    return;
+  }
+  if (!token || !title || !body) {
+    res.status(400).json({ error: "token, title and body are required" });
+    return;
+  }
+
+  // ts is absent until the device clock has been set over SNTP
+  const deviceTs = Number(ts);
+  const serverReceiveLatencyMs = Number.isFinite(deviceTs) && deviceTs > 0 ? receivedAt - deviceTs : null;
+
+  const data = { serverRx: String(receivedAt) };
+  if (seq !== undefined) data.seq = String(seq);
+  if (serverReceiveLatencyMs !== null) {
+    data.ts = String(deviceTs);
+    data.serverReceiveLatencyMs = String(serverReceiveLatencyMs);
+  }
+
+  try {
+    if (attachment) {
+      const buffer = Buffer.from(attachment, "base64");
+      const safeName = String(attachmentName || "attachment").replace(/[^A-Za-z0-9._-]/g, "_");
+      const path = `attachments/${receivedAt}-${safeName}`;
+      await admin.storage().bucket().file(path).save(buffer);
+      data.attachmentPath = path;
+      data.attachmentSize = String(buffer.length);
+      logger.info("attachment stored", { seq: seq ?? null, path, size: buffer.length });
+    }
+
+    const messageId = await admin.messaging().send({
+      token,
+      notification: { title, body },
+      data,
+      android: { priority: "high" },
+    });
+    const sentAt = Date.now();
+
+    logger.info("notification delivered to FCM", {
+      seq: seq ?? null,
+      serverReceiveLatencyMs,
+      fcmSendMs: sentAt - receivedAt,
+      compact,
+    });
+    const commands = await takeCommands(token);
+    answer(res, compact, { success: true, messageId, seq: seq ?? null, serverReceiveLatencyMs }, commands);
+  } catch (error) {
+    logger.error("FCM send failed", { seq: seq ?? null, code: error.code, message: error.message });
+    // Invalid or unregistered tokens will not succeed on retry
+    const permanent = error.code === "messaging/invalid-argument" ||
+      error.code === "messaging/registration-token-not-registered";
+    res.status(permanent ? 400 : 500).json({ success: false, error: error.code || "internal" });
+  }
+});
@@ -0,0 +1,84 @@
+/**
+ * FCMAllocTracker.h - Opt-in heap allocation tracking for PicoFCMNotifier.
+ *
+ * Build with -DPICO_FCM_ALLOC_TRACKING to count allocations, bytes and peak
+ * heap use per library API call. Without the flag the scopes compile away
+ * and all counters stay at zero.
+ *
+ * Allocations are counted through operator new/delete and the ArduinoJson
+ * allocator used by the library. The arduino-pico core already wraps
+ * malloc() itself, so plain malloc() calls (String, lwIP) are not counted
+ * one by one; they still show up in the heap delta, which is measured with
+ * mallinfo() around each call.
+ */
+
+#ifndef FCM_ALLOC_TRACKER_H
+#define FCM_ALLOC_TRACKER_H
+
+#include <Arduino.h>
+
+// Library API calls tracked separately
+typedef enum
+{
+    FCM_ALLOC_API_LOOP = 0,    // PicoFCMNotifier.loop(), excluding the nested calls below
+    FCM_ALLOC_API_SEND = 1,    // One send attempt (sendNotification() or a queued retry)
+    FCM_ALLOC_API_TLS = 2,     // TLS connection setup; the core allocates session buffers per connection
+    FCM_ALLOC_API_OAUTH = 3,   // OAuth access token refresh in direct mode
+    FCM_ALLOC_API_STORAGE = 4, // Loading or saving configuration, caches and bonds in LittleFS
+    FCM_ALLOC_API_COMMAND = 5, // Processing a BLE command
+    FCM_ALLOC_API_METRICS = 6, // Serving a metrics scrape
+    FCM_ALLOC_API_COUNT
+} FCMAllocApi;
+
+// Allocation counters of one API
+typedef struct
+{
+    uint32_t calls;
+    uint32_t allocations;   // Counted allocations made directly inside the call
+    uint32_t frees;
+    uint32_t bytesAllocated;
+    int32_t lastHeapDelta;  // Heap in use after minus before the last call, nested calls included
+    uint32_t peakHeapUsed;  // Highest heap in use seen during any call
+} FCMAllocStats;
+
+// Whether the library was built with PICO_FCM_ALLOC_TRACKING
+bool fcmAllocTrackingEnabled();
+
+// Get the counters of one API
+const FCMAllocStats &fcmGetAllocStats(FCMAllocApi api);
+
+// Reset all counters
+void fcmResetAllocStats();
+
+// Get a printable name for an API
+const char *fcmAllocApiToString(FCMAllocApi api);
+
+// Steady-state check: once armed (after warm-up), any counted allocation or
+// heap growth inside loop() or a send attempt is a violation. Growth inside a
+// nested call of another API counts against that API, not the caller. TLS, OAuth,
+// storage, command processing and metrics scrapes are expected to allocate
+// and are exempt.
+void fcmArmAllocCheck(void (*onViolation)(FCMAllocApi api, uint32_t bytes) = nullptr);
+void fcmDisarmAllocCheck();
+
+// Number of violations since the check was armed
+uint32_t fcmGetAllocViolations();
+
+#ifdef PICO_FCM_ALLOC_TRACKING
+// Attributes allocations to an API for the lifetime of the scope
+class FCMAllocScope
+{
+public:
+    FCMAllocScope(FCMAllocApi api);
+    ~FCMAllocScope();
+
+private:
+    FCMAllocApi _api;
+    uint32_t _heapUsedAtStart;
+};
+#define FCM_ALLOC_SCOPE(api) FCMAllocScope fcmAllocScope_(api)
+#else
+#define FCM_ALLOC_SCOPE(api)
+#endif
+
+#endif // FCM_ALLOC_TRACKER_H
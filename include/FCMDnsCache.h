@@ -0,0 +1,75 @@
+/**
+ * FCMDnsCache.h - Small DNS result cache for the notifier's endpoint hosts.
+ *
+ * Keeps the last resolved IPv4 address of each endpoint host for a fixed
+ * TTL, remembers failed lookups for a shorter time so a flaky resolver
+ * fails fast, and persists the last good addresses to LittleFS so they can
+ * be used as a fallback right after a reboot. Connecting to a fallback
+ * address sends no SNI, so it cannot complete a TLS handshake with Google
+ * front ends; it only helps servers that do not require SNI.
+ */
+
+#ifndef FCM_DNS_CACHE_H
+#define FCM_DNS_CACHE_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Number of hosts cached (Cloud Function, OAuth token and FCM API hosts)
+#define FCM_DNS_CACHE_SIZE 3
+// Maximum host name length accepted in endpoint URLs
+#define MAX_FCM_HOST_LENGTH 128
+// File used to persist the last good addresses
+#define FCM_DNS_CACHE_FILE "/fcm_dns.json"
+// Default lifetimes of positive and negative entries
+#define FCM_DNS_DEFAULT_TTL_MS 300000
+#define FCM_DNS_DEFAULT_NEGATIVE_TTL_MS 10000
+
+// One cached host
+typedef struct
+{
+    char host[MAX_FCM_HOST_LENGTH + 1];
+    uint32_t address;         // Last good IPv4 address, 0 if unknown
+    unsigned long resolvedAt; // millis() of the last successful lookup
+    unsigned long failedAt;   // millis() of the last failed lookup
+    unsigned long lastUsed;
+    bool resolved;            // resolvedAt is valid (false for addresses loaded from flash)
+    bool failed;              // failedAt is valid
+} FCMDnsCacheEntry;
+
+class FCMDnsCache
+{
+public:
+    FCMDnsCache();
+
+    // Set how long resolved addresses and failed lookups are cached
+    void setTtl(uint32_t ttlMs, uint32_t negativeTtlMs);
+
+    // Resolve a host, answering from the cache while the entry is fresh.
+    // If the lookup fails, a stale or persisted address is returned and
+    // usedStale is set so the caller can treat it as a fallback.
+    bool resolve(const char *host, IPAddress &address, bool &usedStale);
+
+    // Look a host up again even if its entry is still fresh (e.g. after
+    // connecting by name failed), falling back like resolve()
+    bool refresh(const char *host, IPAddress &address, bool &usedStale);
+
+    // Forget all entries, including the persisted ones
+    void clear();
+
+    // Load the last good addresses saved before a reboot (all start stale)
+    bool loadFromFlash();
+
+private:
+    FCMDnsCacheEntry _entries[FCM_DNS_CACHE_SIZE];
+    uint32_t _ttlMs;
+    uint32_t _negativeTtlMs;
+
+    // Find the entry for a host, or recycle the least recently used one
+    FCMDnsCacheEntry &entryFor(const char *host);
+
+    // Persist the last good addresses
+    bool saveToFlash();
+};
+
+#endif // FCM_DNS_CACHE_H
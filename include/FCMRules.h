@@ -0,0 +1,90 @@
+/**
+ * FCMRules.h - Event ring and rule evaluation for the rules engine.
+ *
+ * Events from interrupts land in a lock-free single-producer/single-consumer
+ * ring and are turned into notifications by declarative rules (edge,
+ * threshold with hysteresis, debounce and rate limit). Only uses the C
+ * library, so rule evaluation builds and can be benchmarked on the host
+ * (see tools/rules_benchmark.cpp).
+ */
+
+#ifndef FCM_RULES_H
+#define FCM_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Capacity of the event ring (power of two)
+#define FCM_EVENT_RING_SIZE 32
+
+// A change on a digital source or a sample of an analog source
+typedef struct
+{
+    uint32_t timeMs;
+    uint8_t source;
+    int32_t value; // Pin level for digital sources, ADC reading for analog ones
+} FCMEvent;
+
+// Lock-free ring with one producer (an interrupt) and one consumer (loop()).
+// Full rings drop the new event and count it.
+class FCMEventRing
+{
+public:
+    FCMEventRing();
+
+    bool push(const FCMEvent &event);
+    bool pop(FCMEvent &event);
+
+    // Events lost because the ring was full
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    FCMEvent _events[FCM_EVENT_RING_SIZE];
+    volatile uint32_t _head; // Written by the producer only
+    volatile uint32_t _tail; // Written by the consumer only
+    volatile uint32_t _dropped;
+};
+
+// What a rule reacts to
+typedef enum
+{
+    FCM_RULE_EDGE = 0,  // Digital source changed to level threshold after debounceMs without changes
+    FCM_RULE_ABOVE = 1, // Value above threshold for debounceMs; re-armed below threshold - hysteresis
+    FCM_RULE_BELOW = 2  // Value below threshold for debounceMs; re-armed above threshold + hysteresis
+} FCMRuleKind;
+
+// A declarative rule. {0} in the title or body is replaced by the event value.
+typedef struct
+{
+    FCMRuleKind kind;
+    uint8_t source;
+    int32_t threshold;
+    int32_t hysteresis;
+    uint32_t debounceMs;
+    uint32_t minIntervalMs; // Triggers closer than this to the last notification are suppressed
+    const char *title;      // Referenced, not copied
+    const char *body;
+    uint8_t valueDecimals;  // Show the value as fixed point, e.g. 235 with 1 is "23.5"
+} FCMRule;
+
+// Evaluation state and counters of one rule
+typedef struct
+{
+    bool tripped;          // Threshold rules: fired and waiting to be re-armed
+    bool pending;          // Condition met, waiting for debounceMs to pass
+    uint32_t pendingSince;
+    bool seenEvent;        // Edge rules: lastEventMs is valid
+    uint32_t lastEventMs;
+    uint32_t lastFiredMs;
+    uint32_t fired;
+    uint32_t suppressed;   // Triggers dropped by the rate limit
+} FCMRuleState;
+
+// Feed one event of the rule's source into the rule. Returns true when a
+// notification should be sent.
+bool fcmEvaluateRule(const FCMRule &rule, FCMRuleState &state, const FCMEvent &event);
+
+// Copy text, replacing {0} by value / 10^decimals. Returns false if truncated.
+bool fcmFormatRuleText(const char *text, int32_t value, uint8_t decimals, char *out, size_t outSize);
+
+#endif // FCM_RULES_H
@@ -0,0 +1,83 @@
+/**
+ * FCMRulesEngine.h - Turns GPIO and ADC events into queued notifications.
+ *
+ * Digital sources are captured by edge interrupts into a lock-free event
+ * ring; analog sources are sampled on a fixed interval from loop(). Each
+ * event is fed to the rules watching its source, and rules that fire queue
+ * a notification on PicoFCMNotifier, so retries and deadlines apply.
+ */
+
+#ifndef FCM_RULES_ENGINE_H
+#define FCM_RULES_ENGINE_H
+
+#include <Arduino.h>
+#include "PicoFCMNotifier.h"
+#include "FCMRules.h"
+
+#define MAX_FCM_RULE_SOURCES 8
+#define MAX_FCM_RULES 8
+#define FCM_RULE_SOURCE_INVALID 0xFF
+
+// Longest title/body after {0} substitution
+#define FCM_RULE_TEXT_LENGTH MAX_NOTIFICATION_BODY_LENGTH
+
+// An input watched by the engine
+typedef struct
+{
+    uint8_t pin;
+    bool analog;
+    uint32_t intervalMs;  // Analog sampling period
+    uint8_t oversample;   // Analog readings averaged per sample
+    unsigned long nextSampleAt;
+} FCMRuleSource;
+
+class FCMRulesEngineClass
+{
+public:
+    FCMRulesEngineClass();
+
+    // Watch a GPIO through edge interrupts. Returns the source ID, or
+    // FCM_RULE_SOURCE_INVALID if all sources are taken.
+    uint8_t addDigitalSource(uint8_t pin, PinMode mode = INPUT_PULLUP);
+
+    // Sample an ADC pin every intervalMs, averaging oversample readings.
+    // Returns the source ID, or FCM_RULE_SOURCE_INVALID.
+    uint8_t addAnalogSource(uint8_t pin, uint32_t intervalMs, uint8_t oversample = 1);
+
+    // Add a rule on a source. The rule's title and body are referenced, not copied.
+    bool addRule(const FCMRule &rule, const FCMRetryPolicy *policy = nullptr);
+
+    // Drain the event ring, sample due analog sources and evaluate rules.
+    // Call this in your loop, next to PicoFCMNotifier.loop().
+    void loop();
+
+    // Set a callback for each rule that fires (called before the notification is queued)
+    void setRuleFiredCallback(void (*callback)(uint8_t rule, const FCMEvent &event));
+
+    // Get the evaluation counters of a rule
+    const FCMRuleState &getRuleState(uint8_t rule);
+
+    // Events lost because loop() did not drain the ring in time
+    uint32_t getDroppedEvents();
+
+    // Called from the GPIO interrupt of a digital source
+    void handleGpioInterrupt(uint8_t source);
+
+private:
+    FCMRuleSource _sources[MAX_FCM_RULE_SOURCES];
+    uint8_t _sourceCount;
+    FCMRule _rules[MAX_FCM_RULES];
+    FCMRuleState _ruleStates[MAX_FCM_RULES];
+    FCMRetryPolicy _rulePolicies[MAX_FCM_RULES];
+    bool _ruleHasPolicy[MAX_FCM_RULES];
+    uint8_t _ruleCount;
+    FCMEventRing _events;
+    void (*_ruleFiredCallback)(uint8_t rule, const FCMEvent &event);
+
+    // Feed one event to every rule and queue the notifications that fire
+    void dispatch(const FCMEvent &event);
+};
+
+extern FCMRulesEngineClass FCMRules;
+
+#endif // FCM_RULES_ENGINE_H
@@ -0,0 +1,96 @@
+/**
+ * FCMTimerWheel.h - Hashed timer wheel for loop()-driven work.
+ *
+ * One-shot and periodic timers live in a fixed pool and are hashed by
+ * deadline into a ring of slots, so scheduling and cancelling are O(1) and
+ * run() only looks at the slots whose ticks have passed. Time is passed in
+ * by the caller (millis()), so the wheel only uses the C library and builds
+ * on the host. Not interrupt safe: schedule, cancel and run from one
+ * context, normally loop().
+ */
+
+#ifndef FCM_TIMER_WHEEL_H
+#define FCM_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of slots (power of two) and the time each one covers; one turn of
+// the wheel is FCM_TIMER_WHEEL_SLOTS * FCM_TIMER_TICK_MS ms
+#define FCM_TIMER_WHEEL_SLOTS 64
+#define FCM_TIMER_TICK_MS 4
+
+// Timers that can be scheduled at once, shared by the library and the sketch
+#define FCM_MAX_TIMERS 24
+
+// Returned by msUntilNext() when no timer is scheduled
+#define FCM_TIMER_NONE UINT32_MAX
+
+typedef void (*FCMTimerCallback)(void *context);
+
+class FCMTimerWheel
+{
+public:
+    FCMTimerWheel();
+
+    // Call callback(context) delayMs after now, then every periodMs if it is
+    // not 0. Returns the timer ID, or 0 if every timer is in use.
+    uint32_t schedule(uint32_t now, uint32_t delayMs, FCMTimerCallback callback, void *context, uint32_t periodMs = 0);
+
+    // Move a scheduled timer to delayMs after now, keeping its callback and period
+    bool reschedule(uint32_t id, uint32_t now, uint32_t delayMs);
+
+    // Stop a timer; IDs of timers that already finished are ignored
+    bool cancel(uint32_t id);
+
+    // Whether the timer is still waiting to run
+    bool pending(uint32_t id) const;
+
+    // Run the callbacks of every timer that is due. Timers scheduled by a
+    // callback run on a later call at the earliest. Returns the number run.
+    uint8_t run(uint32_t now);
+
+    // Time until the earliest deadline (0 if one is due), or FCM_TIMER_NONE
+    uint32_t msUntilNext(uint32_t now) const;
+
+    // Timers currently scheduled
+    uint8_t active() const { return _active; }
+
+private:
+    static const uint8_t NONE = 0xFF;
+
+    enum TimerState : uint8_t
+    {
+        TIMER_FREE,
+        TIMER_ARMED,
+        TIMER_DUE,      // Expired, waiting in the run list for its callback
+        TIMER_CANCELLED // Cancelled while in the run list
+    };
+
+    struct Timer
+    {
+        uint32_t deadline;
+        uint32_t periodMs;
+        FCMTimerCallback callback;
+        void *context;
+        uint32_t generation; // Changes every time the timer is freed, so stale IDs miss
+        TimerState state;
+        uint8_t prev; // Neighbours in the slot list, or next in the run list
+        uint8_t next;
+    };
+
+    Timer _timers[FCM_MAX_TIMERS];
+    uint8_t _slots[FCM_TIMER_WHEEL_SLOTS]; // First timer of each slot
+    uint8_t _free;                          // Free list, linked through next
+    uint8_t _active;
+    uint32_t _tick;                         // Tick of the last run()
+
+    // Timer index of an ID, or NONE
+    uint8_t find(uint32_t id) const;
+
+    void link(uint8_t index);
+    void unlink(uint8_t index);
+    void release(uint8_t index);
+};
+
+#endif // FCM_TIMER_WHEEL_H
@@ -16,8 +16,12 @@
 #include <BLESecure.h>
 #include <BLENotify.h>
 #include <LittleFS.h>
-#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
+#include <time.h>
+#include "FCMDnsCache.h"
+#include "FCMAllocTracker.h"
+#include "FCMTimerWheel.h"
 
 // Maximum number of WiFi networks that can be stored
 #define MAX_WIFI_NETWORKS 5
@@ -31,6 +35,105 @@
 #define MAX_FCM_URL_LENGTH 256
 #define MAX_FCM_TOKEN_LENGTH 256
 
+// Direct FCM HTTP v1 mode: service account and OAuth access token limits
+#define MAX_FCM_PROJECT_ID_LENGTH 64
+#define MAX_SERVICE_ACCOUNT_EMAIL_LENGTH 128
+#define MAX_OAUTH_TOKEN_LENGTH 2048
+// File used to cache the OAuth access token across reboots
+#define FCM_OAUTH_CACHE_FILE "/fcm_oauth.json"
+// Default Google endpoints used in direct mode
+#define FCM_DEFAULT_OAUTH_TOKEN_URL "https://oauth2.googleapis.com/token"
+#define FCM_DEFAULT_API_URL "https://fcm.googleapis.com"
+
+// File used to keep the token ID assigned by the Cloud Function in compact mode
+#define FCM_TOKEN_ID_FILE "/fcm_token_id.json"
+
+// Downstream commands received in responses wait here until loop() applies them
+#define FCM_COMMAND_BUFFER_SIZE 384
+// Shortest heartbeat interval the Cloud Function may set with a command
+#define FCM_MIN_REMOTE_HEARTBEAT_MS 60000
+// File used to keep the settings changed by downstream commands
+#define FCM_REMOTE_CONFIG_FILE "/fcm_remote.json"
+
+// BLE connection parameters requested while provisioning data is exchanged
+// (interval in 1.25 ms units, supervision timeout in 10 ms units)
+#define FCM_BLE_FAST_INTERVAL_MIN 12 // 15 ms
+#define FCM_BLE_FAST_INTERVAL_MAX 24 // 30 ms
+#define FCM_BLE_FAST_LATENCY 0
+#define FCM_BLE_FAST_TIMEOUT 200 // 2 s
+// Relaxed parameters requested once the link has gone idle, to save power
+#define FCM_BLE_IDLE_INTERVAL_MIN 80  // 100 ms
+#define FCM_BLE_IDLE_INTERVAL_MAX 160 // 200 ms
+#define FCM_BLE_IDLE_LATENCY 4
+#define FCM_BLE_IDLE_TIMEOUT 600 // 6 s
+// Idle time after the last GATT write before relaxing the link
+#define FCM_BLE_IDLE_RELAX_MS 10000
+
+// Bonding keys of trusted phones kept in LittleFS, most recently used first
+#define MAX_BONDED_PEERS 4
+#define BOND_STORE_FILE "/fcm_bonds.json"
+
+// Longest BLE device name kept for deferred BLE startup
+#define FCM_BLE_DEVICE_NAME_LENGTH 29
+
+// In BLE coexistence mode, how long to wait for the app to acknowledge the
+// final WiFi status before dropping the BLE link anyway
+#define FCM_BLE_ACK_TIMEOUT_MS 30000
+
+// Device Status characteristic: minimum time between notifications, and the
+// RSSI change (dB) that counts as a change worth sending
+#define FCM_STATUS_MIN_INTERVAL_MS 500
+#define FCM_STATUS_RSSI_DELTA 3
+// Largest encoded status record (mask byte plus every field)
+#define FCM_STATUS_RECORD_MAX_LENGTH 10
+
+// Prometheus metrics endpoint
+#define FCM_METRICS_DEFAULT_PORT 9100
+// Drop a scrape connection that has not sent a complete request by then
+#define FCM_METRICS_REQUEST_TIMEOUT_MS 2000
+// How often the free heap is sampled for the low watermark
+#define FCM_HEAP_SAMPLE_INTERVAL_MS 250
+
+// Longest idle time loop() reports while nothing is due; WiFi status, BLE,
+// scrapes and serial input are polled, so it still needs regular calls
+#define FCM_LOOP_IDLE_POLL_MS 100
+// Longest idle time while a BLE session, WiFi join, scrape, provisioning
+// frame or roaming scan is in progress
+#define FCM_LOOP_BUSY_POLL_MS 10
+
+// Roaming between stored networks (defaults of FCMRoamingConfig)
+#define FCM_ROAM_SCAN_THRESHOLD_DBM -72 // Scan for a better network while weaker than this
+#define FCM_ROAM_MIN_GAIN_DB 8           // A candidate must be this much stronger
+#define FCM_ROAM_SCAN_INTERVAL_MS 60000  // Minimum time between scans while weak
+#define FCM_ROAM_QUIET_MS 2000           // Only switch when no queued send is due this soon
+// How often RSSI is sampled, and the weight of a new sample in the average (1/n)
+#define FCM_ROAM_RSSI_SAMPLE_MS 1000
+#define FCM_ROAM_EWMA_WEIGHT 8
+// Scan interval while the link is down, and how long a scan result stays usable
+#define FCM_ROAM_LINK_DOWN_SCAN_MS 5000
+#define FCM_ROAM_CANDIDATE_TTL_MS 15000
+
+// Serial provisioning: drop a partial frame after this long without completing it
+#define FCM_PROVISION_FRAME_TIMEOUT_MS 2000
+
+// Notification queue used by the retry engine
+#define MAX_QUEUED_NOTIFICATIONS 8
+#define MAX_NOTIFICATION_TITLE_LENGTH 64
+#define MAX_NOTIFICATION_BODY_LENGTH 192
+
+// Notification JSON payloads are built in a fixed buffer of this size
+#define FCM_PAYLOAD_BUFFER_SIZE 1024
+// Cached request line and headers of the send endpoint
+#define FCM_HTTP_HEAD_SIZE 512
+
+// Attachments are read in chunks of this many bytes and base64-encoded into the payload buffer
+#define FCM_ATTACHMENT_CHUNK_SIZE (FCM_PAYLOAD_BUFFER_SIZE / 4 * 3)
+
+// Prepared notification templates
+#define MAX_PREPARED_NOTIFICATIONS 4
+#define MAX_PREPARED_SLOTS 4             // Placeholders {0} to {3}
+#define FCM_PREPARED_FRAGMENT_SIZE 640   // Pre-escaped JSON of one template
+
 // Status of the WiFi provisioning process
 typedef enum
 {
@@ -42,6 +145,270 @@ typedef enum
     PROVISION_CONNECTED = 5
 } PicoWiFiProvisioningStatus;
 
+// How begin() brings the device up
+typedef enum
+{
+    FCM_STARTUP_FULL = 0,  // Storage, config and BLE advertising are all up when begin() returns (default)
+    FCM_STARTUP_STAGED = 1 // With stored networks, start joining WiFi right away and bring up BLE only when needed
+} FCMStartupMode;
+
+// Milestones recorded in the boot timeline
+typedef enum
+{
+    FCM_BOOT_BEGIN = 0,
+    FCM_BOOT_STORAGE_MOUNTED = 1,
+    FCM_BOOT_CONFIG_LOADED = 2,
+    FCM_BOOT_WIFI_STARTED = 3,
+    FCM_BOOT_BLE_STARTED = 4,
+    FCM_BOOT_ADVERTISING = 5,
+    FCM_BOOT_WIFI_CONNECTED = 6,
+    FCM_BOOT_FIRST_NOTIFICATION = 7,
+    FCM_BOOT_PHASE_COUNT
+} FCMBootPhase;
+
+// How notifications are delivered to FCM
+typedef enum
+{
+    FCM_DELIVERY_CLOUD_FUNCTION = 0, // POST to the provisioned Cloud Function URL
+    FCM_DELIVERY_DIRECT_V1 = 1       // POST straight to the FCM HTTP v1 API
+} FCMDeliveryMode;
+
+// Body format of notification requests to the Cloud Function
+typedef enum
+{
+    FCM_WIRE_JSON = 0,   // JSON with the full FCM token (default)
+    FCM_WIRE_MSGPACK = 1 // MessagePack with a short token ID registered once, and no Content-Type header
+} FCMWireFormat;
+
+// How the HTTPS server certificate is verified
+typedef enum
+{
+    FCM_TLS_INSECURE = 0,    // No verification (default)
+    FCM_TLS_PINNED_KEY = 1,  // Server must present a pinned public key, no chain parsing
+    FCM_TLS_TRUST_ANCHOR = 2 // Full chain validation against precompiled trust anchors
+} FCMTlsMode;
+
+// When the roaming monitor looks for, and switches to, a stronger stored network
+typedef struct
+{
+    int8_t scanThresholdDbm;
+    uint8_t minGainDb;
+    uint32_t scanIntervalMs;
+    uint32_t quietMs;
+} FCMRoamingConfig;
+
+// Roaming and link counters
+typedef struct
+{
+    uint32_t roams;          // Switches to another network or access point
+    uint32_t failedRoams;    // Switches that did not connect and went back
+    uint32_t scans;          // Background scans started
+    uint32_t disconnects;    // Times the link went down after connecting
+    uint64_t disconnectedMs; // Total time the link was down after connecting
+    int32_t smoothedRssi;    // dBm, averaged over recent samples
+} FCMRoamingStats;
+
+// Heartbeat and downstream command counters
+typedef struct
+{
+    uint32_t heartbeats;        // Heartbeats answered by the Cloud Function
+    uint32_t heartbeatFailures; // Heartbeats that were not answered
+    uint32_t commandsApplied;
+    uint32_t commandsRejected;  // Unknown commands or invalid arguments
+    uint32_t commandsDropped;   // Too long, badly escaped, or no room left in the buffer
+} FCMRemoteStats;
+
+// Outcome of a single send attempt, classified by the phase that failed
+typedef enum
+{
+    FCM_SEND_OK = 0,
+    FCM_SEND_NO_WIFI = 1,           // Retryable: WiFi not connected
+    FCM_SEND_NOT_CONFIGURED = 2,    // Permanent: URL, token or service account missing/invalid
+    FCM_SEND_CLOCK_NOT_SET = 3,     // Retryable: direct mode waiting for SNTP
+    FCM_SEND_DNS_FAILED = 4,        // Retryable: host name did not resolve
+    FCM_SEND_CONNECT_FAILED = 5,    // Retryable: TCP connect failed or connection dropped
+    FCM_SEND_TLS_FAILED = 6,        // Retryable: TLS handshake failed
+    FCM_SEND_CERT_REJECTED = 7,     // Permanent: certificate or pinned key verification failed
+    FCM_SEND_TIMEOUT = 8,           // Retryable: no (complete) response in time, or HTTP 408
+    FCM_SEND_HTTP_429 = 9,          // Retryable: rate limited, honours Retry-After
+    FCM_SEND_HTTP_5XX = 10,         // Retryable: server error
+    FCM_SEND_AUTH_FAILED = 11,      // Permanent: HTTP 401/403 or OAuth token rejected
+    FCM_SEND_HTTP_4XX = 12,         // Permanent: any other client error
+    FCM_SEND_DEADLINE_EXCEEDED = 13, // Final result only: retries ran out of time
+    FCM_SEND_PAYLOAD_TOO_LARGE = 14, // Permanent: payload does not fit FCM_PAYLOAD_BUFFER_SIZE
+    FCM_SEND_ATTACHMENT_FAILED = 15, // Permanent: attachment could not be read
+    FCM_SEND_RESULT_COUNT
+} FCMSendResult;
+
+// Retry policy for a queued notification
+typedef struct
+{
+    uint8_t maxAttempts;    // Total attempts including the first (attempts without WiFi are not counted)
+    uint32_t baseBackoffMs; // Delay before the first retry, doubled after each failure
+    uint32_t maxBackoffMs;  // Upper bound for the exponential backoff
+    uint8_t jitterPercent;  // Random +/- spread applied to each delay (0-100)
+    uint32_t deadlineMs;    // Give up this long after queueing (0 = no deadline)
+} FCMRetryPolicy;
+
+// Latency histogram with power-of-two millisecond buckets: bucket 0 counts
+// samples up to 1 ms, bucket i samples in (2^(i-1), 2^i] ms, and the last
+// bucket everything above 2^(FCM_LATENCY_BUCKETS-2) ms
+#define FCM_LATENCY_BUCKETS 16
+typedef struct
+{
+    uint32_t buckets[FCM_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t maxMs;
+    uint64_t totalMs;
+} FCMLatencyHistogram;
+
+// Send counters, with attempt failures broken down by class
+typedef struct
+{
+    uint32_t attempts;
+    uint32_t delivered;
+    uint32_t retries;
+    uint32_t dropped;
+    uint32_t failures[FCM_SEND_RESULT_COUNT];
+    FCMLatencyHistogram queueLatency; // Enqueue to start of the delivering attempt
+    FCMLatencyHistogram sendLatency;  // Start of the delivering attempt to 2xx
+} FCMSendStats;
+
+// Sequence number and origin time sent with each notification
+typedef struct
+{
+    uint32_t seq;
+    uint64_t timestampMs; // Wall-clock ms since the epoch at enqueue, 0 if the clock was not set
+} FCMNotificationStamp;
+
+// A notification waiting in the retry queue
+typedef struct
+{
+    uint32_t id;
+    char title[MAX_NOTIFICATION_TITLE_LENGTH + 1];
+    char body[MAX_NOTIFICATION_BODY_LENGTH + 1];
+    FCMRetryPolicy policy;
+    FCMNotificationStamp stamp;
+    uint8_t attempts;
+    uint32_t backoffMs;
+    unsigned long queuedAt;
+    unsigned long nextAttemptAt;
+    bool inUse;
+} FCMQueuedNotification;
+
+// Request line and fixed headers of POSTs to one endpoint, built once.
+// The text ends with "Content-Length: " so only the length is written per request.
+typedef struct
+{
+    char host[MAX_FCM_HOST_LENGTH + 1];
+    uint16_t port;
+    char text[FCM_HTTP_HEAD_SIZE];
+    uint16_t length;
+} FCMHttpPreparedHead;
+
+// Reads the next bytes of an attachment into buffer. Returns the number of
+// bytes read, 0 at the end, or -1 on error.
+typedef int (*FCMAttachmentReader)(void *context, uint8_t *buffer, size_t size);
+
+// Value spliced into a prepared notification slot
+typedef struct
+{
+    const char *text; // Short string, escaped at send time; null for a number
+    int32_t number;
+    uint8_t decimals; // Fixed-point decimals of number, e.g. 235 with 1 is "23.5"
+} FCMSlotValue;
+
+inline FCMSlotValue fcmSlot(const char *text) { return {text, 0, 0}; }
+inline FCMSlotValue fcmSlot(int32_t number, uint8_t decimals = 0) { return {nullptr, number, decimals}; }
+
+// A registered notification template. The JSON up to the stamp is kept
+// pre-escaped for the current delivery mode and token, with one marker byte
+// per slot, and rebuilt only when the endpoint configuration changes.
+typedef struct
+{
+    char title[MAX_NOTIFICATION_TITLE_LENGTH + 1];
+    char body[MAX_NOTIFICATION_BODY_LENGTH + 1];
+    uint8_t slotCount;   // Highest placeholder used plus one
+    char fragments[FCM_PREPARED_FRAGMENT_SIZE];
+    uint16_t fragmentsLength;
+    uint32_t generation;          // Endpoint configuration the fragments were built for, 0 if none
+    uint32_t oversizedGeneration; // Endpoint configuration the template did not fit
+    bool inUse;
+} FCMPreparedNotification;
+
+// Parameters of the current BLE link
+typedef struct
+{
+    uint16_t mtu;                  // Negotiated ATT MTU (23 until exchanged)
+    uint32_t connectionIntervalUs; // 0 when not connected
+    uint16_t latency;              // Peripheral latency in connection events
+    uint16_t supervisionTimeoutMs;
+    bool fastParameters;           // Short provisioning interval currently requested
+    uint32_t encryptionLatencyMs;  // Connection to encrypted link, 0 until encrypted (kept after disconnect)
+    bool resumedFromBond;          // Encrypted with a stored LTK, no pairing exchange
+} FCMBleLinkInfo;
+
+// Bonding keys of one trusted phone, as stored in the BTstack device database
+typedef struct
+{
+    int addrType;
+    uint8_t addr[6];
+    uint8_t irk[16];
+    uint8_t ltk[16];
+    uint8_t rand[8];
+    uint16_t ediv;
+    uint8_t keySize;
+    bool authenticated;
+    bool authorized;
+    bool secureConnection;
+} FCMBondRecord;
+
+// Fields of the Device Status record. A record starts with a mask byte of
+// these bits, followed by the flagged fields in bit order.
+typedef enum
+{
+    FCM_STATUS_FIELD_PROVISIONING = 0x01, // uint8_t PicoWiFiProvisioningStatus
+    FCM_STATUS_FIELD_WIFI = 0x02,         // uint8_t WiFiStatusCodes
+    FCM_STATUS_FIELD_RSSI = 0x04,         // int8_t dBm
+    FCM_STATUS_FIELD_IP = 0x08,           // 4 bytes, network order
+    FCM_STATUS_FIELD_QUEUE = 0x10,        // uint8_t queued notifications
+    FCM_STATUS_FIELD_SEND_RESULT = 0x20,  // uint8_t FCMSendResult of the last attempt
+    FCM_STATUS_FIELD_ALL = 0x3F
+} FCMStatusField;
+
+// Values carried by the Device Status record
+typedef struct
+{
+    uint8_t provisioningStatus;
+    uint8_t wifiStatus;
+    int8_t rssi;
+    uint32_t ip;
+    uint8_t queueDepth;
+    uint8_t lastSendResult;
+} FCMDeviceStatus;
+
+// Get a printable name for a send result
+const char *fcmSendResultToString(FCMSendResult result);
+
+// Get a printable name for a boot phase
+const char *fcmBootPhaseToString(FCMBootPhase phase);
+
+// Whether a failed attempt with this result may succeed when retried
+bool fcmIsRetryable(FCMSendResult result);
+
+// Add a sample to a latency histogram
+void fcmRecordLatency(FCMLatencyHistogram &histogram, uint32_t ms);
+
+// Estimate a percentile (0-100) from a histogram, as the upper edge of its bucket
+uint32_t fcmLatencyPercentile(const FCMLatencyHistogram &histogram, uint8_t percentile);
+
+// Wall-clock time in ms since the epoch, or 0 until SNTP has set the clock
+uint64_t fcmWallClockMs();
+
+// Encode the fields selected by mask as a Device Status record.
+// out must hold FCM_STATUS_RECORD_MAX_LENGTH bytes. Returns the record length.
+uint16_t fcmEncodeDeviceStatus(const FCMDeviceStatus &status, uint8_t mask, uint8_t *out);
+
 // Structure to hold WiFi network credentials
 typedef struct
 {
@@ -50,16 +417,37 @@ typedef struct
     bool enabled;
 } WiFiNetworkConfig;
 
+class FCMMetricsWriter;
+class FCMJsonWriter;
+class FCMProvisionReceiver;
+class FCMCommandParser;
+struct FCMAttachmentStream;
+
 class PicoFCMNotifierClass
 {
 public:
     PicoFCMNotifierClass();
 
+    // Choose how begin() brings the device up; call before begin()
+    void setStartupMode(FCMStartupMode mode);
+
     // Initialize the WiFi provisioning service
     bool begin(const char *deviceName = "PicoFCM", BLESecurityLevel securityLevel = SECURITY_HIGH, io_capability_t ioCapability = IO_CAPABILITY_DISPLAY_YES_NO);
 
-    // Process BLE and WiFi events - call this in your loop
-    void loop();
+    // Process BLE and WiFi events and run due timers - call this in your loop.
+    // Returns how long the sketch may idle before the next call, e.g. with
+    // delay(), which the arduino-pico core implements with sleep_ms() and so
+    // idles the core in __wfe().
+    uint32_t loop();
+
+    // Run callback(context) from loop() after delayMs, then every periodMs if
+    // that is not 0. Returns a timer ID for cancelTimer(), or 0 if all
+    // FCM_MAX_TIMERS timers are in use. Call from loop() context only, not
+    // from interrupts or BLE callbacks.
+    uint32_t scheduleTimer(uint32_t delayMs, FCMTimerCallback callback, void *context = nullptr, uint32_t periodMs = 0);
+
+    // Stop a timer started with scheduleTimer()
+    bool cancelTimer(uint32_t id);
 
     // Save a new WiFi network configuration
     bool saveNetwork(const char *ssid, const char *password);
@@ -67,8 +455,8 @@ public:
     // Connect to stored WiFi networks (try each one until successful)
     bool connectToStoredNetworks();
 
-    // Connect to a specific network
-    void connectToNetwork(const char *ssid, const char *password);
+    // Connect to a specific network, optionally to one access point of it
+    void connectToNetwork(const char *ssid, const char *password, const uint8_t *bssid = nullptr);
 
     // Erase all stored WiFi networks
     bool clearNetworks();
@@ -103,6 +491,18 @@ public:
     // Get the RSSI of the current WiFi connection
     int32_t getRSSI();
 
+    // Watch the smoothed RSSI from loop(), scan in the background when it is
+    // weak or the link is down, and switch to a stronger stored network (or
+    // access point of the same network) when no send is due. Pass nullptr
+    // for the defaults.
+    void enableRoaming(const FCMRoamingConfig *config = nullptr);
+
+    // Stop roaming; the link counters keep running
+    void disableRoaming();
+
+    // Get the roaming and link counters
+    FCMRoamingStats getRoamingStats();
+
     // Handle BLE device connection events
     void handleDeviceConnected(BLEStatus status, BLEDevice *device);
 
@@ -115,12 +515,180 @@ public:
     // Handle BLE GATT read events
     uint16_t handleGattRead(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size);
 
+    // Handle HCI, security manager and GATT client events used to track the BLE link
+    void handleHciEvent(uint8_t packetType, uint8_t *packet, uint16_t size);
+
     // Update the pairing status characteristic
     void updatePairingStatusCharacteristic(bool isPaired);
+
+    // Request a larger MTU and a short connection interval while provisioning (default on)
+    void enableFastProvisioningLink(bool enable);
+
+    // Get the negotiated BLE link parameters
+    FCMBleLinkInfo getBLELinkInfo();
+
+    // Get the number of phones whose bonding keys are stored
+    uint8_t getBondedPeerCount();
+
+    // Forget all stored bonding keys; phones must pair again
+    void clearBondedPeers();
+
+    // Keep the BLE link up while joining WiFi and report progress on the WiFi
+    // Status characteristic; the link is dropped when the app sends CMD_ACK_STATUS
+    void setBLECoexistence(bool enable);
+
+    // Time from BLE connection to WiFi connected for the last provisioning, 0 if none
+    uint32_t getLastProvisioningDurationMs();
+
+    // Bring up BLE and start advertising if staged startup deferred it.
+    // Returns false if begin() has not been called.
+    bool beginBLE();
+
+    // micros() when a boot phase was reached, or 0 if it has not been.
+    // Phases reached after about 71 minutes wrap around.
+    uint32_t getBootPhaseUs(FCMBootPhase phase);
+
+    // Print the boot timeline with the time between phases
+    void printBootTimeline();
     
     // Send an FCM notification to the connected device
     bool sendNotification(const char *title, const char *body);
 
+    // Send a notification with a LittleFS file attached (Cloud Function mode only).
+    // The file is streamed base64-encoded with chunked transfer encoding through
+    // fixed buffers, so RAM use does not depend on its size. Not retried.
+    bool sendNotificationWithAttachment(const char *title, const char *body, const char *path);
+
+    // Same, with the attachment produced by a reader callback
+    bool sendNotificationWithAttachment(const char *title, const char *body, const char *name,
+                                        FCMAttachmentReader reader, void *context);
+
+    // Register a notification template whose title and body may contain the
+    // placeholders {0} to {3}. Returns a template ID, or 0 if the template is
+    // too long, uses an invalid placeholder or all slots are taken.
+    uint8_t prepareNotification(const char *title, const char *body);
+
+    // Send a prepared notification, filling its placeholders from values
+    bool sendPreparedNotification(uint8_t id, const FCMSlotValue *values = nullptr, uint8_t count = 0);
+
+    // Free a template ID
+    void releasePreparedNotification(uint8_t id);
+
+    // Sync the clock over SNTP once WiFi connects, so notifications carry
+    // wall-clock timestamps (always on in direct mode)
+    void enableTimeSync(bool enable);
+
+    // Select how notifications are delivered (Cloud Function or direct FCM HTTP v1)
+    void setDeliveryMode(FCMDeliveryMode mode);
+
+    // Get the current delivery mode
+    FCMDeliveryMode getDeliveryMode();
+
+    // Select the request body format used in Cloud Function mode. MessagePack
+    // needs a function that supports token registration; the device falls back
+    // to JSON if the function rejects it. Prepared and attachment sends stay JSON.
+    void setWireFormat(FCMWireFormat format);
+
+    // Get the selected wire format
+    FCMWireFormat getWireFormat();
+
+    // Set the service account used to sign OAuth JWTs in direct mode.
+    // The private key PEM is referenced, not copied, so it must stay valid.
+    bool setServiceAccount(const char *projectId, const char *clientEmail, const char *privateKeyPem);
+
+    // Override the OAuth token and FCM API endpoints (e.g. for a local stand-in server)
+    void setDirectEndpoints(const char *tokenUrl, const char *fcmApiUrl);
+
+    // Drop the cached OAuth access token from RAM and flash
+    void invalidateAccessToken();
+
+    // Select how server certificates are verified
+    void setTlsMode(FCMTlsMode mode);
+
+    // Get the current TLS verification mode
+    FCMTlsMode getTlsMode();
+
+    // Pin the server public key (DER SubjectPublicKeyInfo, e.g. from tools/gen_tls_pins.py).
+    // The data is referenced, not copied, so keep it in flash-resident constexpr storage.
+    bool setPinnedPublicKey(const uint8_t *der, size_t length);
+
+    // Set the trust anchor certificate (DER) used for full chain validation.
+    // The data is referenced, not copied, so keep it in flash-resident constexpr storage.
+    bool setTrustAnchor(const uint8_t *der, size_t length);
+
+    // Apply the current TLS verification settings to a client
+    void configureTlsClient(WiFiClientSecure &client);
+
+    // Queue a notification for delivery from loop() with retries.
+    // Returns the notification ID, or 0 if the queue is full or the input is invalid.
+    uint32_t queueNotification(const char *title, const char *body, const FCMRetryPolicy *policy = nullptr);
+
+    // Remove a queued notification before it is delivered
+    bool cancelNotification(uint32_t id);
+
+    // Get the number of notifications waiting in the queue
+    uint8_t getQueueDepth();
+
+    // Set the retry policy used when queueNotification() is given none
+    void setDefaultRetryPolicy(const FCMRetryPolicy &policy);
+
+    // Space queued send attempts at least minIntervalMs apart (0 for no limit).
+    // sendNotification() is not limited.
+    void setQueueRateLimit(uint32_t minIntervalMs);
+
+    // Attempt every queued notification now instead of waiting out its backoff
+    void flushQueue();
+
+    // Apply the commands the Cloud Function returns in its responses
+    // ({"cmd": [...]}) from loop(). Off by default; the url and token commands
+    // are rejected while the TLS mode is FCM_TLS_INSECURE.
+    void enableRemoteCommands(bool enable);
+
+    // Set callback for commands the library does not know; return true if applied
+    void setRemoteCommandCallback(bool (*callback)(const char *name, const char *argument));
+
+    // Send a heartbeat to the Cloud Function when no request was answered for
+    // intervalMs, so idle devices still pick up commands (0 turns it off)
+    void setHeartbeatInterval(uint32_t intervalMs);
+
+    // Get the heartbeat and command counters
+    FCMRemoteStats getRemoteStats();
+
+    // Set callback for the final outcome of each queued notification
+    void setNotificationResultCallback(void (*callback)(uint32_t id, FCMSendResult result, uint8_t attempts));
+
+    // Get the outcome of the most recent send attempt
+    FCMSendResult getLastSendResult();
+
+    // Get the send counters
+    const FCMSendStats &getSendStats();
+
+    // Reset the send counters
+    void resetSendStats();
+
+    // Set how long resolved endpoint addresses and failed lookups are cached
+    void setDnsCacheTtl(uint32_t ttlMs, uint32_t negativeTtlMs);
+
+    // Resolve the endpoint hosts now (done automatically once WiFi connects)
+    void preResolveEndpoints();
+
+    // Forget cached endpoint addresses, including the persisted ones
+    void clearDnsCache();
+
+    // Serve Prometheus metrics at http://<device>:<port>/metrics, from loop()
+    bool beginMetricsServer(uint16_t port = FCM_METRICS_DEFAULT_PORT);
+
+    // Stop the metrics server
+    void stopMetricsServer();
+
+    // Accept binary provisioning frames (see tools/serial_provision.py) on a
+    // serial port, USB-CDC by default, from loop(). The port must not be
+    // read by the sketch while this is enabled.
+    bool beginSerialProvisioning(Stream &port = Serial);
+
+    // Stop accepting provisioning frames
+    void stopSerialProvisioning();
+
 private:
     // Track the currently connected device
     BLEDevice *_connectedDevice;
@@ -136,6 +704,7 @@ private:
 
     // Track connection attempt start time
     unsigned long _connectionStartTime;
+    uint32_t _joinCount; // Bumped by every connectToNetwork()
 
     // WiFi connection timeout (15 seconds)
     static const unsigned long WIFI_CONNECT_TIMEOUT_MS = 15000;
@@ -153,12 +722,16 @@ private:
     UUID _pairingStatusCharUUID;
     UUID _fcmUrlCharUUID;
     UUID _fcmTokenCharUUID;
+    UUID _wifiStatusCharUUID;
+    UUID _deviceStatusCharUUID;
     uint16_t _ssidCharHandle;
     uint16_t _passwordCharHandle;
     uint16_t _commandCharHandle;
     uint16_t _pairingStatusCharHandle;
     uint16_t _fcmUrlCharHandle;
     uint16_t _fcmTokenCharHandle;
+    uint16_t _wifiStatusCharHandle;
+    uint16_t _deviceStatusCharHandle;
 
     // Flag for allowing provisioning when already connected
     bool _allowProvisioningWhenConnected;
@@ -190,10 +763,311 @@ private:
     // Process WiFi commands
     void processCommand(uint8_t command);
 
+    // BLE link tuning
+    bool _fastBLELinkEnabled;
+    uint16_t _bleConHandle;
+    FCMBleLinkInfo _bleLinkInfo;
+    unsigned long _lastBLEActivity;
+
+    // Request fast (provisioning) or relaxed (idle) connection parameters
+    void requestBLEConnectionParameters(bool fast);
+
+    // Bonded peers, most recently used first
+    FCMBondRecord _bonds[MAX_BONDED_PEERS];
+    uint8_t _bondCount;
+    unsigned long _bleConnectedAt;
+    bool _pairingExchangeSeen;
+
+    // Restore stored bonds into the BTstack device database
+    bool loadBondsFromFlash();
+
+    // Persist the stored bonds
+    bool saveBondsToFlash();
+
+    // Record the bond used by a connection as the most recently used one
+    void rememberBond(uint16_t conHandle);
+
+    // Staged startup and boot timeline
+    FCMStartupMode _startupMode;
+    bool _begun;
+    bool _bleStarted;
+    bool _stagedJoinPending; // The join started by begin() has no outcome yet
+    char _bleDeviceName[FCM_BLE_DEVICE_NAME_LENGTH + 1];
+    BLESecurityLevel _bleSecurityLevel;
+    io_capability_t _bleIoCapability;
+    uint32_t _bootTimeline[FCM_BOOT_PHASE_COUNT];
+
+    // Record the first time a boot phase is reached
+    void markBootPhase(FCMBootPhase phase);
+
+    // BLE/WiFi coexistence
+    bool _bleCoexistence;
+    uint8_t _wifiStatusCode;
+    unsigned long _awaitingAckSince; // 0 when no acknowledgement is pending
+    unsigned long _provisioningStartTime;
+    uint32_t _lastProvisioningDurationMs;
+
+    // Push a WiFiStatusCodes value to the WiFi Status characteristic
+    void updateWiFiStatusCharacteristic(uint8_t statusCode);
+
+    // Drop the BLE link once provisioning has finished
+    void endProvisioningSession();
+
+    // Device Status characteristic state
+    FCMDeviceStatus _sentDeviceStatus; // Values the app last received
+    bool _deviceStatusSynced;          // False until a full snapshot was sent
+    bool _statusSnapshotRequested;
+    unsigned long _lastDeviceStatusChecked;
+
+    // Collect the current values for the Device Status record
+    void collectDeviceStatus(FCMDeviceStatus &status);
+
+    // Notify changed status fields, rate limited
+    void updateDeviceStatusCharacteristic();
+
     // Load configuration from flash
     bool loadConfigFromFlash();
-    // Save configuration to flash
+    // Save configuration to flash, with the endpoint received over BLE
     bool saveConfigToFlash();
+    // Save configuration to flash with the given endpoint; null or empty keeps the current value
+    bool saveConfigToFlash(const char *fcmUrl, const char *fcmToken);
+
+    // Direct FCM HTTP v1 delivery
+    FCMDeliveryMode _deliveryMode;
+    char _projectId[MAX_FCM_PROJECT_ID_LENGTH + 1];
+    char _clientEmail[MAX_SERVICE_ACCOUNT_EMAIL_LENGTH + 1];
+    const char *_privateKeyPem;
+    char _oauthTokenUrl[MAX_FCM_URL_LENGTH + 1];
+    char _fcmApiUrl[MAX_FCM_URL_LENGTH + 1];
+
+    // Cached OAuth access token and its expiry (seconds since epoch)
+    char _accessToken[MAX_OAUTH_TOKEN_LENGTH + 1];
+    time_t _accessTokenExpiry;
+    bool _accessTokenCacheChecked; // /fcm_oauth.json was read since boot
+
+    // Send a payload straight to the FCM HTTP v1 API
+    FCMSendResult sendDirectNotification(const FCMJsonWriter &payload, uint32_t *retryAfterMs);
+
+    // Make sure a valid access token is cached, fetching one if needed
+    FCMSendResult ensureAccessToken(uint32_t *retryAfterMs);
+
+    // Build and sign the service account JWT assertion
+    bool buildSignedJwt(char *out, size_t outSize);
+
+    // Exchange a signed JWT for an OAuth access token
+    FCMSendResult requestAccessToken(uint32_t *retryAfterMs);
+
+    // Load/save the cached access token from/to flash
+    bool loadAccessTokenFromFlash();
+    bool saveAccessTokenToFlash();
+
+    // Start SNTP so JWTs and notifications can be stamped with wall-clock time
+    void startTimeSync();
+    bool _timeSyncEnabled;
+
+    // Sequence number for the next notification
+    uint32_t _nextSequence;
+
+    // Stamp a notification with the next sequence number and the current time
+    FCMNotificationStamp stampNotification();
+
+    // TLS verification settings, parsed once and reused for every handshake
+    FCMTlsMode _tlsMode;
+    BearSSL::PublicKey *_pinnedKey;
+    BearSSL::X509List *_trustAnchors;
+
+    // TLS client reused by every request, so a send does not allocate one;
+    // recreated when the verification settings change
+    WiFiClientSecure *_tlsClient;
+    bool _tlsClientStale;
+    WiFiClientSecure &tlsClient();
+
+    // Notification payloads are serialized here instead of into a String
+    char _payloadBuffer[FCM_PAYLOAD_BUFFER_SIZE];
+
+    // Retry engine state
+    FCMQueuedNotification _queue[MAX_QUEUED_NOTIFICATIONS];
+    uint32_t _nextNotificationId;
+    FCMRetryPolicy _defaultRetryPolicy;
+    FCMSendStats _sendStats;
+    FCMSendResult _lastSendResult;
+    void (*_notificationResultCallback)(uint32_t id, FCMSendResult result, uint8_t attempts);
+
+    // POST a payload to the provisioned Cloud Function, followed by a streamed attachment if given
+    FCMSendResult sendCloudFunctionNotification(const FCMJsonWriter &payload, uint32_t *retryAfterMs, FCMAttachmentStream *attachment);
+
+    // Raw attachment bytes of the chunk being encoded
+    uint8_t _attachmentBuffer[FCM_ATTACHMENT_CHUNK_SIZE];
+    FCMSendResult attemptAttachmentSend(const char *title, const char *body, const char *name,
+                                        FCMAttachmentReader reader, void *context,
+                                        const FCMNotificationStamp &stamp, uint32_t *retryAfterMs);
+
+    // Bumped whenever the delivery mode, URLs or token change; cached
+    // headers and template fragments built for an older value are rebuilt
+    uint32_t _endpointGeneration;
+    FCMHttpPreparedHead _sendHead;
+    uint32_t _sendHeadGeneration;
+    const FCMHttpPreparedHead *sendHead();
+
+    // Payload JSON of the current delivery mode: up to the opening quote of
+    // the title, and from after the body to the end (stamp included)
+    void writePayloadStart(FCMJsonWriter &payload);
+    void writePayloadEnd(FCMJsonWriter &payload, const FCMNotificationStamp &stamp);
+
+    // Send a rendered payload over the current delivery path and record the outcome
+    FCMSendResult postPayload(const FCMJsonWriter &payload, uint32_t *retryAfterMs, FCMAttachmentStream *attachment = nullptr);
+
+    // Count an attempt and its outcome in the send statistics
+    void recordSendResult(FCMSendResult result, unsigned long startedAt);
+
+    // Compact wire format: token ID assigned by the Cloud Function, and the
+    // CRC of the URL and token it was issued for
+    FCMWireFormat _wireFormat;
+    uint32_t _tokenId; // 0 until registered
+    uint32_t _tokenIdCrc;
+    bool _tokenIdLoaded;
+    uint32_t _compactRejectedGeneration; // Endpoint generation whose function refused registration
+    FCMHttpPreparedHead _compactHead;
+    uint32_t _compactHeadGeneration;
+    const FCMHttpPreparedHead *compactHead();
+
+    // MessagePack is selected and the current endpoint has not refused it
+    bool compactWireActive();
+
+    // Send a notification as a MessagePack request, registering the token first if needed
+    FCMSendResult attemptCompactSend(const char *title, const char *body, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs);
+
+    // Send a heartbeat as a MessagePack request
+    FCMSendResult sendCompactHeartbeat(uint32_t *retryAfterMs);
+
+    // Make sure a token ID for the current URL and token is known
+    FCMSendResult ensureTokenId(uint32_t *retryAfterMs);
+    uint32_t tokenIdCrc();
+
+    // Load/save the token ID from/to flash
+    bool loadTokenIdFromFlash();
+    bool saveTokenIdToFlash();
+
+    // Prepared notification templates
+    FCMPreparedNotification _prepared[MAX_PREPARED_NOTIFICATIONS];
+    bool compilePreparedNotification(FCMPreparedNotification &prepared);
+    FCMSendResult attemptPreparedSend(FCMPreparedNotification &prepared, const FCMSlotValue *values, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs);
+
+    // Cached addresses of the endpoint hosts
+    FCMDnsCache _dnsCache;
+
+    // Make one send attempt and classify its outcome
+    FCMSendResult attemptSend(const char *title, const char *body, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs);
+
+    // Run at most one due attempt from the queue
+    void processNotificationQueue();
+
+    // Point the queue timer at the next retry or deadline
+    void armQueueTimer();
+
+    // Queue pacing set by setQueueRateLimit()
+    uint32_t _queueMinIntervalMs;
+    unsigned long _lastQueueAttemptAt;
+    bool _queueAttempted;
+    uint32_t queuePacingMs(unsigned long now); // Time until the next attempt is allowed
+
+    // Downstream commands and heartbeats
+    bool _remoteCommandsEnabled;
+    bool (*_remoteCommandCallback)(const char *name, const char *argument);
+    char _commandBuffer[FCM_COMMAND_BUFFER_SIZE]; // NUL-separated commands waiting for loop()
+    size_t _commandLength;
+    uint32_t _heartbeatIntervalMs;
+    FCMRemoteStats _remoteStats;
+
+    // Keep the commands parsed from an answered request for loop(), and
+    // push the next heartbeat back
+    void acceptCommands(const FCMCommandParser &commands, FCMSendResult result);
+    void applyRemoteCommands();
+    bool applyRemoteCommand(char *command);
+    FCMSendResult sendHeartbeat();
+
+    // Store a new URL and/or token (nullptr keeps the current one)
+    bool saveEndpoint(const char *url, const char *token);
+
+    // Load/save the settings changed by commands from/to flash
+    bool loadRemoteConfigFromFlash();
+    bool saveRemoteSetting(const char *key, uint32_t value);
+
+    // Timers of the library's own housekeeping, run from loop(). The join
+    // timeout is armed from loop() because joins can start in a BLE callback.
+    FCMTimerWheel _timers;
+    uint32_t _connectTimer;
+    uint32_t _connectTimerJoin; // _joinCount the connect timer was armed for
+    uint32_t _queueTimer;
+    uint32_t _heapSampleTimer;
+    uint32_t _commandTimer;
+    uint32_t _heartbeatTimer;
+    static void onConnectTimeout(void *self);
+    static void onQueueTimer(void *self);
+    static void onHeapSampleTimer(void *self);
+    static void onCommandTimer(void *self);
+    static void onHeartbeatTimer(void *self);
+
+    // Remove a queued notification and report its final outcome
+    void finishQueuedNotification(FCMQueuedNotification &entry, FCMSendResult result);
+
+    // Metrics endpoint, at most one scrape connection at a time
+    WiFiServer *_metricsServer;
+    WiFiClient _metricsClient;
+    unsigned long _metricsRequestStart;
+    char _metricsRequestLine[32];
+    uint8_t _metricsRequestLength;
+    uint8_t _metricsHeaderEndMatch; // Progress through the blank line ending the headers
+
+    // Runtime counters exported as metrics
+    uint32_t _loopCount;
+    uint64_t _loopTotalUs;
+    uint32_t _loopMaxUs; // Since the last scrape
+    uint32_t _wifiReconnects;
+    bool _wifiWasConnected;
+    uint32_t _heapFreeMin;
+
+    // Accept, read and answer scrape requests without blocking
+    void serviceMetricsServer();
+
+    // Render all metrics
+    void writeMetrics(FCMMetricsWriter &writer);
+
+    // Serial provisioning
+    Stream *_provisionPort;
+    FCMProvisionReceiver *_provisionReceiver;
+    unsigned long _provisionFrameStart;
+
+    // Read provisioning frames and answer each one without blocking
+    void serviceSerialProvisioning();
+
+    // Validate a received configuration and store it as processCommand() does.
+    // Returns an FCMProvisionStatus.
+    uint8_t applyProvisionFrame(const FCMProvisionReceiver &receiver, uint8_t &flags);
+
+    // Roaming monitor
+    bool _roamingEnabled;
+    FCMRoamingConfig _roamingConfig;
+    FCMRoamingStats _roamingStats;
+    int32_t _roamRssiQ4; // Smoothed RSSI in 1/16 dB
+    bool _roamRssiValid;
+    unsigned long _lastRoamSample;
+    unsigned long _lastRoamScan;
+    bool _roamScanRunning;
+    int8_t _roamCandidate; // Index into _networks, or -1
+    uint8_t _roamCandidateBssid[6];
+    unsigned long _roamCandidateAt;
+    int8_t _roamFromNetwork; // Network to go back to if a roam fails, or -1
+    unsigned long _wifiDownSince; // 0 while the link is up
+
+    // Sample RSSI, run scans and roam, from loop()
+    void serviceRoaming();
+
+    // Pick the strongest stored network in the finished scan
+    void finishRoamScan(int32_t smoothedRssi, bool linkUp);
+
+    // No queued send, scrape, BLE session or provisioning frame is in progress or due
+    bool roamingIsQuiet(unsigned long now);
 
 };
 
@@ -209,7 +1083,8 @@ enum WiFiCommands
     CMD_GET_STATUS = 0x04,
     CMD_DISCONNECT = 0x05,
     CMD_START_SCAN = 0x06,
-    CMD_GET_SCAN_RESULTS = 0x07
+    CMD_GET_SCAN_RESULTS = 0x07,
+    CMD_ACK_STATUS = 0x08
 };
 
 // Status codes for the status characteristic
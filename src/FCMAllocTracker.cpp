@@ -0,0 +1,190 @@
+/**
+ * FCMAllocTracker.cpp - Opt-in heap allocation tracking for PicoFCMNotifier.
+ */
+
+#include "FCMAllocTracker.h"
+#include "FCMJsonAllocator.h"
+
+static FCMAllocStats allocStats[FCM_ALLOC_API_COUNT];
+
+#ifdef PICO_FCM_ALLOC_TRACKING
+
+#include <malloc.h>
+#include <new>
+
+// Nesting depth is bounded by the call graph (loop -> command -> storage, ...)
+#define FCM_ALLOC_SCOPE_DEPTH 8
+
+static FCMAllocApi scopeStack[FCM_ALLOC_SCOPE_DEPTH];
+static int32_t nestedHeapDelta[FCM_ALLOC_SCOPE_DEPTH]; // Heap growth of the scopes nested in each level
+static uint8_t scopeDepth = 0;
+static int32_t heapUsedEstimate = 0; // Heap in use, kept current between mallinfo() samples
+static bool checkArmed = false;
+static void (*violationCallback)(FCMAllocApi api, uint32_t bytes) = nullptr;
+static uint32_t violationCount = 0;
+
+// API of the innermost scope; scopes nested past the stack depth count towards the deepest one kept
+static FCMAllocApi currentApi() { return scopeStack[(scopeDepth < FCM_ALLOC_SCOPE_DEPTH ? scopeDepth : FCM_ALLOC_SCOPE_DEPTH) - 1]; }
+
+static bool isChecked(FCMAllocApi api) { return api == FCM_ALLOC_API_LOOP || api == FCM_ALLOC_API_SEND; }
+
+static void reportViolation(FCMAllocApi api, uint32_t bytes)
+{
+    violationCount++;
+    if (violationCallback) violationCallback(api, bytes);
+}
+
+// Called with the block malloc() returned; the estimate moves by the usable
+// size on both sides, as that is what the heap actually hands out
+static void *recordAllocation(void *ptr, size_t size)
+{
+    if (scopeDepth == 0 || !ptr) return ptr;
+    FCMAllocApi api = currentApi();
+    FCMAllocStats &stats = allocStats[api];
+    stats.allocations++;
+    stats.bytesAllocated += size;
+    heapUsedEstimate += malloc_usable_size(ptr);
+    if (heapUsedEstimate > (int32_t)stats.peakHeapUsed) stats.peakHeapUsed = heapUsedEstimate;
+    if (checkArmed && isChecked(api)) reportViolation(api, size);
+    return ptr;
+}
+
+// Called before the block is freed or reallocated
+static void recordFree(void *ptr)
+{
+    if (scopeDepth == 0 || !ptr) return;
+    allocStats[currentApi()].frees++;
+    heapUsedEstimate -= malloc_usable_size(ptr);
+}
+
+FCMAllocScope::FCMAllocScope(FCMAllocApi api) : _api(api)
+{
+    _heapUsedAtStart = mallinfo().uordblks;
+    heapUsedEstimate = _heapUsedAtStart;
+    if (scopeDepth < FCM_ALLOC_SCOPE_DEPTH)
+    {
+        scopeStack[scopeDepth] = api;
+        nestedHeapDelta[scopeDepth] = 0;
+    }
+    scopeDepth++;
+    allocStats[api].calls++;
+}
+
+FCMAllocScope::~FCMAllocScope()
+{
+    scopeDepth--;
+    uint32_t heapUsed = mallinfo().uordblks;
+    heapUsedEstimate = heapUsed;
+
+    FCMAllocStats &stats = allocStats[_api];
+    stats.lastHeapDelta = (int32_t)(heapUsed - _heapUsedAtStart);
+    if (heapUsed > stats.peakHeapUsed) stats.peakHeapUsed = heapUsed;
+
+    // Nested scopes answer for their own growth (e.g. TLS buffers kept for
+    // the next connection), so only what is left counts against this one
+    int32_t ownHeapDelta = stats.lastHeapDelta;
+    if (scopeDepth < FCM_ALLOC_SCOPE_DEPTH) ownHeapDelta -= nestedHeapDelta[scopeDepth];
+    if (scopeDepth > 0 && scopeDepth <= FCM_ALLOC_SCOPE_DEPTH) nestedHeapDelta[scopeDepth - 1] += stats.lastHeapDelta;
+
+    // Growth that no counted allocation explains (e.g. String or lwIP via malloc)
+    if (checkArmed && isChecked(_api) && ownHeapDelta > 0) reportViolation(_api, ownHeapDelta);
+}
+
+bool fcmAllocTrackingEnabled() { return true; }
+
+void fcmArmAllocCheck(void (*onViolation)(FCMAllocApi api, uint32_t bytes))
+{
+    violationCallback = onViolation;
+    violationCount = 0;
+    checkArmed = true;
+}
+
+void fcmDisarmAllocCheck() { checkArmed = false; }
+uint32_t fcmGetAllocViolations() { return violationCount; }
+
+void *FCMJsonAllocator::allocate(size_t size) { return recordAllocation(malloc(size), size); }
+
+void FCMJsonAllocator::deallocate(void *ptr)
+{
+    recordFree(ptr);
+    free(ptr);
+}
+
+void *FCMJsonAllocator::reallocate(void *ptr, size_t newSize)
+{
+    recordFree(ptr);
+    void *result = realloc(ptr, newSize);
+    if (!result && ptr && scopeDepth > 0) heapUsedEstimate += malloc_usable_size(ptr); // The old block is still in use
+    return recordAllocation(result, newSize);
+}
+
+// Replace the global allocation operators so every new/delete is counted
+void *operator new(size_t size) { return recordAllocation(malloc(size ? size : 1), size); }
+
+void *operator new[](size_t size) { return recordAllocation(malloc(size ? size : 1), size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return recordAllocation(malloc(size ? size : 1), size); }
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return recordAllocation(malloc(size ? size : 1), size); }
+
+void operator delete(void *ptr) noexcept
+{
+    recordFree(ptr);
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    recordFree(ptr);
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    recordFree(ptr);
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    recordFree(ptr);
+    free(ptr);
+}
+
+#else
+
+bool fcmAllocTrackingEnabled() { return false; }
+void fcmArmAllocCheck(void (*onViolation)(FCMAllocApi api, uint32_t bytes)) {}
+void fcmDisarmAllocCheck() {}
+uint32_t fcmGetAllocViolations() { return 0; }
+
+void *FCMJsonAllocator::allocate(size_t size) { return malloc(size); }
+void FCMJsonAllocator::deallocate(void *ptr) { free(ptr); }
+void *FCMJsonAllocator::reallocate(void *ptr, size_t newSize) { return realloc(ptr, newSize); }
+
+#endif // PICO_FCM_ALLOC_TRACKING
+
+const FCMAllocStats &fcmGetAllocStats(FCMAllocApi api)
+{
+    if (api >= FCM_ALLOC_API_COUNT) api = FCM_ALLOC_API_LOOP;
+    return allocStats[api];
+}
+
+void fcmResetAllocStats() { memset(allocStats, 0, sizeof(allocStats)); }
+
+const char *fcmAllocApiToString(FCMAllocApi api)
+{
+    switch (api)
+    {
+    case FCM_ALLOC_API_LOOP: return "loop";
+    case FCM_ALLOC_API_SEND: return "send";
+    case FCM_ALLOC_API_TLS: return "tls";
+    case FCM_ALLOC_API_OAUTH: return "oauth";
+    case FCM_ALLOC_API_STORAGE: return "storage";
+    case FCM_ALLOC_API_COMMAND: return "command";
+    case FCM_ALLOC_API_METRICS: return "metrics";
+    default: return "unknown";
+    }
+}
+
+FCMJsonAllocator FCMJsonAllocator::_instance;
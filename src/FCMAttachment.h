@@ -0,0 +1,46 @@
+/**
+ * FCMAttachment.h - Streams a notification payload with an attachment.
+ *
+ * Produces the request body as the payload JSON up to the attachment
+ * value, the attachment base64-encoded one chunk at a time, and the rest of
+ * the payload. Only fixed buffers are used, so any attachment size needs
+ * the same RAM. Internal to the library.
+ */
+
+#ifndef FCM_ATTACHMENT_H
+#define FCM_ATTACHMENT_H
+
+#include "PicoFCMNotifier.h"
+
+// Longest payload ending (closing quote, stamp and braces)
+#define FCM_ATTACHMENT_SUFFIX_SIZE 96
+
+struct FCMAttachmentStream
+{
+    FCMAttachmentReader reader;
+    void *context;
+
+    const char *prefix; // Payload JSON up to the opening quote of the attachment value
+    size_t prefixLength;
+    char suffix[FCM_ATTACHMENT_SUFFIX_SIZE];
+    size_t suffixLength;
+
+    uint8_t *raw;     // Bytes read from the reader
+    size_t rawSize;   // A multiple of 3
+    char *encoded;    // Base64 output, may reuse the prefix buffer once it is sent
+    uint8_t carry[2]; // Bytes left over when a read is not a multiple of 3
+    uint8_t carryLength;
+
+    uint8_t stage;
+    uint32_t bytesRead;
+};
+
+// Prepare a stream; prefix, raw and encoded must stay valid while it is read
+void fcmAttachmentStreamInit(FCMAttachmentStream &stream, FCMAttachmentReader reader, void *context,
+                             const char *prefix, size_t prefixLength,
+                             uint8_t *raw, size_t rawSize, char *encoded);
+
+// FCMBodyReader over an FCMAttachmentStream
+int fcmAttachmentBodyReader(void *context, const uint8_t **data);
+
+#endif // FCM_ATTACHMENT_H
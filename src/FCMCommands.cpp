@@ -0,0 +1,126 @@
+/**
+ * FCMCommands.cpp - Bounded streaming parser for downstream commands.
+ */
+
+#include "FCMCommands.h"
+
+static const char COMMANDS_KEY[] = "cmd";
+
+FCMCommandParser::FCMCommandParser(char *buffer, size_t size) : _buffer(buffer),
+                                                                _size(size),
+                                                                _length(0),
+                                                                _write(0),
+                                                                _count(0),
+                                                                _dropped(0),
+                                                                _depth(0),
+                                                                _keyLength(0),
+                                                                _inString(false),
+                                                                _escape(false),
+                                                                _expectKey(false),
+                                                                _inKey(false),
+                                                                _keyMatches(false),
+                                                                _cmdKey(false),
+                                                                _inCommands(false),
+                                                                _inCommand(false),
+                                                                _commandOk(false)
+{
+}
+
+void FCMCommandParser::sink(void *context, char c) { ((FCMCommandParser *)context)->feed(c); }
+
+void FCMCommandParser::feed(char c)
+{
+    if (_inString)
+    {
+        if (_escape)
+        {
+            _escape = false;
+            if (c == '"' || c == '\\' || c == '/') take(c);
+            else _commandOk = false; // \n, \uXXXX and friends have no place in a command
+            return;
+        }
+        if (c == '\\') _escape = true;
+        else if (c == '"') endString();
+        else take(c);
+        return;
+    }
+
+    switch (c)
+    {
+    case '"':
+        _inString = true;
+        if (_depth == 1 && _expectKey)
+        {
+            _inKey = true;
+            _keyLength = 0;
+            _keyMatches = true;
+        }
+        else if (_depth == 2 && _inCommands)
+        {
+            _inCommand = true;
+            _commandOk = true;
+            _write = _length;
+        }
+        break;
+    case '{':
+    case '[':
+        if (_depth == 1 && c == '[' && _cmdKey) _inCommands = true;
+        if (_depth < UINT8_MAX) _depth++;
+        if (_depth == 1) _expectKey = c == '{';
+        break;
+    case '}':
+    case ']':
+        if (_depth > 0) _depth--;
+        if (_depth <= 1) _inCommands = false;
+        break;
+    case ',':
+        if (_depth == 1)
+        {
+            _expectKey = true;
+            _cmdKey = false;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void FCMCommandParser::take(char c)
+{
+    if (_inKey)
+    {
+        if (_keyLength >= sizeof(COMMANDS_KEY) - 1 || COMMANDS_KEY[_keyLength] != c) _keyMatches = false;
+        if (_keyLength < UINT8_MAX) _keyLength++;
+    }
+    else if (_inCommand)
+    {
+        // Keep room for the terminator
+        if (_write + 1 < _size) _buffer[_write++] = c;
+        else _commandOk = false;
+    }
+}
+
+void FCMCommandParser::endString()
+{
+    _inString = false;
+    if (_inKey)
+    {
+        _inKey = false;
+        _expectKey = false;
+        _cmdKey = _keyMatches && _keyLength == sizeof(COMMANDS_KEY) - 1;
+    }
+    else if (_inCommand)
+    {
+        _inCommand = false;
+        if (!_commandOk)
+        {
+            if (_dropped < UINT8_MAX) _dropped++;
+        }
+        else if (_write > _length && _count < UINT8_MAX)
+        {
+            _buffer[_write++] = '\0';
+            _length = _write;
+            _count++;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * FCMCommands.h - Bounded streaming parser for downstream commands.
+ *
+ * The Cloud Function may answer a send with {"cmd": ["rate 30000", ...]}.
+ * The parser is fed the response body one byte at a time as it arrives and
+ * copies the strings of the top-level "cmd" array into a caller-owned
+ * buffer as NUL-terminated commands; everything else in the body is skipped
+ * with a few bytes of state. Commands that do not fit, or that use escapes
+ * other than \" \\ and \/, are dropped and counted. Internal to the library.
+ */
+
+#ifndef FCM_COMMANDS_H
+#define FCM_COMMANDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class FCMCommandParser
+{
+public:
+    FCMCommandParser(char *buffer, size_t size);
+
+    // Consume the next byte of the response body
+    void feed(char c);
+
+    // FCMBodySink adapter; context is the parser
+    static void sink(void *context, char c);
+
+    // Bytes of complete commands in the buffer, terminators included
+    size_t length() const { return _length; }
+
+    // Complete commands, and commands that were dropped
+    uint8_t count() const { return _count; }
+    uint8_t dropped() const { return _dropped; }
+
+private:
+    char *_buffer;
+    size_t _size;
+    size_t _length; // End of the last complete command
+    size_t _write;  // End of the command being copied
+    uint8_t _count;
+    uint8_t _dropped;
+    uint8_t _depth;
+    uint8_t _keyLength;
+    bool _inString;
+    bool _escape;
+    bool _expectKey;   // The next string at depth 1 is a key
+    bool _inKey;
+    bool _keyMatches;  // The key read so far is a prefix of "cmd"
+    bool _cmdKey;      // The current top-level value belongs to "cmd"
+    bool _inCommands;  // Inside the "cmd" array
+    bool _inCommand;
+    bool _commandOk;
+
+    void take(char c);
+    void endString();
+};
+
+#endif // FCM_COMMANDS_H
@@ -0,0 +1,163 @@
+/**
+ * FCMDnsCache.cpp - Small DNS result cache for the notifier's endpoint hosts.
+ */
+
+#include "FCMDnsCache.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include "FCMAllocTracker.h"
+#include "FCMJsonAllocator.h"
+
+FCMDnsCache::FCMDnsCache() : _ttlMs(FCM_DNS_DEFAULT_TTL_MS),
+                             _negativeTtlMs(FCM_DNS_DEFAULT_NEGATIVE_TTL_MS)
+{
+    memset(_entries, 0, sizeof(_entries));
+}
+
+void FCMDnsCache::setTtl(uint32_t ttlMs, uint32_t negativeTtlMs)
+{
+    _ttlMs = ttlMs;
+    _negativeTtlMs = negativeTtlMs;
+}
+
+FCMDnsCacheEntry &FCMDnsCache::entryFor(const char *host)
+{
+    FCMDnsCacheEntry *victim = &_entries[0];
+    for (int i = 0; i < FCM_DNS_CACHE_SIZE; i++)
+    {
+        if (strcmp(_entries[i].host, host) == 0) return _entries[i];
+        if (_entries[i].host[0] == '\0')
+        {
+            victim = &_entries[i];
+        }
+        else if (victim->host[0] != '\0' && _entries[i].lastUsed < victim->lastUsed)
+        {
+            victim = &_entries[i];
+        }
+    }
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->host, host, MAX_FCM_HOST_LENGTH);
+    return *victim;
+}
+
+bool FCMDnsCache::resolve(const char *host, IPAddress &address, bool &usedStale)
+{
+    usedStale = false;
+    if (!host || strlen(host) > MAX_FCM_HOST_LENGTH) return false;
+
+    unsigned long now = millis();
+    FCMDnsCacheEntry &entry = entryFor(host);
+    entry.lastUsed = now;
+
+    if (entry.resolved && now - entry.resolvedAt < _ttlMs)
+    {
+        address = IPAddress(entry.address);
+        return true;
+    }
+
+    // Within the negative TTL, skip the resolver and go straight to the fallback
+    bool lookupFailed = entry.failed && now - entry.failedAt < _negativeTtlMs;
+    if (!lookupFailed)
+    {
+        IPAddress resolved;
+        if (WiFi.hostByName(host, resolved))
+        {
+            uint32_t previous = entry.address;
+            entry.address = (uint32_t)resolved;
+            entry.resolvedAt = millis();
+            entry.resolved = true;
+            entry.failed = false;
+            address = resolved;
+            // Only touch flash when the address actually changed
+            if (entry.address != previous) saveToFlash();
+            return true;
+        }
+        entry.failed = true;
+        entry.failedAt = millis();
+        Serial.print("DNS lookup failed for ");
+        Serial.println(host);
+    }
+
+    if (entry.address != 0)
+    {
+        address = IPAddress(entry.address);
+        usedStale = true;
+        return true;
+    }
+    return false;
+}
+
+bool FCMDnsCache::refresh(const char *host, IPAddress &address, bool &usedStale)
+{
+    usedStale = false;
+    if (!host || strlen(host) > MAX_FCM_HOST_LENGTH) return false;
+
+    // Keep the address for the fallback, but make resolve() ask the resolver
+    FCMDnsCacheEntry &entry = entryFor(host);
+    entry.resolved = false;
+    entry.failed = false;
+    return resolve(host, address, usedStale);
+}
+
+void FCMDnsCache::clear()
+{
+    memset(_entries, 0, sizeof(_entries));
+    if (LittleFS.exists(FCM_DNS_CACHE_FILE))
+    {
+        LittleFS.remove(FCM_DNS_CACHE_FILE);
+    }
+}
+
+bool FCMDnsCache::loadFromFlash()
+{
+    if (!LittleFS.exists(FCM_DNS_CACHE_FILE)) return false;
+
+    File cacheFile = LittleFS.open(FCM_DNS_CACHE_FILE, "r");
+    if (!cacheFile) return false;
+
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, cacheFile);
+    cacheFile.close();
+    if (error) return false;
+
+    int count = 0;
+    for (JsonObject host : doc["hosts"].as<JsonArray>())
+    {
+        if (count >= FCM_DNS_CACHE_SIZE) break;
+        const char *name = host["host"];
+        const char *ip = host["ip"];
+        IPAddress address;
+        if (!name || !ip || strlen(name) > MAX_FCM_HOST_LENGTH || !address.fromString(ip)) continue;
+
+        FCMDnsCacheEntry &entry = _entries[count++];
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.host, name, MAX_FCM_HOST_LENGTH);
+        entry.address = (uint32_t)address;
+    }
+    return count > 0;
+}
+
+bool FCMDnsCache::saveToFlash()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    JsonArray hosts = doc["hosts"].to<JsonArray>();
+    for (int i = 0; i < FCM_DNS_CACHE_SIZE; i++)
+    {
+        if (_entries[i].host[0] == '\0' || _entries[i].address == 0) continue;
+        JsonObject host = hosts.add<JsonObject>();
+        host["host"] = _entries[i].host;
+        char ip[16];
+        IPAddress address(_entries[i].address);
+        snprintf(ip, sizeof(ip), "%u.%u.%u.%u", address[0], address[1], address[2], address[3]);
+        host["ip"] = ip;
+    }
+
+    File cacheFile = LittleFS.open(FCM_DNS_CACHE_FILE, "w");
+    if (!cacheFile) return false;
+
+    bool ok = serializeJson(doc, cacheFile) > 0;
+    cacheFile.close();
+    return ok;
+}
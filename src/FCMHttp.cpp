@@ -0,0 +1,336 @@
+/**
+ * FCMHttp.cpp - Minimal HTTPS POST transport used by PicoFCMNotifier.
+ */
+
+#include "FCMHttp.h"
+#include <strings.h>
+
+#define CONTENT_LENGTH_HEADER "Content-Length: "
+
+// Read one byte, waiting until the deadline. Returns -1 on timeout or close.
+static int readByte(WiFiClientSecure &client, unsigned long deadline)
+{
+    while (!client.available())
+    {
+        if (!client.connected() || (long)(millis() - deadline) >= 0) return -1;
+        delay(1);
+    }
+    return client.read();
+}
+
+// Read a CRLF terminated line without the line ending. Overlong lines are
+// truncated but fully consumed. Returns the stored length, or -1 on timeout.
+static int readLine(WiFiClientSecure &client, char *buf, size_t size, unsigned long deadline)
+{
+    size_t len = 0;
+    while (true)
+    {
+        int c = readByte(client, deadline);
+        if (c < 0) return -1;
+        if (c == '\n') break;
+        if (c != '\r' && len + 1 < size) buf[len++] = (char)c;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+static void storeBodyByte(FCMHttpResponse &response, int c)
+{
+    if (response.bodySink) response.bodySink(response.bodySinkContext, (char)c);
+    if (response.body && response.bodyLength + 1 < response.bodySize)
+    {
+        response.body[response.bodyLength++] = (char)c;
+    }
+}
+
+// Read the response body in whichever framing the server chose
+static bool readBody(WiFiClientSecure &client, FCMHttpResponse &response, long contentLength, bool chunked, unsigned long deadline)
+{
+    if (chunked)
+    {
+        char line[32];
+        while (true)
+        {
+            if (readLine(client, line, sizeof(line), deadline) < 0) return false;
+            unsigned long chunkSize = strtoul(line, nullptr, 16);
+            if (chunkSize == 0) break;
+            for (unsigned long i = 0; i < chunkSize; i++)
+            {
+                int c = readByte(client, deadline);
+                if (c < 0) return false;
+                storeBodyByte(response, c);
+            }
+            if (readLine(client, line, sizeof(line), deadline) < 0) return false;
+        }
+        // Skip optional trailers
+        while (readLine(client, line, sizeof(line), deadline) > 0)
+        {
+        }
+        return true;
+    }
+
+    if (contentLength >= 0)
+    {
+        for (long i = 0; i < contentLength; i++)
+        {
+            int c = readByte(client, deadline);
+            if (c < 0) return false;
+            storeBodyByte(response, c);
+        }
+        return true;
+    }
+
+    // No framing: the body ends when the server closes the connection
+    int c;
+    while ((c = readByte(client, deadline)) >= 0)
+    {
+        storeBodyByte(response, c);
+    }
+    return true;
+}
+
+// Map a failed WiFiClientSecure::connect() to the phase that failed
+static FCMSendResult classifyConnectFailure(WiFiClientSecure &client)
+{
+    int sslError = client.getLastSSLError();
+    if (sslError == BR_ERR_OK) return FCM_SEND_CONNECT_FAILED;
+    // Certificate errors, and a pinned key that does not match the server's signature
+    if ((sslError > BR_ERR_X509_OK && sslError < BR_ERR_RECV_FATAL_ALERT) || sslError == BR_ERR_BAD_SIGNATURE)
+    {
+        return FCM_SEND_CERT_REJECTED;
+    }
+    return FCM_SEND_TLS_FAILED;
+}
+
+static FCMSendResult classifyStatus(int statusCode)
+{
+    if (statusCode >= 200 && statusCode < 300) return FCM_SEND_OK;
+    if (statusCode == 429) return FCM_SEND_HTTP_429;
+    if (statusCode == 408) return FCM_SEND_TIMEOUT;
+    if (statusCode == 401 || statusCode == 403) return FCM_SEND_AUTH_FAILED;
+    if (statusCode >= 500) return FCM_SEND_HTTP_5XX;
+    return FCM_SEND_HTTP_4XX;
+}
+
+bool fcmParseUrl(const char *url, FCMUrl &out)
+{
+    static const char *scheme = "https://";
+    if (!url || strncmp(url, scheme, strlen(scheme)) != 0) return false;
+
+    const char *host = url + strlen(scheme);
+    const char *hostEnd = host;
+    while (*hostEnd && *hostEnd != ':' && *hostEnd != '/') hostEnd++;
+    size_t hostLen = hostEnd - host;
+    if (hostLen == 0 || hostLen > MAX_FCM_HOST_LENGTH) return false;
+    memcpy(out.host, host, hostLen);
+    out.host[hostLen] = '\0';
+
+    out.port = 443;
+    const char *path = hostEnd;
+    if (*path == ':')
+    {
+        char *portEnd;
+        unsigned long port = strtoul(path + 1, &portEnd, 10);
+        if (port == 0 || port > 65535) return false;
+        out.port = (uint16_t)port;
+        path = portEnd;
+    }
+    out.path = (*path == '/') ? path : "/";
+    return true;
+}
+
+// Write the body from its reader, one chunk per read
+static FCMSendResult writeChunkedBody(WiFiClientSecure &client, const FCMHttpRequest &request)
+{
+    char sizeLine[12];
+    for (;;)
+    {
+        const uint8_t *data = nullptr;
+        int length = request.bodyReader(request.bodyReaderContext, &data);
+        if (length < 0) return FCM_SEND_ATTACHMENT_FAILED;
+        if (length == 0) break;
+
+        int sizeLineLen = snprintf(sizeLine, sizeof(sizeLine), "%x\r\n", (unsigned)length);
+        bool written = client.write((const uint8_t *)sizeLine, sizeLineLen) == (size_t)sizeLineLen &&
+                       client.write(data, length) == (size_t)length &&
+                       client.print("\r\n") > 0;
+        if (!written) return FCM_SEND_CONNECT_FAILED;
+    }
+    return client.print("0\r\n\r\n") > 0 ? FCM_SEND_OK : FCM_SEND_CONNECT_FAILED;
+}
+
+bool fcmHttpPrepareHead(const char *url, const char *contentType, FCMHttpPreparedHead &out)
+{
+    FCMUrl parsed;
+    if (!fcmParseUrl(url, parsed))
+    {
+        Serial.println("Error: invalid endpoint URL (https:// required).");
+        return false;
+    }
+    strcpy(out.host, parsed.host);
+    out.port = parsed.port;
+
+    char contentTypeLine[64] = "";
+    if (contentType) snprintf(contentTypeLine, sizeof(contentTypeLine), "Content-Type: %s\r\n", contentType);
+
+    // Content-Length goes last so only its value is written per request
+    int length;
+    if (parsed.port == 443)
+    {
+        length = snprintf(out.text, sizeof(out.text),
+                          "POST %s HTTP/1.1\r\nHost: %s\r\n%sConnection: close\r\n" CONTENT_LENGTH_HEADER,
+                          parsed.path, parsed.host, contentTypeLine);
+    }
+    else
+    {
+        length = snprintf(out.text, sizeof(out.text),
+                          "POST %s HTTP/1.1\r\nHost: %s:%u\r\n%sConnection: close\r\n" CONTENT_LENGTH_HEADER,
+                          parsed.path, parsed.host, parsed.port, contentTypeLine);
+    }
+    if (length <= 0 || (size_t)length >= sizeof(out.text))
+    {
+        Serial.println("Error: endpoint URL too long.");
+        return false;
+    }
+    out.length = (uint16_t)length;
+    return true;
+}
+
+FCMSendResult fcmHttpPost(WiFiClientSecure &client, const FCMHttpRequest &request, FCMHttpResponse &response, FCMDnsCache *dnsCache)
+{
+    response.statusCode = 0;
+    response.retryAfterMs = 0;
+    response.bodyLength = 0;
+    if (response.body && response.bodySize > 0) response.body[0] = '\0';
+
+    FCMHttpPreparedHead localHead;
+    const FCMHttpPreparedHead *head = request.head;
+    if (!head)
+    {
+        if (!fcmHttpPrepareHead(request.url, request.contentType, localHead)) return FCM_SEND_NOT_CONFIGURED;
+        head = &localHead;
+    }
+
+    // Resolve separately so DNS failures are not reported as connect failures
+    IPAddress address;
+    bool usedStale = false;
+    bool resolved = dnsCache ? dnsCache->resolve(head->host, address, usedStale) : WiFi.hostByName(head->host, address);
+    if (!resolved)
+    {
+        return FCM_SEND_DNS_FAILED;
+    }
+
+    // Connect by name so SNI is sent; after a recent lookup lwIP answers it from
+    // its own table. Only when the resolver is failing do we dial the last good
+    // address directly, which works for servers that do not require SNI (not
+    // Google front ends, so not the Cloud Function or FCM endpoints).
+    client.setTimeout(FCM_HTTP_TIMEOUT_MS);
+    int connected;
+    {
+        // The handshake allocates the session buffers, released again by stop()
+        FCM_ALLOC_SCOPE(FCM_ALLOC_API_TLS);
+        connected = usedStale ? client.connect(address, head->port) : client.connect(head->host, head->port);
+    }
+    if (!connected && !usedStale && dnsCache && client.getLastSSLError() == BR_ERR_OK)
+    {
+        // connect() resolves the name again and may fail while our entry is
+        // still fresh; ask the resolver ourselves to tell DNS from TCP failures
+        client.stop();
+        if (!dnsCache->refresh(head->host, address, usedStale)) return FCM_SEND_DNS_FAILED;
+        if (usedStale)
+        {
+            FCM_ALLOC_SCOPE(FCM_ALLOC_API_TLS);
+            connected = client.connect(address, head->port);
+        }
+    }
+    if (!connected)
+    {
+        return classifyConnectFailure(client);
+    }
+
+    bool written;
+    if (request.bodyReader)
+    {
+        // Replace the trailing "Content-Length: " of the prepared head
+        size_t headLength = head->length - strlen(CONTENT_LENGTH_HEADER);
+        written = client.write((const uint8_t *)head->text, headLength) == headLength &&
+                  client.print("Transfer-Encoding: chunked\r\n") > 0;
+    }
+    else
+    {
+        char lengthLine[16];
+        int lengthLineLen = snprintf(lengthLine, sizeof(lengthLine), "%u\r\n", (unsigned)request.bodyLength);
+        written = client.write((const uint8_t *)head->text, head->length) == head->length &&
+                  client.write((const uint8_t *)lengthLine, lengthLineLen) == (size_t)lengthLineLen;
+    }
+    if (written && request.bearerToken)
+    {
+        size_t tokenLen = strlen(request.bearerToken);
+        written = client.print("Authorization: Bearer ") > 0 &&
+                  client.write((const uint8_t *)request.bearerToken, tokenLen) == tokenLen &&
+                  client.print("\r\n") > 0;
+    }
+    written = written && client.print("\r\n") > 0;
+    if (written && request.bodyReader)
+    {
+        FCMSendResult streamed = writeChunkedBody(client, request);
+        if (streamed != FCM_SEND_OK)
+        {
+            client.stop();
+            return streamed;
+        }
+    }
+    else if (written && request.bodyLength > 0)
+    {
+        written = client.write(request.body, request.bodyLength) == request.bodyLength;
+    }
+    if (!written)
+    {
+        client.stop();
+        return FCM_SEND_CONNECT_FAILED;
+    }
+
+    unsigned long deadline = millis() + FCM_HTTP_TIMEOUT_MS;
+    char line[160];
+    if (readLine(client, line, sizeof(line), deadline) < 0 || strncmp(line, "HTTP/1.", 7) != 0)
+    {
+        client.stop();
+        return FCM_SEND_TIMEOUT;
+    }
+    const char *status = strchr(line, ' ');
+    response.statusCode = status ? atoi(status + 1) : 0;
+
+    long contentLength = -1;
+    bool chunked = false;
+    int lineLen;
+    while ((lineLen = readLine(client, line, sizeof(line), deadline)) > 0)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            contentLength = atol(line + 15);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            chunked = strstr(line + 18, "chunked") != nullptr;
+        }
+        else if (strncasecmp(line, "Retry-After:", 12) == 0)
+        {
+            // Only the delay-seconds form is supported; HTTP dates fall back to backoff
+            const char *value = line + 12;
+            while (*value == ' ') value++;
+            if (*value >= '0' && *value <= '9') response.retryAfterMs = (uint32_t)atol(value) * 1000UL;
+        }
+    }
+    if (lineLen < 0)
+    {
+        client.stop();
+        return FCM_SEND_TIMEOUT;
+    }
+
+    // The status line decides the outcome even if the body is cut short
+    readBody(client, response, contentLength, chunked, deadline);
+    if (response.body && response.bodySize > 0) response.body[response.bodyLength] = '\0';
+    client.stop();
+
+    return classifyStatus(response.statusCode);
+}
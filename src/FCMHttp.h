@@ -0,0 +1,70 @@
+/**
+ * FCMHttp.h - Minimal HTTPS POST transport used by PicoFCMNotifier.
+ *
+ * Performs one request per connection in explicit phases (DNS, connect,
+ * TLS, request, response) so every failure can be classified into an
+ * FCMSendResult, and parses the status line and the few response headers
+ * the retry engine needs. Internal to the library.
+ */
+
+#ifndef FCM_HTTP_H
+#define FCM_HTTP_H
+
+#include "PicoFCMNotifier.h"
+
+// How long to wait for the server before giving up on a request
+#define FCM_HTTP_TIMEOUT_MS 10000
+
+// Parsed https:// endpoint URL
+typedef struct
+{
+    char host[MAX_FCM_HOST_LENGTH + 1];
+    uint16_t port;
+    const char *path; // Points into the parsed URL string
+} FCMUrl;
+
+// Streamed request body source. Points *data at the next chunk and returns
+// its length, 0 at the end of the body, or -1 if the source failed.
+typedef int (*FCMBodyReader)(void *context, const uint8_t **data);
+
+// Optional observer of the response body, called with every body byte as it
+// arrives, whether or not it fits into the body buffer
+typedef void (*FCMBodySink)(void *context, char c);
+
+// A single POST request
+typedef struct
+{
+    const char *url;
+    const char *contentType;
+    const char *bearerToken; // Optional OAuth token sent as "Authorization: Bearer"
+    const uint8_t *body;
+    size_t bodyLength;
+    const FCMHttpPreparedHead *head; // Optional cached headers; url and contentType are then unused
+    FCMBodyReader bodyReader;        // Optional: stream the body with chunked transfer encoding instead
+    void *bodyReaderContext;
+} FCMHttpRequest;
+
+// Response fields filled in by fcmHttpPost()
+typedef struct
+{
+    int statusCode;
+    uint32_t retryAfterMs; // 0 when the server sent no usable Retry-After
+    char *body;            // Optional caller buffer for the response body
+    size_t bodySize;
+    size_t bodyLength;     // Bytes stored in body (excluding the terminator)
+    FCMBodySink bodySink;  // Optional
+    void *bodySinkContext;
+} FCMHttpResponse;
+
+// Split an https:// URL into host, port and path
+bool fcmParseUrl(const char *url, FCMUrl &out);
+
+// Build the request line and fixed headers of POSTs to an endpoint
+// (contentType may be null to leave the Content-Type header out)
+bool fcmHttpPrepareHead(const char *url, const char *contentType, FCMHttpPreparedHead &out);
+
+// POST a request over an already configured TLS client and classify the outcome.
+// Host names are resolved through dnsCache when one is given.
+FCMSendResult fcmHttpPost(WiFiClientSecure &client, const FCMHttpRequest &request, FCMHttpResponse &response, FCMDnsCache *dnsCache = nullptr);
+
+#endif // FCM_HTTP_H
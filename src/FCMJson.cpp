@@ -0,0 +1,99 @@
+/**
+ * FCMJson.cpp - Allocation-free JSON writer for notification payloads.
+ */
+
+#include "FCMJson.h"
+#include <string.h>
+
+FCMJsonWriter::FCMJsonWriter(char *buffer, size_t size) : _buffer(buffer),
+                                                          _size(size),
+                                                          _length(0),
+                                                          _overflow(size == 0)
+{
+    if (size > 0) buffer[0] = '\0';
+}
+
+void FCMJsonWriter::put(char c)
+{
+    if (_overflow) return;
+    if (_length + 1 >= _size)
+    {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = '\0';
+}
+
+FCMJsonWriter &FCMJsonWriter::raw(const char *text)
+{
+    while (*text) put(*text++);
+    return *this;
+}
+
+FCMJsonWriter &FCMJsonWriter::raw(const char *text, size_t length)
+{
+    if (_overflow) return *this;
+    if (_length + length >= _size)
+    {
+        _overflow = true;
+        return *this;
+    }
+    memcpy(_buffer + _length, text, length);
+    _length += length;
+    _buffer[_length] = '\0';
+    return *this;
+}
+
+FCMJsonWriter &FCMJsonWriter::string(const char *text)
+{
+    put('"');
+    escaped(text, strlen(text));
+    put('"');
+    return *this;
+}
+
+FCMJsonWriter &FCMJsonWriter::escaped(const char *text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        switch (c)
+        {
+        case '"': raw("\\\""); break;
+        case '\\': raw("\\\\"); break;
+        case '\n': raw("\\n"); break;
+        case '\r': raw("\\r"); break;
+        case '\t': raw("\\t"); break;
+        default:
+            if (c < 0x20)
+            {
+                raw("\\u00");
+                put(hex[c >> 4]);
+                put(hex[c & 0x0F]);
+            }
+            else
+            {
+                put((char)c); // UTF-8 passes through unchanged
+            }
+            break;
+        }
+    }
+    return *this;
+}
+
+FCMJsonWriter &FCMJsonWriter::number(uint64_t value, bool quoted)
+{
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value > 0);
+    if (quoted) put('"');
+    while (n > 0) put(digits[--n]);
+    if (quoted) put('"');
+    return *this;
+}
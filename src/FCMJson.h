@@ -0,0 +1,48 @@
+/**
+ * FCMJson.h - Allocation-free JSON writer for notification payloads.
+ *
+ * Appends JSON text to a caller-owned buffer, escaping strings as it goes.
+ * Overflow is sticky: once the buffer is full every later call is ignored
+ * and ok() returns false. Internal to the library.
+ */
+
+#ifndef FCM_JSON_H
+#define FCM_JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class FCMJsonWriter
+{
+public:
+    FCMJsonWriter(char *buffer, size_t size);
+
+    // Append text as is (structure such as {"key": and punctuation)
+    FCMJsonWriter &raw(const char *text);
+    FCMJsonWriter &raw(const char *text, size_t length);
+
+    // Append a quoted, escaped string
+    FCMJsonWriter &string(const char *text);
+
+    // Append the escaped characters of a string without the quotes
+    FCMJsonWriter &escaped(const char *text, size_t length);
+
+    // Append an unsigned number, optionally quoted (FCM data values must be strings)
+    FCMJsonWriter &number(uint64_t value, bool quoted = false);
+
+    // Whether everything fitted
+    bool ok() const { return !_overflow; }
+
+    size_t length() const { return _length; }
+    const char *c_str() const { return _buffer; }
+
+private:
+    char *_buffer;
+    size_t _size;
+    size_t _length;
+    bool _overflow;
+
+    void put(char c);
+};
+
+#endif // FCM_JSON_H
@@ -0,0 +1,27 @@
+/**
+ * FCMJsonAllocator.h - ArduinoJson allocator used by the library's documents.
+ *
+ * Plain malloc/free, with each call counted when the library is built with
+ * PICO_FCM_ALLOC_TRACKING. Internal to the library.
+ */
+
+#ifndef FCM_JSON_ALLOCATOR_H
+#define FCM_JSON_ALLOCATOR_H
+
+#include <ArduinoJson.h>
+
+class FCMJsonAllocator : public ArduinoJson::Allocator
+{
+public:
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t newSize) override;
+
+    // Pass to JsonDocument's constructor
+    static FCMJsonAllocator *instance() { return &_instance; }
+
+private:
+    static FCMJsonAllocator _instance;
+};
+
+#endif // FCM_JSON_ALLOCATOR_H
@@ -0,0 +1,171 @@
+/**
+ * FCMMetrics.cpp - Prometheus text format writer used by the metrics endpoint.
+ */
+
+#include "FCMMetrics.h"
+#include <string.h>
+
+FCMMetricsWriter::FCMMetricsWriter(FCMMetricsSink sink, void *context) : _sink(sink),
+                                                                         _context(context),
+                                                                         _length(0),
+                                                                         _written(0)
+{
+}
+
+void FCMMetricsWriter::flush()
+{
+    if (_length == 0) return;
+    _sink(_context, _buffer, _length);
+    _written += _length;
+    _length = 0;
+}
+
+size_t FCMMetricsWriter::written() const { return _written + _length; }
+
+void FCMMetricsWriter::appendChar(char c)
+{
+    if (_length == sizeof(_buffer)) flush();
+    _buffer[_length++] = c;
+}
+
+void FCMMetricsWriter::append(const char *text)
+{
+    while (*text) appendChar(*text++);
+}
+
+void FCMMetricsWriter::appendUnsigned(uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) appendChar(digits[--n]);
+}
+
+void FCMMetricsWriter::appendFixed(uint64_t value, uint8_t decimals)
+{
+    uint64_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+    appendUnsigned(value / scale);
+
+    uint64_t fraction = value % scale;
+    if (fraction == 0) return;
+    appendChar('.');
+    // Print leading zeros, and stop once the remaining digits are all zero
+    while (fraction != 0)
+    {
+        scale /= 10;
+        appendChar('0' + (char)(fraction / scale));
+        fraction %= scale;
+    }
+}
+
+void FCMMetricsWriter::family(const char *name, const char *type, const char *help)
+{
+    append("# HELP ");
+    append(name);
+    appendChar(' ');
+    append(help);
+    append("\n# TYPE ");
+    append(name);
+    appendChar(' ');
+    append(type);
+    appendChar('\n');
+}
+
+void FCMMetricsWriter::appendName(const char *name, const char *labelName, const char *labelValue)
+{
+    append(name);
+    if (labelName)
+    {
+        appendChar('{');
+        append(labelName);
+        append("=\"");
+        append(labelValue);
+        append("\"}");
+    }
+    appendChar(' ');
+}
+
+void FCMMetricsWriter::sample(const char *name, const char *labelName, const char *labelValue, uint64_t value)
+{
+    appendName(name, labelName, labelValue);
+    appendUnsigned(value);
+    appendChar('\n');
+}
+
+void FCMMetricsWriter::sampleSigned(const char *name, int64_t value)
+{
+    append(name);
+    appendChar(' ');
+    if (value < 0)
+    {
+        appendChar('-');
+        appendUnsigned((uint64_t)(-value));
+    }
+    else
+    {
+        appendUnsigned((uint64_t)value);
+    }
+    appendChar('\n');
+}
+
+void FCMMetricsWriter::sampleFixed(const char *name, uint64_t value, uint8_t decimals)
+{
+    sampleFixed(name, nullptr, nullptr, value, decimals);
+}
+
+void FCMMetricsWriter::sampleFixed(const char *name, const char *labelName, const char *labelValue, uint64_t value, uint8_t decimals)
+{
+    appendName(name, labelName, labelValue);
+    appendFixed(value, decimals);
+    appendChar('\n');
+}
+
+void FCMMetricsWriter::histogramMs(const char *name, const char *help, const uint32_t *buckets, size_t bucketCount,
+                                   uint32_t count, uint64_t sumMs)
+{
+    family(name, "histogram", help);
+
+    // Prometheus buckets are cumulative; the last local bucket only fits under +Inf
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i + 1 < bucketCount; i++)
+    {
+        cumulative += buckets[i];
+        append(name);
+        append("_bucket{le=\"");
+        appendFixed((uint64_t)1 << i, 3);
+        append("\"} ");
+        appendUnsigned(cumulative);
+        appendChar('\n');
+    }
+    append(name);
+    append("_bucket{le=\"+Inf\"} ");
+    appendUnsigned(count);
+    appendChar('\n');
+
+    append(name);
+    append("_sum ");
+    appendFixed(sumMs, 3);
+    appendChar('\n');
+    append(name);
+    append("_count ");
+    appendUnsigned(count);
+    appendChar('\n');
+}
+
+void fcmMetricsLabel(const char *text, char *out, size_t outSize)
+{
+    if (outSize == 0) return;
+    size_t n = 0;
+    for (; *text && n + 1 < outSize; text++)
+    {
+        char c = *text;
+        if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+        out[n++] = ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) ? c : '_';
+    }
+    out[n] = '\0';
+}
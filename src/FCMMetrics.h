@@ -0,0 +1,74 @@
+/**
+ * FCMMetrics.h - Prometheus text format writer used by the metrics endpoint.
+ *
+ * Formats samples into a fixed buffer and hands full chunks to a sink
+ * callback, so a response is rendered without heap allocation. Only uses
+ * the C library, so it builds unchanged on the host. Internal to the library.
+ */
+
+#ifndef FCM_METRICS_H
+#define FCM_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the staging buffer; the sink is called whenever it fills up
+#define FCM_METRICS_BUFFER_SIZE 256
+
+// Receives rendered output
+typedef void (*FCMMetricsSink)(void *context, const char *data, size_t length);
+
+class FCMMetricsWriter
+{
+public:
+    FCMMetricsWriter(FCMMetricsSink sink, void *context);
+
+    // Write the # HELP and # TYPE lines of a metric family
+    void family(const char *name, const char *type, const char *help);
+
+    // Write one sample. labelName may be null for an unlabelled sample.
+    void sample(const char *name, const char *labelName, const char *labelValue, uint64_t value);
+    void sampleSigned(const char *name, int64_t value);
+
+    // Write value / 10^decimals as a decimal (e.g. microseconds as seconds with 6)
+    void sampleFixed(const char *name, uint64_t value, uint8_t decimals);
+    void sampleFixed(const char *name, const char *labelName, const char *labelValue, uint64_t value, uint8_t decimals);
+
+    // Write a histogram from power-of-two millisecond buckets (bucket 0 <= 1 ms,
+    // bucket i <= 2^i ms, the last one unbounded), rendered in seconds
+    void histogramMs(const char *name, const char *help, const uint32_t *buckets, size_t bucketCount,
+                     uint32_t count, uint64_t sumMs);
+
+    // Pass any buffered output to the sink
+    void flush();
+
+    // Total bytes passed to the sink so far
+    size_t written() const;
+
+private:
+    FCMMetricsSink _sink;
+    void *_context;
+    char _buffer[FCM_METRICS_BUFFER_SIZE];
+    size_t _length;
+    size_t _written;
+
+    void append(const char *text);
+    void appendName(const char *name, const char *labelName, const char *labelValue); // Name, labels and the space
+    void appendChar(char c);
+    void appendUnsigned(uint64_t value);
+    void appendFixed(uint64_t value, uint8_t decimals);
+};
+
+// Bucket of a sample for histogramMs(): bucket 0 holds up to 1 ms and
+// bucket i (2^(i-1), 2^i] ms, so each sample counts under its le label
+inline int fcmLatencyBucket(uint32_t ms, int bucketCount)
+{
+    int bucket = ms <= 1 ? 0 : 32 - __builtin_clz(ms - 1);
+    return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+// Copy text into a metric label value, lowercased with anything outside
+// [a-z0-9] turned into '_' (e.g. "HTTP 429" -> "http_429")
+void fcmMetricsLabel(const char *text, char *out, size_t outSize);
+
+#endif // FCM_METRICS_H
@@ -0,0 +1,66 @@
+/**
+ * FCMMsgPack.cpp - Allocation-free MessagePack writer for compact payloads.
+ */
+
+#include "FCMMsgPack.h"
+#include <string.h>
+
+FCMMsgPackWriter::FCMMsgPackWriter(uint8_t *buffer, size_t size) : _buffer(buffer),
+                                                                   _size(size),
+                                                                   _length(0),
+                                                                   _overflow(false)
+{
+}
+
+void FCMMsgPackWriter::head(uint8_t type, uint64_t value, int bytes)
+{
+    if (_overflow) return;
+    if (_length + 1 + bytes > _size)
+    {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = type;
+    for (int i = bytes - 1; i >= 0; i--) _buffer[_length++] = (uint8_t)(value >> (8 * i));
+}
+
+FCMMsgPackWriter &FCMMsgPackWriter::map(uint32_t count)
+{
+    if (count < 16) head(0x80 | count, 0, 0);
+    else if (count <= 0xFFFF) head(0xDE, count, 2);
+    else head(0xDF, count, 4);
+    return *this;
+}
+
+FCMMsgPackWriter &FCMMsgPackWriter::uint(uint64_t value)
+{
+    if (value < 0x80) head((uint8_t)value, 0, 0); // Positive fixint
+    else if (value <= 0xFF) head(0xCC, value, 1);
+    else if (value <= 0xFFFF) head(0xCD, value, 2);
+    else if (value <= 0xFFFFFFFFULL) head(0xCE, value, 4);
+    else head(0xCF, value, 8);
+    return *this;
+}
+
+FCMMsgPackWriter &FCMMsgPackWriter::str(const char *text)
+{
+    return str(text, strlen(text));
+}
+
+FCMMsgPackWriter &FCMMsgPackWriter::str(const char *text, size_t length)
+{
+    if (length < 32) head(0xA0 | length, 0, 0);
+    else if (length <= 0xFF) head(0xD9, length, 1);
+    else if (length <= 0xFFFF) head(0xDA, length, 2);
+    else head(0xDB, length, 4);
+
+    if (_overflow) return *this;
+    if (_length + length > _size)
+    {
+        _overflow = true;
+        return *this;
+    }
+    memcpy(_buffer + _length, text, length);
+    _length += length;
+    return *this;
+}
@@ -0,0 +1,56 @@
+/**
+ * FCMMsgPack.h - Allocation-free MessagePack writer for compact payloads.
+ *
+ * Appends MessagePack values to a caller-owned buffer, always picking the
+ * shortest encoding. Overflow is sticky like FCMJsonWriter: once the buffer
+ * is full every later call is ignored and ok() returns false. Internal to
+ * the library.
+ */
+
+#ifndef FCM_MSGPACK_H
+#define FCM_MSGPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keys of the compact Cloud Function request (keep in sync with the reference function)
+#define FCM_WIRE_KEY_TOKEN 0    // Full FCM token, only in the registration request
+#define FCM_WIRE_KEY_TOKEN_ID 1 // Short ID the function assigned to the token
+#define FCM_WIRE_KEY_TITLE 2
+#define FCM_WIRE_KEY_BODY 3
+#define FCM_WIRE_KEY_SEQ 4
+#define FCM_WIRE_KEY_TS 5
+#define FCM_WIRE_KEY_HEARTBEAT 6 // Present instead of title and body in heartbeats
+
+class FCMMsgPackWriter
+{
+public:
+    FCMMsgPackWriter(uint8_t *buffer, size_t size);
+
+    // Start a map of count key/value pairs
+    FCMMsgPackWriter &map(uint32_t count);
+
+    // Append an unsigned integer
+    FCMMsgPackWriter &uint(uint64_t value);
+
+    // Append a UTF-8 string
+    FCMMsgPackWriter &str(const char *text);
+    FCMMsgPackWriter &str(const char *text, size_t length);
+
+    // Whether everything fitted
+    bool ok() const { return !_overflow; }
+
+    size_t length() const { return _length; }
+    const uint8_t *data() const { return _buffer; }
+
+private:
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _length;
+    bool _overflow;
+
+    // Append a type byte followed by the low bytes of value, big-endian
+    void head(uint8_t type, uint64_t value, int bytes);
+};
+
+#endif // FCM_MSGPACK_H
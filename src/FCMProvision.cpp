@@ -0,0 +1,137 @@
+/**
+ * FCMProvision.cpp - Binary provisioning frames received over a serial port.
+ */
+
+#include "FCMProvision.h"
+#include <string.h>
+
+static const uint8_t REQUEST_MAGIC[4] = {'P', 'F', 'C', 'P'};
+static const uint8_t ACK_MAGIC[4] = {'P', 'F', 'C', 'A'};
+
+static uint16_t readU16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t fcmCrc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+    // Half-byte table: 64 bytes of flash instead of 1 KB
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+FCMProvisionReceiver::FCMProvisionReceiver() { reset(); }
+
+void FCMProvisionReceiver::reset()
+{
+    _length = 0;
+    _expected = 0;
+    _oversized = false;
+}
+
+bool FCMProvisionReceiver::push(uint8_t byte)
+{
+    if (_length < sizeof(REQUEST_MAGIC))
+    {
+        // Resynchronise on the magic; console noise before it is ignored
+        if (byte != REQUEST_MAGIC[_length])
+        {
+            _length = 0;
+            if (byte != REQUEST_MAGIC[0]) return false;
+        }
+        _frame[_length++] = byte;
+        return false;
+    }
+
+    _frame[_length++] = byte;
+    if (_length == FCM_PROVISION_HEADER_SIZE)
+    {
+        size_t payloadLength = readU16(_frame + 6);
+        if (payloadLength > FCM_PROVISION_MAX_PAYLOAD)
+        {
+            _oversized = true;
+            return true;
+        }
+        _expected = FCM_PROVISION_HEADER_SIZE + payloadLength + 4;
+    }
+    return _expected != 0 && _length == _expected;
+}
+
+uint32_t FCMProvisionReceiver::frameCrc() const
+{
+    if (_expected == 0 || _length != _expected) return 0;
+    return readU32(_frame + _length - 4);
+}
+
+FCMProvisionStatus FCMProvisionReceiver::parse(FCMProvisionBlob &out) const
+{
+    if (_oversized || _expected == 0 || _length != _expected) return FCM_PROVISION_MALFORMED;
+    if (fcmCrc32(_frame, _length - 4) != frameCrc()) return FCM_PROVISION_BAD_CRC;
+    if (_frame[4] != FCM_PROVISION_VERSION) return FCM_PROVISION_UNSUPPORTED_VERSION;
+
+    memset(&out, 0, sizeof(out));
+    out.flags = _frame[5];
+    const uint8_t *p = _frame + FCM_PROVISION_HEADER_SIZE;
+    const uint8_t *end = _frame + _length - 4;
+
+    if (end - p < 1) return FCM_PROVISION_MALFORMED;
+    out.networkCount = *p++;
+    if (out.networkCount > FCM_PROVISION_MAX_NETWORKS) return FCM_PROVISION_TOO_MANY_NETWORKS;
+    for (uint8_t i = 0; i < out.networkCount; i++)
+    {
+        FCMProvisionNetwork &network = out.networks[i];
+        if (end - p < 1 || end - p < 1 + p[0]) return FCM_PROVISION_MALFORMED;
+        network.ssidLength = *p++;
+        network.ssid = (const char *)p;
+        p += network.ssidLength;
+        if (end - p < 1 || end - p < 1 + p[0]) return FCM_PROVISION_MALFORMED;
+        network.passwordLength = *p++;
+        network.password = (const char *)p;
+        p += network.passwordLength;
+    }
+
+    if (end - p < 2 || end - p < 2 + readU16(p)) return FCM_PROVISION_MALFORMED;
+    out.fcmUrlLength = readU16(p);
+    out.fcmUrl = (const char *)p + 2;
+    p += 2 + out.fcmUrlLength;
+    if (end - p < 2 || end - p < 2 + readU16(p)) return FCM_PROVISION_MALFORMED;
+    out.fcmTokenLength = readU16(p);
+    out.fcmToken = (const char *)p + 2;
+    p += 2 + out.fcmTokenLength;
+
+    return p == end ? FCM_PROVISION_OK : FCM_PROVISION_MALFORMED;
+}
+
+size_t fcmEncodeProvisionAck(FCMProvisionStatus status, uint8_t networkCount, uint32_t requestCrc, uint8_t *out)
+{
+    memcpy(out, ACK_MAGIC, sizeof(ACK_MAGIC));
+    out[4] = (uint8_t)status;
+    out[5] = networkCount;
+    for (int i = 0; i < 4; i++) out[6 + i] = (uint8_t)(requestCrc >> (8 * i));
+    return FCM_PROVISION_ACK_SIZE;
+}
+
+const char *fcmProvisionStatusToString(FCMProvisionStatus status)
+{
+    switch (status)
+    {
+    case FCM_PROVISION_OK: return "ok";
+    case FCM_PROVISION_BAD_CRC: return "bad CRC";
+    case FCM_PROVISION_MALFORMED: return "malformed frame";
+    case FCM_PROVISION_UNSUPPORTED_VERSION: return "unsupported version";
+    case FCM_PROVISION_INVALID_FIELD: return "invalid field";
+    case FCM_PROVISION_TOO_MANY_NETWORKS: return "too many networks";
+    case FCM_PROVISION_STORAGE_FAILED: return "storage failed";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,106 @@
+/**
+ * FCMProvision.h - Binary provisioning frames received over a serial port.
+ *
+ * A request frame carries the whole configuration (networks, FCM URL and
+ * token) in one exchange and is answered by a fixed-size acknowledgement.
+ * All integers are little-endian:
+ *
+ *   request: "PFCP" | version u8 | flags u8 | payload length u16 | payload | CRC-32 u32
+ *   payload: network count u8, then per network ssid length u8 | ssid |
+ *            password length u8 | password, then FCM URL length u16 | URL |
+ *            FCM token length u16 | token
+ *   ack:     "PFCA" | status u8 | stored network count u8 | request CRC-32 u32
+ *
+ * The CRC is the zlib CRC-32 of every request byte before it. Only uses the
+ * C library, so it builds unchanged on the host. Internal to the library.
+ */
+
+#ifndef FCM_PROVISION_H
+#define FCM_PROVISION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FCM_PROVISION_VERSION 1
+#define FCM_PROVISION_HEADER_SIZE 8
+#define FCM_PROVISION_MAX_PAYLOAD 1024
+#define FCM_PROVISION_FRAME_SIZE (FCM_PROVISION_HEADER_SIZE + FCM_PROVISION_MAX_PAYLOAD + 4)
+#define FCM_PROVISION_ACK_SIZE 10
+// Most networks a frame can carry; the device may store fewer
+#define FCM_PROVISION_MAX_NETWORKS 8
+
+// Request flags
+#define FCM_PROVISION_REPLACE 0x01 // Clear stored networks and FCM config first
+#define FCM_PROVISION_CONNECT 0x02 // Connect to the stored networks once saved
+
+// Outcome reported in the acknowledgement
+typedef enum
+{
+    FCM_PROVISION_OK = 0,
+    FCM_PROVISION_BAD_CRC = 1,
+    FCM_PROVISION_MALFORMED = 2,          // Truncated or oversized payload
+    FCM_PROVISION_UNSUPPORTED_VERSION = 3,
+    FCM_PROVISION_INVALID_FIELD = 4,      // Empty SSID, a field over its maximum length or with a NUL
+    FCM_PROVISION_TOO_MANY_NETWORKS = 5,
+    FCM_PROVISION_STORAGE_FAILED = 6
+} FCMProvisionStatus;
+
+// A network in a received frame; the strings point into the frame and are not terminated
+typedef struct
+{
+    const char *ssid;
+    uint8_t ssidLength;
+    const char *password;
+    uint8_t passwordLength;
+} FCMProvisionNetwork;
+
+// The decoded payload of a request frame
+typedef struct
+{
+    uint8_t flags;
+    uint8_t networkCount;
+    FCMProvisionNetwork networks[FCM_PROVISION_MAX_NETWORKS];
+    const char *fcmUrl;
+    uint16_t fcmUrlLength;
+    const char *fcmToken;
+    uint16_t fcmTokenLength;
+} FCMProvisionBlob;
+
+// Reassembles request frames from a byte stream, skipping anything before the magic
+class FCMProvisionReceiver
+{
+public:
+    FCMProvisionReceiver();
+
+    // Add one received byte. Returns true when a frame is complete (or its
+    // header announced an oversized payload) and should be parsed.
+    bool push(uint8_t byte);
+
+    // Check and decode the completed frame
+    FCMProvisionStatus parse(FCMProvisionBlob &out) const;
+
+    // CRC-32 carried by the completed frame, echoed in the acknowledgement
+    uint32_t frameCrc() const;
+
+    // Drop any partial frame
+    void reset();
+
+    // A frame has started but is not complete yet
+    bool receiving() const { return _length > 0; }
+
+private:
+    uint8_t _frame[FCM_PROVISION_FRAME_SIZE];
+    size_t _length;
+    size_t _expected; // Total frame size once the header is in, else 0
+    bool _oversized;
+};
+
+// zlib-compatible CRC-32; pass the previous result to continue a running CRC
+uint32_t fcmCrc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+// Encode an acknowledgement into out, which must hold FCM_PROVISION_ACK_SIZE bytes
+size_t fcmEncodeProvisionAck(FCMProvisionStatus status, uint8_t networkCount, uint32_t requestCrc, uint8_t *out);
+
+const char *fcmProvisionStatusToString(FCMProvisionStatus status);
+
+#endif // FCM_PROVISION_H
@@ -0,0 +1,139 @@
+/**
+ * FCMRules.cpp - Event ring and rule evaluation for the rules engine.
+ */
+
+#include "FCMRules.h"
+#include <string.h>
+
+FCMEventRing::FCMEventRing() : _head(0), _tail(0), _dropped(0)
+{
+}
+
+bool FCMEventRing::push(const FCMEvent &event)
+{
+    uint32_t head = _head;
+    if (head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) == FCM_EVENT_RING_SIZE)
+    {
+        _dropped = _dropped + 1;
+        return false;
+    }
+    _events[head % FCM_EVENT_RING_SIZE] = event;
+    // Publish the slot only after it is written
+    __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool FCMEventRing::pop(FCMEvent &event)
+{
+    uint32_t tail = _tail;
+    if (__atomic_load_n(&_head, __ATOMIC_ACQUIRE) == tail) return false;
+    event = _events[tail % FCM_EVENT_RING_SIZE];
+    __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Apply the rate limit to a trigger
+static bool fire(const FCMRule &rule, FCMRuleState &state, uint32_t now)
+{
+    if (state.fired > 0 && now - state.lastFiredMs < rule.minIntervalMs)
+    {
+        state.suppressed++;
+        return false;
+    }
+    state.lastFiredMs = now;
+    state.fired++;
+    return true;
+}
+
+bool fcmEvaluateRule(const FCMRule &rule, FCMRuleState &state, const FCMEvent &event)
+{
+    if (event.source != rule.source) return false;
+    uint32_t now = event.timeMs;
+
+    if (rule.kind == FCM_RULE_EDGE)
+    {
+        // Leading-edge debounce: contact bounce follows within debounceMs of the previous change
+        bool quiet = !state.seenEvent || now - state.lastEventMs >= rule.debounceMs;
+        state.seenEvent = true;
+        state.lastEventMs = now;
+        if (!quiet || event.value != rule.threshold) return false;
+        return fire(rule, state, now);
+    }
+
+    bool above = rule.kind == FCM_RULE_ABOVE;
+    if (state.tripped)
+    {
+        bool rearm = above ? event.value < rule.threshold - rule.hysteresis
+                           : event.value > rule.threshold + rule.hysteresis;
+        if (rearm) state.tripped = false;
+        return false;
+    }
+
+    bool met = above ? event.value > rule.threshold : event.value < rule.threshold;
+    if (!met)
+    {
+        state.pending = false;
+        return false;
+    }
+    if (!state.pending)
+    {
+        state.pending = true;
+        state.pendingSince = now;
+    }
+    if (now - state.pendingSince < rule.debounceMs) return false;
+
+    state.pending = false;
+    state.tripped = true;
+    return fire(rule, state, now);
+}
+
+bool fcmFormatRuleText(const char *text, int32_t value, uint8_t decimals, char *out, size_t outSize)
+{
+    if (outSize == 0) return false;
+
+    // Render the value once
+    char number[16];
+    size_t numberLength = 0;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    if (decimals > 9) decimals = 9;
+    char digits[12];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + (char)(magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0 || n <= decimals);
+    if (value < 0) number[numberLength++] = '-';
+    while (n > 0)
+    {
+        if (n == decimals) number[numberLength++] = '.';
+        number[numberLength++] = digits[--n];
+    }
+
+    size_t length = 0;
+    bool complete = true;
+    while (*text)
+    {
+        const char *piece = text;
+        size_t pieceLength = 1;
+        if (text[0] == '{' && text[1] == '0' && text[2] == '}')
+        {
+            piece = number;
+            pieceLength = numberLength;
+            text += 3;
+        }
+        else
+        {
+            text++;
+        }
+        if (length + pieceLength >= outSize)
+        {
+            complete = false;
+            break;
+        }
+        memcpy(out + length, piece, pieceLength);
+        length += pieceLength;
+    }
+    out[length] = '\0';
+    return complete;
+}
@@ -0,0 +1,125 @@
+/**
+ * FCMRulesEngine.cpp - Turns GPIO and ADC events into queued notifications.
+ */
+
+#include "FCMRulesEngine.h"
+
+// Create the global instance
+FCMRulesEngineClass FCMRules;
+
+// Global trampoline for GPIO interrupts; the parameter carries the source ID
+void ruleGpioInterruptCallback(void *param) { FCMRules.handleGpioInterrupt((uint8_t)(uintptr_t)param); }
+
+FCMRulesEngineClass::FCMRulesEngineClass() : _sourceCount(0),
+                                             _ruleCount(0),
+                                             _ruleFiredCallback(nullptr)
+{
+    memset(_sources, 0, sizeof(_sources));
+    memset(_rules, 0, sizeof(_rules));
+    memset(_ruleStates, 0, sizeof(_ruleStates));
+    memset(_rulePolicies, 0, sizeof(_rulePolicies));
+    memset(_ruleHasPolicy, 0, sizeof(_ruleHasPolicy));
+}
+
+uint8_t FCMRulesEngineClass::addDigitalSource(uint8_t pin, PinMode mode)
+{
+    if (_sourceCount >= MAX_FCM_RULE_SOURCES) return FCM_RULE_SOURCE_INVALID;
+    uint8_t source = _sourceCount++;
+    FCMRuleSource &entry = _sources[source];
+    entry.pin = pin;
+    entry.analog = false;
+
+    pinMode(pin, mode);
+    attachInterruptParam(pin, ruleGpioInterruptCallback, CHANGE, (void *)(uintptr_t)source);
+    return source;
+}
+
+uint8_t FCMRulesEngineClass::addAnalogSource(uint8_t pin, uint32_t intervalMs, uint8_t oversample)
+{
+    if (_sourceCount >= MAX_FCM_RULE_SOURCES) return FCM_RULE_SOURCE_INVALID;
+    uint8_t source = _sourceCount++;
+    FCMRuleSource &entry = _sources[source];
+    entry.pin = pin;
+    entry.analog = true;
+    entry.intervalMs = intervalMs > 0 ? intervalMs : 1;
+    entry.oversample = oversample > 0 ? oversample : 1;
+    entry.nextSampleAt = millis();
+    return source;
+}
+
+bool FCMRulesEngineClass::addRule(const FCMRule &rule, const FCMRetryPolicy *policy)
+{
+    if (_ruleCount >= MAX_FCM_RULES || rule.source >= _sourceCount || !rule.title || !rule.body)
+    {
+        Serial.println("Error: invalid rule or rule table full.");
+        return false;
+    }
+    _rules[_ruleCount] = rule;
+    memset(&_ruleStates[_ruleCount], 0, sizeof(FCMRuleState));
+    _ruleHasPolicy[_ruleCount] = policy != nullptr;
+    if (policy) _rulePolicies[_ruleCount] = *policy;
+    _ruleCount++;
+    return true;
+}
+
+void FCMRulesEngineClass::handleGpioInterrupt(uint8_t source)
+{
+    if (source >= _sourceCount) return;
+    FCMEvent event = {(uint32_t)millis(), source, digitalRead(_sources[source].pin)};
+    _events.push(event);
+}
+
+void FCMRulesEngineClass::loop()
+{
+    FCMEvent event;
+    while (_events.pop(event))
+    {
+        dispatch(event);
+    }
+
+    // Analog samples are taken here, in the consumer's context, so they skip the ring
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < _sourceCount; i++)
+    {
+        FCMRuleSource &source = _sources[i];
+        if (!source.analog || (long)(now - source.nextSampleAt) < 0) continue;
+
+        int32_t total = 0;
+        for (uint8_t n = 0; n < source.oversample; n++) total += analogRead(source.pin);
+        FCMEvent sample = {(uint32_t)now, i, total / source.oversample};
+        source.nextSampleAt += source.intervalMs;
+        // Do not try to catch up after a long stall
+        if ((long)(now - source.nextSampleAt) >= 0) source.nextSampleAt = now + source.intervalMs;
+        dispatch(sample);
+    }
+}
+
+void FCMRulesEngineClass::dispatch(const FCMEvent &event)
+{
+    for (uint8_t i = 0; i < _ruleCount; i++)
+    {
+        const FCMRule &rule = _rules[i];
+        if (!fcmEvaluateRule(rule, _ruleStates[i], event)) continue;
+
+        if (_ruleFiredCallback) _ruleFiredCallback(i, event);
+
+        char title[MAX_NOTIFICATION_TITLE_LENGTH + 1];
+        char body[FCM_RULE_TEXT_LENGTH + 1];
+        fcmFormatRuleText(rule.title, event.value, rule.valueDecimals, title, sizeof(title));
+        fcmFormatRuleText(rule.body, event.value, rule.valueDecimals, body, sizeof(body));
+        if (PicoFCMNotifier.queueNotification(title, body, _ruleHasPolicy[i] ? &_rulePolicies[i] : nullptr) == 0)
+        {
+            Serial.println("Rule fired but the notification queue is full.");
+        }
+    }
+}
+
+void FCMRulesEngineClass::setRuleFiredCallback(void (*callback)(uint8_t rule, const FCMEvent &event)) { _ruleFiredCallback = callback; }
+
+const FCMRuleState &FCMRulesEngineClass::getRuleState(uint8_t rule)
+{
+    if (rule >= _ruleCount) rule = 0;
+    return _ruleStates[rule];
+}
+
+uint32_t FCMRulesEngineClass::getDroppedEvents() { return _events.dropped(); }
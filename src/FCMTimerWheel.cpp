@@ -0,0 +1,190 @@
+/**
+ * FCMTimerWheel.cpp - Hashed timer wheel for loop()-driven work.
+ */
+
+#include "FCMTimerWheel.h"
+#include <string.h>
+
+static uint32_t tickOf(uint32_t ms) { return ms / FCM_TIMER_TICK_MS; }
+
+static uint8_t slotOf(uint32_t ms) { return (uint8_t)(tickOf(ms) & (FCM_TIMER_WHEEL_SLOTS - 1)); }
+
+// Wrap-safe "a is at or after b"
+static bool reached(uint32_t a, uint32_t b) { return (int32_t)(a - b) >= 0; }
+
+FCMTimerWheel::FCMTimerWheel() : _free(0), _active(0), _tick(0)
+{
+    memset(_timers, 0, sizeof(_timers));
+    memset(_slots, NONE, sizeof(_slots));
+    for (uint8_t i = 0; i < FCM_MAX_TIMERS; i++)
+    {
+        _timers[i].state = TIMER_FREE;
+        _timers[i].next = (i + 1 < FCM_MAX_TIMERS) ? i + 1 : NONE;
+    }
+}
+
+uint8_t FCMTimerWheel::find(uint32_t id) const
+{
+    uint32_t index = (id & 0xFF) - 1;
+    if (id == 0 || index >= FCM_MAX_TIMERS) return NONE;
+    const Timer &timer = _timers[index];
+    if (timer.generation != (id >> 8) || timer.state == TIMER_FREE || timer.state == TIMER_CANCELLED) return NONE;
+    return (uint8_t)index;
+}
+
+void FCMTimerWheel::link(uint8_t index)
+{
+    Timer &timer = _timers[index];
+    uint8_t slot = slotOf(timer.deadline);
+    timer.state = TIMER_ARMED;
+    timer.prev = NONE;
+    timer.next = _slots[slot];
+    if (timer.next != NONE) _timers[timer.next].prev = index;
+    _slots[slot] = index;
+}
+
+void FCMTimerWheel::unlink(uint8_t index)
+{
+    Timer &timer = _timers[index];
+    if (timer.prev != NONE) _timers[timer.prev].next = timer.next;
+    else _slots[slotOf(timer.deadline)] = timer.next;
+    if (timer.next != NONE) _timers[timer.next].prev = timer.prev;
+}
+
+void FCMTimerWheel::release(uint8_t index)
+{
+    Timer &timer = _timers[index];
+    timer.state = TIMER_FREE;
+    timer.generation = (timer.generation + 1) & 0xFFFFFF;
+    timer.next = _free;
+    _free = index;
+    _active--;
+}
+
+uint32_t FCMTimerWheel::schedule(uint32_t now, uint32_t delayMs, FCMTimerCallback callback, void *context, uint32_t periodMs)
+{
+    if (!callback || _free == NONE) return 0;
+    // An idle wheel starts counting ticks from now rather than from its last run
+    if (_active == 0) _tick = tickOf(now);
+
+    uint8_t index = _free;
+    Timer &timer = _timers[index];
+    _free = timer.next;
+    _active++;
+
+    timer.deadline = now + delayMs;
+    timer.periodMs = periodMs;
+    timer.callback = callback;
+    timer.context = context;
+    link(index);
+    return (timer.generation << 8) | (uint32_t)(index + 1);
+}
+
+bool FCMTimerWheel::reschedule(uint32_t id, uint32_t now, uint32_t delayMs)
+{
+    uint8_t index = find(id);
+    if (index == NONE) return false;
+    // A timer waiting in the run list is not in a slot
+    if (_timers[index].state == TIMER_ARMED) unlink(index);
+    else return false;
+    _timers[index].deadline = now + delayMs;
+    link(index);
+    return true;
+}
+
+bool FCMTimerWheel::cancel(uint32_t id)
+{
+    uint8_t index = find(id);
+    if (index == NONE) return false;
+    if (_timers[index].state == TIMER_DUE)
+    {
+        // run() frees it when it reaches it in the run list
+        _timers[index].state = TIMER_CANCELLED;
+        return true;
+    }
+    unlink(index);
+    release(index);
+    return true;
+}
+
+bool FCMTimerWheel::pending(uint32_t id) const
+{
+    return find(id) != NONE;
+}
+
+uint8_t FCMTimerWheel::run(uint32_t now)
+{
+    // Visit the slots from the last run's tick up to now; after a long gap
+    // one full turn covers every slot
+    uint32_t nowTick = tickOf(now);
+    uint32_t ticks = nowTick - _tick;
+    if (ticks >= FCM_TIMER_WHEEL_SLOTS) ticks = FCM_TIMER_WHEEL_SLOTS - 1;
+
+    // Move everything that is due to the run list first, so callbacks that
+    // schedule or cancel timers cannot disturb the walk
+    uint8_t runHead = NONE, runTail = NONE;
+    for (uint32_t t = nowTick - ticks; t != nowTick + 1; t++)
+    {
+        uint8_t index = _slots[t & (FCM_TIMER_WHEEL_SLOTS - 1)];
+        while (index != NONE)
+        {
+            Timer &timer = _timers[index];
+            uint8_t next = timer.next;
+            if (reached(now, timer.deadline))
+            {
+                unlink(index);
+                timer.state = TIMER_DUE;
+                timer.next = NONE;
+                if (runTail != NONE) _timers[runTail].next = index;
+                else runHead = index;
+                runTail = index;
+            }
+            index = next;
+        }
+    }
+    _tick = nowTick;
+
+    uint8_t ran = 0;
+    while (runHead != NONE)
+    {
+        uint8_t index = runHead;
+        Timer &timer = _timers[index];
+        runHead = timer.next;
+        if (timer.state == TIMER_CANCELLED)
+        {
+            release(index);
+            continue;
+        }
+
+        FCMTimerCallback callback = timer.callback;
+        void *context = timer.context;
+        if (timer.periodMs > 0)
+        {
+            // Periods missed during a long gap are skipped, not run back to back
+            timer.deadline += timer.periodMs;
+            if (reached(now, timer.deadline)) timer.deadline = now + timer.periodMs;
+            link(index);
+        }
+        else
+        {
+            release(index);
+        }
+        callback(context);
+        ran++;
+    }
+    return ran;
+}
+
+uint32_t FCMTimerWheel::msUntilNext(uint32_t now) const
+{
+    // The pool is small, so a scan is cheaper than keeping the minimum up to date
+    uint32_t next = FCM_TIMER_NONE;
+    for (uint8_t i = 0; i < FCM_MAX_TIMERS; i++)
+    {
+        const Timer &timer = _timers[i];
+        if (timer.state != TIMER_ARMED) continue;
+        if (reached(now, timer.deadline)) return 0;
+        if (timer.deadline - now < next) next = timer.deadline - now;
+    }
+    return next;
+}
@@ -5,7 +5,14 @@
  */
 
 #include "PicoFCMNotifier.h"
+#include "FCMHttp.h"
+#include "FCMJson.h"
+#include "FCMAttachment.h"
+#include "FCMJsonAllocator.h"
+#include "FCMProvision.h"
+#include "FCMCommands.h"
 #include <ArduinoJson.h>
+#include <btstack.h>
 
 // Define the UUIDs for service and characteristics
 static const char *SERVICE_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa1";
@@ -15,6 +22,8 @@ static const char *COMMAND_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa4";
 static const char *PAIRING_STATUS_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa5";
 static const char *FCM_URL_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa6";
 static const char *FCM_TOKEN_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa7";
+static const char *WIFI_STATUS_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa8";
+static const char *DEVICE_STATUS_CHAR_UUID = "5a67d678-6361-4f32-8396-54c6926c8fa9";
 
 // Global instance
 PicoFCMNotifierClass PicoFCMNotifier;
@@ -24,6 +33,12 @@ void bleDeviceConnected(BLEStatus status, BLEDevice *device);
 void bleDeviceDisconnected(BLEDevice *device);
 int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size);
 uint16_t gattReadCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size);
+void hciEventCallback(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+// Registrations for raw HCI events (connection parameters, encryption) and
+// security manager events (pairing and re-encryption)
+static btstack_packet_callback_registration_t hciEventRegistration;
+static btstack_packet_callback_registration_t smEventRegistration;
 
 // Constructor
 PicoFCMNotifierClass::PicoFCMNotifierClass() : _status(PROVISION_IDLE),
@@ -38,15 +53,98 @@ PicoFCMNotifierClass::PicoFCMNotifierClass() : _status(PROVISION_IDLE),
                                                _pairingStatusCharUUID(PAIRING_STATUS_CHAR_UUID),
                                                _fcmUrlCharUUID(FCM_URL_CHAR_UUID),
                                                _fcmTokenCharUUID(FCM_TOKEN_CHAR_UUID),
+                                               _wifiStatusCharUUID(WIFI_STATUS_CHAR_UUID),
+                                               _deviceStatusCharUUID(DEVICE_STATUS_CHAR_UUID),
                                                _ssidCharHandle(0),
                                                _passwordCharHandle(0),
                                                _commandCharHandle(0),
                                                _pairingStatusCharHandle(0),
                                                _fcmUrlCharHandle(0),
                                                _fcmTokenCharHandle(0),
+                                               _wifiStatusCharHandle(0),
+                                               _deviceStatusCharHandle(0),
                                                _allowProvisioningWhenConnected(false),
                                                _connectedDevice(nullptr),
-                                               _connectionStartTime(0)
+                                               _connectionStartTime(0),
+                                               _joinCount(0),
+                                               _deliveryMode(FCM_DELIVERY_CLOUD_FUNCTION),
+                                               _privateKeyPem(nullptr),
+                                               _accessTokenExpiry(0),
+                                               _accessTokenCacheChecked(false),
+                                               _timeSyncEnabled(false),
+                                               _nextSequence(1),
+                                               _tlsMode(FCM_TLS_INSECURE),
+                                               _pinnedKey(nullptr),
+                                               _trustAnchors(nullptr),
+                                               _tlsClient(nullptr),
+                                               _tlsClientStale(false),
+                                               _nextNotificationId(1),
+                                               _lastSendResult(FCM_SEND_OK),
+                                               _notificationResultCallback(nullptr),
+                                               _endpointGeneration(1),
+                                               _sendHeadGeneration(0),
+                                               _wireFormat(FCM_WIRE_JSON),
+                                               _tokenId(0),
+                                               _tokenIdCrc(0),
+                                               _tokenIdLoaded(false),
+                                               _compactRejectedGeneration(0),
+                                               _compactHeadGeneration(0),
+                                               _fastBLELinkEnabled(true),
+                                               _bleConHandle(HCI_CON_HANDLE_INVALID),
+                                               _lastBLEActivity(0),
+                                               _bondCount(0),
+                                               _bleConnectedAt(0),
+                                               _pairingExchangeSeen(false),
+                                               _startupMode(FCM_STARTUP_FULL),
+                                               _begun(false),
+                                               _bleStarted(false),
+                                               _stagedJoinPending(false),
+                                               _bleSecurityLevel(SECURITY_HIGH),
+                                               _bleIoCapability(IO_CAPABILITY_DISPLAY_YES_NO),
+                                               _bleCoexistence(false),
+                                               _wifiStatusCode(STATUS_IDLE),
+                                               _awaitingAckSince(0),
+                                               _provisioningStartTime(0),
+                                               _lastProvisioningDurationMs(0),
+                                               _deviceStatusSynced(false),
+                                               _statusSnapshotRequested(false),
+                                               _lastDeviceStatusChecked(0),
+                                               _metricsServer(nullptr),
+                                               _metricsRequestStart(0),
+                                               _metricsRequestLength(0),
+                                               _metricsHeaderEndMatch(0),
+                                               _loopCount(0),
+                                               _loopTotalUs(0),
+                                               _loopMaxUs(0),
+                                               _wifiReconnects(0),
+                                               _wifiWasConnected(false),
+                                               _heapFreeMin(UINT32_MAX),
+                                               _queueMinIntervalMs(0),
+                                               _lastQueueAttemptAt(0),
+                                               _queueAttempted(false),
+                                               _remoteCommandsEnabled(false),
+                                               _remoteCommandCallback(nullptr),
+                                               _commandLength(0),
+                                               _heartbeatIntervalMs(0),
+                                               _connectTimer(0),
+                                               _connectTimerJoin(0),
+                                               _queueTimer(0),
+                                               _heapSampleTimer(0),
+                                               _commandTimer(0),
+                                               _heartbeatTimer(0),
+                                               _provisionPort(nullptr),
+                                               _provisionReceiver(nullptr),
+                                               _provisionFrameStart(0),
+                                               _roamingEnabled(false),
+                                               _roamRssiQ4(0),
+                                               _roamRssiValid(false),
+                                               _lastRoamSample(0),
+                                               _lastRoamScan(0),
+                                               _roamScanRunning(false),
+                                               _roamCandidate(-1),
+                                               _roamCandidateAt(0),
+                                               _roamFromNetwork(-1),
+                                               _wifiDownSince(0)
 {
     // Initialize string buffers
     memset(_receivedSSID, 0, sizeof(_receivedSSID));
@@ -65,21 +163,84 @@ PicoFCMNotifierClass::PicoFCMNotifierClass() : _status(PROVISION_IDLE),
     memset(_receivedFcmToken, 0, sizeof(_receivedFcmToken));
     memset(_fcmUrl, 0, sizeof(_fcmUrl));
     memset(_fcmToken, 0, sizeof(_fcmToken));
+
+    // Initialize direct FCM HTTP v1 settings
+    memset(_projectId, 0, sizeof(_projectId));
+    memset(_clientEmail, 0, sizeof(_clientEmail));
+    memset(_accessToken, 0, sizeof(_accessToken));
+    strncpy(_oauthTokenUrl, FCM_DEFAULT_OAUTH_TOKEN_URL, MAX_FCM_URL_LENGTH);
+    strncpy(_fcmApiUrl, FCM_DEFAULT_API_URL, MAX_FCM_URL_LENGTH);
+
+    // Initialize the retry engine
+    memset(_queue, 0, sizeof(_queue));
+    memset(_prepared, 0, sizeof(_prepared));
+    memset(&_sendStats, 0, sizeof(_sendStats));
+    memset(&_remoteStats, 0, sizeof(_remoteStats));
+    _defaultRetryPolicy = {5, 1000, 60000, 20, 300000};
+
+    memset(&_bleLinkInfo, 0, sizeof(_bleLinkInfo));
+    memset(&_sentDeviceStatus, 0, sizeof(_sentDeviceStatus));
+    memset(_bonds, 0, sizeof(_bonds));
+
+    memset(_bleDeviceName, 0, sizeof(_bleDeviceName));
+    memset(_bootTimeline, 0, sizeof(_bootTimeline));
+
+    _roamingConfig = {FCM_ROAM_SCAN_THRESHOLD_DBM, FCM_ROAM_MIN_GAIN_DB, FCM_ROAM_SCAN_INTERVAL_MS, FCM_ROAM_QUIET_MS};
+    memset(&_roamingStats, 0, sizeof(_roamingStats));
+    memset(_roamCandidateBssid, 0, sizeof(_roamCandidateBssid));
 }
 
 // Initialize the WiFi provisioning and FCM notifier service
 bool PicoFCMNotifierClass::begin(const char *deviceName, BLESecurityLevel securityLevel, io_capability_t ioCapability)
 {
+    markBootPhase(FCM_BOOT_BEGIN);
     if (!LittleFS.begin())
     {
         Serial.println("Failed to initialize LittleFS");
         return false;
     }
+    markBootPhase(FCM_BOOT_STORAGE_MOUNTED);
     loadConfigFromFlash();
+    // Settings changed by commands override the ones made before begin()
+    loadRemoteConfigFromFlash();
+    markBootPhase(FCM_BOOT_CONFIG_LOADED);
+
+    strncpy(_bleDeviceName, deviceName, FCM_BLE_DEVICE_NAME_LENGTH);
+    _bleSecurityLevel = securityLevel;
+    _bleIoCapability = ioCapability;
+    _begun = true;
+    if (_heapSampleTimer == 0)
+    {
+        _heapSampleTimer = _timers.schedule(millis(), 0, onHeapSampleTimer, this, FCM_HEAP_SAMPLE_INTERVAL_MS);
+    }
+
+    if (_startupMode == FCM_STARTUP_STAGED && _networkCount > 0)
+    {
+        // Start the join first; loop() brings up BLE only if this join fails
+        _stagedJoinPending = connectToStoredNetworks();
+        _dnsCache.loadFromFlash();
+        if (!_stagedJoinPending) return beginBLE();
+        Serial.println("FCM Notifier started, BLE deferred");
+        return true;
+    }
+
+    _dnsCache.loadFromFlash();
+    return beginBLE();
+}
+
+bool PicoFCMNotifierClass::beginBLE()
+{
+    if (_bleStarted) return true;
+    if (!_begun) return false;
     BLENotify.begin();
-    BTstack.setup(deviceName);
-    BLESecure.begin(ioCapability);
-    BLESecure.setSecurityLevel(securityLevel, true);
+    BTstack.setup(_bleDeviceName);
+    hciEventRegistration.callback = hciEventCallback;
+    hci_add_event_handler(&hciEventRegistration);
+    BLESecure.begin(_bleIoCapability);
+    smEventRegistration.callback = hciEventCallback;
+    sm_add_event_handler(&smEventRegistration);
+    loadBondsFromFlash();
+    BLESecure.setSecurityLevel(_bleSecurityLevel, true);
     BLESecure.allowReconnectionWithoutDatabaseEntry(true);
     BLESecure.requestPairingOnConnect(true);
     BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
@@ -87,16 +248,36 @@ bool PicoFCMNotifierClass::begin(const char *deviceName, BLESecurityLevel securi
     BTstack.setGATTCharacteristicWrite(gattWriteCallback);
     BTstack.setGATTCharacteristicRead(gattReadCallback);
     setupBLEService();
+    _bleStarted = true;
+    markBootPhase(FCM_BOOT_BLE_STARTED);
     BTstack.startAdvertising();
+    markBootPhase(FCM_BOOT_ADVERTISING);
     Serial.println("FCM Notifier service started");
     return true;
 }
 
 // Process BLE and WiFi events
-void PicoFCMNotifierClass::loop()
+uint32_t PicoFCMNotifierClass::loop()
 {
-    BTstack.loop();
-    BLENotify.update();
+    unsigned long loopStart = micros();
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_LOOP);
+    // Staged startup: BLE is needed once there is nothing to join or the first
+    // join failed. Later failures (a roam, a dropped link) are left to roaming
+    // and reconnects, so they do not bring up BLE for good.
+    if (_stagedJoinPending && _status != PROVISION_CONNECTING)
+    {
+        _stagedJoinPending = false;
+        if (_status != PROVISION_CONNECTED) beginBLE();
+    }
+    if (!_bleStarted && _begun && _networkCount == 0)
+    {
+        beginBLE();
+    }
+    if (_bleStarted)
+    {
+        BTstack.loop();
+        BLENotify.update();
+    }
 
     wl_status_t currentWiFiStatus = (wl_status_t)WiFi.status();
     static wl_status_t lastReportedWiFiStatusToApp = WL_NO_SHIELD;
@@ -104,33 +285,129 @@ void PicoFCMNotifierClass::loop()
     if (_status == PROVISION_CONNECTING)
     {
         unsigned long currentTime = millis();
+        if (_connectTimerJoin != _joinCount)
+        {
+            _connectTimerJoin = _joinCount;
+            unsigned long elapsed = currentTime - _connectionStartTime;
+            _timers.cancel(_connectTimer);
+            _connectTimer = _timers.schedule(currentTime, elapsed < WIFI_CONNECT_TIMEOUT_MS ? WIFI_CONNECT_TIMEOUT_MS - elapsed : 0,
+                                             onConnectTimeout, this);
+        }
+
         if (currentWiFiStatus == WL_CONNECTED)
         {
+            _timers.cancel(_connectTimer);
             Serial.println("WiFi connected!");
+            markBootPhase(FCM_BOOT_WIFI_CONNECTED);
+            if (_provisioningStartTime != 0)
+            {
+                _lastProvisioningDurationMs = currentTime - _provisioningStartTime;
+                _provisioningStartTime = 0;
+                Serial.print("Provisioning took ");
+                Serial.print(_lastProvisioningDurationMs);
+                Serial.println(" ms");
+            }
             setStatus(PROVISION_CONNECTED);
+            if (_deliveryMode == FCM_DELIVERY_DIRECT_V1 || _timeSyncEnabled)
+            {
+                startTimeSync();
+            }
+            // Resolve now so the first notification skips the lookup
+            preResolveEndpoints();
         }
         else if (currentWiFiStatus == WL_CONNECT_FAILED || currentWiFiStatus == WL_NO_SSID_AVAIL)
         {
+            _timers.cancel(_connectTimer);
             Serial.print("WiFi connection failed: ");
             Serial.println(currentWiFiStatus);
             setStatus(PROVISION_FAILED);
         }
-        else if (currentTime - _connectionStartTime > WIFI_CONNECT_TIMEOUT_MS)
-        {
-            Serial.println("WiFi connection timed out.");
-            setStatus(PROVISION_FAILED);
-            WiFi.disconnect();
-        }
     }
 
     if (currentWiFiStatus != lastReportedWiFiStatusToApp)
     {
+        if (currentWiFiStatus == WL_CONNECTED)
+        {
+            if (_wifiWasConnected) _wifiReconnects++;
+            _wifiWasConnected = true;
+            if (_wifiDownSince != 0)
+            {
+                _roamingStats.disconnectedMs += millis() - _wifiDownSince;
+                _wifiDownSince = 0;
+            }
+        }
+        else if (_wifiWasConnected && _wifiDownSince == 0)
+        {
+            _roamingStats.disconnects++;
+            _wifiDownSince = millis();
+        }
         if (_wifiStatusCallback)
         {
             _wifiStatusCallback(currentWiFiStatus);
         }
         lastReportedWiFiStatusToApp = currentWiFiStatus;
+        // Queued sends wait for the link, so their timer depends on it
+        armQueueTimer();
+    }
+
+    // Do not hold the BLE link forever if the app never acknowledges
+    if (_awaitingAckSince != 0 && millis() - _awaitingAckSince > FCM_BLE_ACK_TIMEOUT_MS)
+    {
+        Serial.println("No status acknowledgement from app, ending BLE session.");
+        endProvisioningSession();
+    }
+
+    // Relax the BLE link once provisioning traffic has stopped
+    if (_bleLinkInfo.fastParameters && _bleConHandle != HCI_CON_HANDLE_INVALID &&
+        millis() - _lastBLEActivity > FCM_BLE_IDLE_RELAX_MS)
+    {
+        requestBLEConnectionParameters(false);
     }
+
+    // Join timeout, queued sends and heap sampling
+    _timers.run(millis());
+    // After the queue, so a due send goes out before a scan or roam
+    if (_roamingEnabled) serviceRoaming();
+    updateDeviceStatusCharacteristic();
+
+    uint32_t loopUs = micros() - loopStart;
+    _loopCount++;
+    _loopTotalUs += loopUs;
+    if (loopUs > _loopMaxUs) _loopMaxUs = loopUs;
+
+    // Served after the timing so scrapes do not show up as slow loops
+    if (_metricsServer) serviceMetricsServer();
+    if (_provisionPort) serviceSerialProvisioning();
+
+    bool busy = _connectedDevice != nullptr || _status == PROVISION_CONNECTING || _metricsClient ||
+                (_provisionReceiver && _provisionReceiver->receiving()) || _roamScanRunning || _roamCandidate >= 0;
+    uint32_t idleMs = _timers.msUntilNext(millis());
+    uint32_t pollMs = busy ? FCM_LOOP_BUSY_POLL_MS : FCM_LOOP_IDLE_POLL_MS;
+    return idleMs < pollMs ? idleMs : pollMs;
+}
+
+uint32_t PicoFCMNotifierClass::scheduleTimer(uint32_t delayMs, FCMTimerCallback callback, void *context, uint32_t periodMs)
+{
+    return _timers.schedule(millis(), delayMs, callback, context, periodMs);
+}
+
+bool PicoFCMNotifierClass::cancelTimer(uint32_t id) { return _timers.cancel(id); }
+
+void PicoFCMNotifierClass::onConnectTimeout(void *self)
+{
+    PicoFCMNotifierClass &notifier = *(PicoFCMNotifierClass *)self;
+    // A join started since the timer was armed gets its own timer on the next loop()
+    if (notifier._status != PROVISION_CONNECTING || notifier._connectTimerJoin != notifier._joinCount) return;
+    Serial.println("WiFi connection timed out.");
+    notifier.setStatus(PROVISION_FAILED);
+    WiFi.disconnect();
+}
+
+void PicoFCMNotifierClass::onHeapSampleTimer(void *self)
+{
+    PicoFCMNotifierClass &notifier = *(PicoFCMNotifierClass *)self;
+    uint32_t freeHeap = rp2040.getFreeHeap();
+    if (freeHeap < notifier._heapFreeMin) notifier._heapFreeMin = freeHeap;
 }
 
 // Update the pairing status characteristic
@@ -198,7 +475,7 @@ bool PicoFCMNotifierClass::connectToStoredNetworks()
 }
 
 // Connect to a specific network
-void PicoFCMNotifierClass::connectToNetwork(const char *ssid, const char *password)
+void PicoFCMNotifierClass::connectToNetwork(const char *ssid, const char *password, const uint8_t *bssid)
 {
     if (!ssid || strlen(ssid) == 0)
     {
@@ -210,10 +487,15 @@ void PicoFCMNotifierClass::connectToNetwork(const char *ssid, const char *passwo
     Serial.print("Connecting to WiFi: ");
     Serial.println(ssid);
 
-    BTstack.stopAdvertising();
-    if (_connectedDevice != nullptr)
+    // In coexistence mode the app stays connected and watches the WiFi Status
+    // characteristic instead of reconnecting to find out how the join went
+    if (_bleStarted && (!_bleCoexistence || _connectedDevice == nullptr))
     {
-        BTstack.bleDisconnect(_connectedDevice);
+        BTstack.stopAdvertising();
+        if (_connectedDevice != nullptr)
+        {
+            BTstack.bleDisconnect(_connectedDevice);
+        }
     }
 
     if (WiFi.status() != WL_DISCONNECTED)
@@ -221,8 +503,11 @@ void PicoFCMNotifierClass::connectToNetwork(const char *ssid, const char *passwo
         WiFi.disconnect();
     }
 
-    WiFi.begin(ssid, password);
+    markBootPhase(FCM_BOOT_WIFI_STARTED);
+    if (bssid) WiFi.begin(ssid, password, bssid);
+    else WiFi.begin(ssid, password);
     _connectionStartTime = millis();
+    _joinCount++;
 }
 
 // Erase all stored WiFi networks and config
@@ -239,6 +524,8 @@ bool PicoFCMNotifierClass::clearNetworks()
     // Clear FCM data from memory
     memset(_fcmUrl, 0, sizeof(_fcmUrl));
     memset(_fcmToken, 0, sizeof(_fcmToken));
+    _endpointGeneration++;
+    _dnsCache.clear();
 
     if (LittleFS.exists(WIFI_CONFIG_FILE))
     {
@@ -255,6 +542,14 @@ void PicoFCMNotifierClass::setStatus(PicoWiFiProvisioningStatus newStatus)
     if (_status != newStatus)
     {
         _status = newStatus;
+        switch (_status)
+        {
+        case PROVISION_IDLE: updateWiFiStatusCharacteristic(STATUS_IDLE); break;
+        case PROVISION_CONNECTING: updateWiFiStatusCharacteristic(STATUS_CONNECTING); break;
+        case PROVISION_CONNECTED: updateWiFiStatusCharacteristic(STATUS_CONNECTED); break;
+        case PROVISION_FAILED: updateWiFiStatusCharacteristic(STATUS_FAILED); break;
+        default: break;
+        }
         if (_statusCallback)
         {
             _statusCallback(_status);
@@ -262,6 +557,40 @@ void PicoFCMNotifierClass::setStatus(PicoWiFiProvisioningStatus newStatus)
     }
 }
 
+// Push the WiFi join progress to the app and, in coexistence mode, wait for it
+// to acknowledge a final state before the BLE link is dropped
+void PicoFCMNotifierClass::updateWiFiStatusCharacteristic(uint8_t statusCode)
+{
+    _wifiStatusCode = statusCode;
+    if (_connectedDevice && BLENotify.isSubscribed(_wifiStatusCharHandle))
+    {
+        BLENotify.notify(_wifiStatusCharHandle, &statusCode, 1);
+        Serial.print("Sent WiFi status update: ");
+        Serial.println(statusCode);
+    }
+    if (_bleCoexistence && _connectedDevice && (statusCode == STATUS_CONNECTED || statusCode == STATUS_FAILED))
+    {
+        _awaitingAckSince = millis();
+        if (_awaitingAckSince == 0) _awaitingAckSince = 1;
+    }
+}
+
+void PicoFCMNotifierClass::endProvisioningSession()
+{
+    _awaitingAckSince = 0;
+    if (_connectedDevice == nullptr) return;
+    // Stay discoverable after a failed join so the app can try again
+    if (_status == PROVISION_CONNECTED && !_allowProvisioningWhenConnected)
+    {
+        BTstack.stopAdvertising();
+    }
+    BTstack.bleDisconnect(_connectedDevice);
+}
+
+void PicoFCMNotifierClass::setBLECoexistence(bool enable) { _bleCoexistence = enable; }
+void PicoFCMNotifierClass::setStartupMode(FCMStartupMode mode) { _startupMode = mode; }
+uint32_t PicoFCMNotifierClass::getLastProvisioningDurationMs() { return _lastProvisioningDurationMs; }
+
 void PicoFCMNotifierClass::setStatusCallback(void (*callback)(PicoWiFiProvisioningStatus status)) { _statusCallback = callback; }
 void PicoFCMNotifierClass::setWiFiStatusCallback(void (*callback)(wl_status_t status)) { _wifiStatusCallback = callback; }
 void PicoFCMNotifierClass::setBLEConnectionStateCallback(void (*callback)(bool isConnected)) { _bleConnectionStateCallback = callback; }
@@ -276,6 +605,7 @@ void bleDeviceConnected(BLEStatus status, BLEDevice *device) { PicoFCMNotifier.h
 void bleDeviceDisconnected(BLEDevice *device) { PicoFCMNotifier.handleDeviceDisconnected(device); }
 int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size) { return PicoFCMNotifier.handleGattWrite(characteristic_id, buffer, buffer_size); }
 uint16_t gattReadCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size) { return PicoFCMNotifier.handleGattRead(characteristic_id, buffer, buffer_size); }
+void hciEventCallback(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) { PicoFCMNotifier.handleHciEvent(packet_type, packet, size); }
 
 // Class member implementations for BLE events
 void PicoFCMNotifierClass::handleDeviceConnected(BLEStatus status, BLEDevice *device)
@@ -284,6 +614,14 @@ void PicoFCMNotifierClass::handleDeviceConnected(BLEStatus status, BLEDevice *de
     {
         Serial.println("BLE Device connected");
         _connectedDevice = device;
+        _lastBLEActivity = millis();
+        _provisioningStartTime = _lastBLEActivity;
+        if (_fastBLELinkEnabled)
+        {
+            // Larger MTU and shorter interval speed up the provisioning writes
+            requestBLEConnectionParameters(true);
+            gatt_client_send_mtu_negotiation(hciEventCallback, device->getHandle());
+        }
         if (_bleConnectionStateCallback) _bleConnectionStateCallback(true);
     }
     else
@@ -298,6 +636,9 @@ void PicoFCMNotifierClass::handleDeviceDisconnected(BLEDevice *device)
     Serial.println("BLE Device disconnected");
     updatePairingStatusCharacteristic(false);
     _connectedDevice = nullptr;
+    _awaitingAckSince = 0;
+    _deviceStatusSynced = false;
+    _statusSnapshotRequested = false;
     BLENotify.handleDisconnection();
     if (_bleConnectionStateCallback)
     {
@@ -305,8 +646,133 @@ void PicoFCMNotifierClass::handleDeviceDisconnected(BLEDevice *device)
     }
 }
 
+void PicoFCMNotifierClass::handleHciEvent(uint8_t packetType, uint8_t *packet, uint16_t size)
+{
+    if (packetType != HCI_EVENT_PACKET) return;
+
+    switch (hci_event_packet_get_type(packet))
+    {
+    case HCI_EVENT_LE_META:
+        switch (hci_event_le_meta_get_subevent_code(packet))
+        {
+        case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
+            _bleConHandle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+            _bleLinkInfo.mtu = ATT_DEFAULT_MTU;
+            _bleLinkInfo.connectionIntervalUs = hci_subevent_le_connection_complete_get_conn_interval(packet) * 1250UL;
+            _bleLinkInfo.latency = hci_subevent_le_connection_complete_get_conn_latency(packet);
+            _bleLinkInfo.supervisionTimeoutMs = hci_subevent_le_connection_complete_get_supervision_timeout(packet) * 10;
+            _bleLinkInfo.fastParameters = false;
+            _bleLinkInfo.encryptionLatencyMs = 0;
+            _bleLinkInfo.resumedFromBond = false;
+            _bleConnectedAt = millis();
+            _pairingExchangeSeen = false;
+            break;
+        case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
+            _bleLinkInfo.connectionIntervalUs = hci_subevent_le_connection_update_complete_get_conn_interval(packet) * 1250UL;
+            _bleLinkInfo.latency = hci_subevent_le_connection_update_complete_get_conn_latency(packet);
+            _bleLinkInfo.supervisionTimeoutMs = hci_subevent_le_connection_update_complete_get_supervision_timeout(packet) * 10;
+            Serial.print("BLE connection interval now ");
+            Serial.print(_bleLinkInfo.connectionIntervalUs / 1000.0, 2);
+            Serial.println(" ms");
+            break;
+        default:
+            break;
+        }
+        break;
+    case HCI_EVENT_DISCONNECTION_COMPLETE:
+    {
+        // Keep the encryption metric of the last session readable after disconnect
+        uint32_t encryptionLatencyMs = _bleLinkInfo.encryptionLatencyMs;
+        bool resumedFromBond = _bleLinkInfo.resumedFromBond;
+        _bleConHandle = HCI_CON_HANDLE_INVALID;
+        memset(&_bleLinkInfo, 0, sizeof(_bleLinkInfo));
+        _bleLinkInfo.encryptionLatencyMs = encryptionLatencyMs;
+        _bleLinkInfo.resumedFromBond = resumedFromBond;
+        break;
+    }
+    case HCI_EVENT_ENCRYPTION_CHANGE:
+        if (hci_event_encryption_change_get_status(packet) == ERROR_CODE_SUCCESS &&
+            hci_event_encryption_change_get_encryption_enabled(packet) &&
+            hci_event_encryption_change_get_connection_handle(packet) == _bleConHandle &&
+            _bleLinkInfo.encryptionLatencyMs == 0)
+        {
+            _bleLinkInfo.encryptionLatencyMs = max(millis() - _bleConnectedAt, 1UL);
+            _bleLinkInfo.resumedFromBond = !_pairingExchangeSeen;
+            Serial.print("BLE link encrypted after ");
+            Serial.print(_bleLinkInfo.encryptionLatencyMs);
+            Serial.println(_bleLinkInfo.resumedFromBond ? " ms (stored bond)" : " ms (new pairing)");
+        }
+        break;
+    case SM_EVENT_PAIRING_STARTED:
+        _pairingExchangeSeen = true;
+        break;
+    case SM_EVENT_PAIRING_COMPLETE:
+        if (sm_event_pairing_complete_get_status(packet) == ERROR_CODE_SUCCESS)
+        {
+            rememberBond(sm_event_pairing_complete_get_handle(packet));
+        }
+        break;
+    case SM_EVENT_REENCRYPTION_COMPLETE:
+        if (sm_event_reencryption_complete_get_status(packet) == ERROR_CODE_SUCCESS)
+        {
+            rememberBond(sm_event_reencryption_complete_get_handle(packet));
+        }
+        break;
+    case GATT_EVENT_MTU:
+        _bleLinkInfo.mtu = gatt_event_mtu_get_MTU(packet);
+        Serial.print("BLE MTU negotiated: ");
+        Serial.println(_bleLinkInfo.mtu);
+        break;
+    default:
+        break;
+    }
+}
+
+void PicoFCMNotifierClass::requestBLEConnectionParameters(bool fast)
+{
+    if (_bleConHandle == HCI_CON_HANDLE_INVALID) return;
+    if (fast)
+    {
+        gap_request_connection_parameter_update(_bleConHandle, FCM_BLE_FAST_INTERVAL_MIN, FCM_BLE_FAST_INTERVAL_MAX,
+                                                FCM_BLE_FAST_LATENCY, FCM_BLE_FAST_TIMEOUT);
+    }
+    else
+    {
+        gap_request_connection_parameter_update(_bleConHandle, FCM_BLE_IDLE_INTERVAL_MIN, FCM_BLE_IDLE_INTERVAL_MAX,
+                                                FCM_BLE_IDLE_LATENCY, FCM_BLE_IDLE_TIMEOUT);
+    }
+    _bleLinkInfo.fastParameters = fast;
+}
+
+void PicoFCMNotifierClass::enableFastProvisioningLink(bool enable)
+{
+    _fastBLELinkEnabled = enable;
+    if (!enable && _bleLinkInfo.fastParameters)
+    {
+        requestBLEConnectionParameters(false);
+    }
+}
+
+FCMBleLinkInfo PicoFCMNotifierClass::getBLELinkInfo()
+{
+    FCMBleLinkInfo info = _bleLinkInfo;
+    if (_bleConHandle != HCI_CON_HANDLE_INVALID)
+    {
+        // The phone may have run its own MTU exchange with our ATT server
+        uint16_t serverMtu = att_server_get_mtu(_bleConHandle);
+        if (serverMtu > info.mtu) info.mtu = serverMtu;
+    }
+    return info;
+}
+
 int PicoFCMNotifierClass::handleGattWrite(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
 {
+    _lastBLEActivity = millis();
+    if (_fastBLELinkEnabled && !_bleLinkInfo.fastParameters && _bleConHandle != HCI_CON_HANDLE_INVALID)
+    {
+        requestBLEConnectionParameters(true);
+    }
+
     if (characteristic_id == _ssidCharHandle)
     {
         memset(_receivedSSID, 0, sizeof(_receivedSSID));
@@ -359,6 +825,31 @@ int PicoFCMNotifierClass::handleGattWrite(uint16_t characteristic_id, uint8_t *b
                 BLENotify.handleSubscriptionChange(_pairingStatusCharHandle, false);
             }
         }
+        else if (char_value_handle == _deviceStatusCharHandle)
+        {
+            if (cccd_value == 0x0001)
+            {
+                BLENotify.handleSubscriptionChange(_deviceStatusCharHandle, true);
+                _statusSnapshotRequested = true;
+            }
+            else if (cccd_value == 0x0000)
+            {
+                BLENotify.handleSubscriptionChange(_deviceStatusCharHandle, false);
+                _deviceStatusSynced = false;
+            }
+        }
+        else if (char_value_handle == _wifiStatusCharHandle)
+        {
+            if (cccd_value == 0x0001)
+            {
+                BLENotify.handleSubscriptionChange(_wifiStatusCharHandle, true);
+                updateWiFiStatusCharacteristic(_wifiStatusCode);
+            }
+            else if (cccd_value == 0x0000)
+            {
+                BLENotify.handleSubscriptionChange(_wifiStatusCharHandle, false);
+            }
+        }
     }
     return 0;
 }
@@ -373,6 +864,21 @@ uint16_t PicoFCMNotifierClass::handleGattRead(uint16_t characteristic_id, uint8_
         buffer[0] = pairingStatusValue;
         return sizeof(pairingStatusValue);
     }
+    if (characteristic_id == _deviceStatusCharHandle)
+    {
+        if (buffer == NULL) return FCM_STATUS_RECORD_MAX_LENGTH;
+        if (buffer_size < FCM_STATUS_RECORD_MAX_LENGTH) return 0;
+        FCMDeviceStatus status;
+        collectDeviceStatus(status);
+        return fcmEncodeDeviceStatus(status, FCM_STATUS_FIELD_ALL, buffer);
+    }
+    if (characteristic_id == _wifiStatusCharHandle)
+    {
+        if (buffer == NULL) return sizeof(_wifiStatusCode);
+        if (buffer_size < sizeof(_wifiStatusCode)) return 0;
+        buffer[0] = _wifiStatusCode;
+        return sizeof(_wifiStatusCode);
+    }
     return 0;
 }
 
@@ -384,7 +890,8 @@ bool PicoFCMNotifierClass::loadConfigFromFlash()
     File configFile = LittleFS.open(WIFI_CONFIG_FILE, "r");
     if (!configFile) return false;
 
-    JsonDocument doc;
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
     DeserializationError error = deserializeJson(doc, configFile);
     configFile.close();
 
@@ -417,18 +924,24 @@ bool PicoFCMNotifierClass::loadConfigFromFlash()
             _networkCount++;
         }
     }
+    _endpointGeneration++;
     Serial.print("Loaded "); Serial.print(_networkCount); Serial.println(" networks from flash.");
     return true;
 }
 
 // Save configuration to flash
-bool PicoFCMNotifierClass::saveConfigToFlash()
+bool PicoFCMNotifierClass::saveConfigToFlash() { return saveConfigToFlash(_receivedFcmUrl, _receivedFcmToken); }
+
+bool PicoFCMNotifierClass::saveConfigToFlash(const char *fcmUrl, const char *fcmToken)
 {
-    JsonDocument doc;
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
 
-    // Save received credentials to the JSON document
-    if (strlen(_receivedFcmUrl) > 0) doc["fcm_url"] = _receivedFcmUrl;
-    if (strlen(_receivedFcmToken) > 0) doc["fcm_token"] = _receivedFcmToken;
+    // An endpoint field that is not given keeps its current value
+    if (!fcmUrl || fcmUrl[0] == '\0') fcmUrl = _fcmUrl;
+    if (!fcmToken || fcmToken[0] == '\0') fcmToken = _fcmToken;
+    if (strlen(fcmUrl) > 0) doc["fcm_url"] = fcmUrl;
+    if (strlen(fcmToken) > 0) doc["fcm_token"] = fcmToken;
     
     JsonArray networksArray = doc["networks"].to<JsonArray>();
     for (int i = 0; i < _networkCount; i++)
@@ -452,9 +965,10 @@ bool PicoFCMNotifierClass::saveConfigToFlash()
     Serial.println("Configuration saved to flash.");
 
     // Update in-memory storage after saving
-    if (strlen(_receivedFcmUrl) > 0) strncpy(_fcmUrl, _receivedFcmUrl, MAX_FCM_URL_LENGTH);
-    if (strlen(_receivedFcmToken) > 0) strncpy(_fcmToken, _receivedFcmToken, MAX_FCM_TOKEN_LENGTH);
-    
+    if (fcmUrl != _fcmUrl) strncpy(_fcmUrl, fcmUrl, MAX_FCM_URL_LENGTH);
+    if (fcmToken != _fcmToken) strncpy(_fcmToken, fcmToken, MAX_FCM_TOKEN_LENGTH);
+    _endpointGeneration++;
+
     return true;
 }
 
@@ -468,6 +982,8 @@ void PicoFCMNotifierClass::setupBLEService()
     _pairingStatusCharHandle = BLENotify.addNotifyCharacteristic(&_pairingStatusCharUUID, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY);
     _fcmUrlCharHandle = BLENotify.addNotifyCharacteristic(&_fcmUrlCharUUID, ATT_PROPERTY_WRITE);
     _fcmTokenCharHandle = BLENotify.addNotifyCharacteristic(&_fcmTokenCharUUID, ATT_PROPERTY_WRITE);
+    _wifiStatusCharHandle = BLENotify.addNotifyCharacteristic(&_wifiStatusCharUUID, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY);
+    _deviceStatusCharHandle = BLENotify.addNotifyCharacteristic(&_deviceStatusCharUUID, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY);
 
     updatePairingStatusCharacteristic(false);
     Serial.println("BLE service and characteristics set up");
@@ -476,6 +992,7 @@ void PicoFCMNotifierClass::setupBLEService()
 // Process commands received via BLE
 void PicoFCMNotifierClass::processCommand(uint8_t command)
 {
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_COMMAND);
     Serial.print("Received command: 0x");
     Serial.println(command, HEX);
     switch (command)
@@ -501,6 +1018,17 @@ void PicoFCMNotifierClass::processCommand(uint8_t command)
         clearNetworks();
         Serial.println("All config cleared.");
         break;
+    case CMD_GET_STATUS:
+        // Sent from loop() so the snapshot goes out after this write is answered
+        _statusSnapshotRequested = true;
+        break;
+    case CMD_ACK_STATUS:
+        if (_awaitingAckSince != 0)
+        {
+            Serial.println("App acknowledged WiFi status, ending BLE session.");
+            endProvisioningSession();
+        }
+        break;
     case CMD_DISCONNECT:
         WiFi.disconnect();
         setStatus(PROVISION_IDLE);
@@ -512,50 +1040,314 @@ void PicoFCMNotifierClass::processCommand(uint8_t command)
     }
 }
 
+void PicoFCMNotifierClass::setTlsMode(FCMTlsMode mode)
+{
+    _tlsMode = mode;
+    _tlsClientStale = true;
+}
+FCMTlsMode PicoFCMNotifierClass::getTlsMode() { return _tlsMode; }
+
+// Parse the pinned key once so each handshake only compares keys
+bool PicoFCMNotifierClass::setPinnedPublicKey(const uint8_t *der, size_t length)
+{
+    if (!der || length == 0) return false;
+    _tlsClientStale = true;
+    delete _pinnedKey;
+    _pinnedKey = new BearSSL::PublicKey(der, length);
+    if (!_pinnedKey->isRSA() && !_pinnedKey->isEC())
+    {
+        Serial.println("Error: invalid pinned public key.");
+        delete _pinnedKey;
+        _pinnedKey = nullptr;
+        return false;
+    }
+    return true;
+}
+
+// Parse the trust anchor once instead of on every handshake
+bool PicoFCMNotifierClass::setTrustAnchor(const uint8_t *der, size_t length)
+{
+    if (!der || length == 0) return false;
+    _tlsClientStale = true;
+    delete _trustAnchors;
+    _trustAnchors = new BearSSL::X509List(der, length);
+    if (_trustAnchors->getCount() == 0)
+    {
+        Serial.println("Error: invalid trust anchor certificate.");
+        delete _trustAnchors;
+        _trustAnchors = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void PicoFCMNotifierClass::configureTlsClient(WiFiClientSecure &client)
+{
+    switch (_tlsMode)
+    {
+    case FCM_TLS_PINNED_KEY:
+        if (_pinnedKey)
+        {
+            client.setKnownKey(_pinnedKey);
+            return;
+        }
+        break;
+    case FCM_TLS_TRUST_ANCHOR:
+        if (_trustAnchors)
+        {
+            client.setTrustAnchors(_trustAnchors);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    if (_tlsMode != FCM_TLS_INSECURE)
+    {
+        // Never fall back to an unverified connection when verification was requested;
+        // a client without any verification settings refuses the handshake
+        Serial.println("Error: TLS pin or trust anchor not set, connection will be refused.");
+        return;
+    }
+    client.setInsecure(); // For simplicity, don't validate server cert
+}
+
+// A fresh client is needed on settings changes: setKnownKey() and
+// setTrustAnchors() do not undo an earlier setInsecure()
+WiFiClientSecure &PicoFCMNotifierClass::tlsClient()
+{
+    if (!_tlsClient || _tlsClientStale)
+    {
+        FCM_ALLOC_SCOPE(FCM_ALLOC_API_TLS);
+        delete _tlsClient;
+        _tlsClient = new WiFiClientSecure();
+        configureTlsClient(*_tlsClient);
+        _tlsClientStale = false;
+    }
+    return *_tlsClient;
+}
+
+void PicoFCMNotifierClass::setDnsCacheTtl(uint32_t ttlMs, uint32_t negativeTtlMs) { _dnsCache.setTtl(ttlMs, negativeTtlMs); }
+void PicoFCMNotifierClass::clearDnsCache() { _dnsCache.clear(); }
+
+// Warm the DNS cache for every host the current delivery mode talks to
+void PicoFCMNotifierClass::preResolveEndpoints()
+{
+    const char *urls[2] = {nullptr, nullptr};
+    if (_deliveryMode == FCM_DELIVERY_DIRECT_V1)
+    {
+        urls[0] = _oauthTokenUrl;
+        urls[1] = _fcmApiUrl;
+    }
+    else
+    {
+        urls[0] = _fcmUrl;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        FCMUrl url;
+        if (!urls[i] || !fcmParseUrl(urls[i], url)) continue;
+        IPAddress address;
+        bool usedStale;
+        if (_dnsCache.resolve(url.host, address, usedStale) && !usedStale)
+        {
+            Serial.print("Pre-resolved ");
+            Serial.print(url.host);
+            Serial.print(" to ");
+            Serial.println(address);
+        }
+    }
+}
+
 // Send an FCM notification
 bool PicoFCMNotifierClass::sendNotification(const char *title, const char *body)
 {
+    uint32_t retryAfterMs = 0;
+    return attemptSend(title, body, stampNotification(), &retryAfterMs) == FCM_SEND_OK;
+}
+
+void PicoFCMNotifierClass::enableTimeSync(bool enable)
+{
+    _timeSyncEnabled = enable;
+    if (enable && WiFi.status() == WL_CONNECTED) startTimeSync();
+}
+
+FCMNotificationStamp PicoFCMNotifierClass::stampNotification()
+{
+    FCMNotificationStamp stamp = {_nextSequence++, fcmWallClockMs()};
+    if (_nextSequence == 0) _nextSequence = 1;
+    return stamp;
+}
+
+// Make one send attempt over the configured delivery path
+FCMSendResult PicoFCMNotifierClass::attemptSend(const char *title, const char *body, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_SEND);
+    if (compactWireActive())
+    {
+        FCMSendResult result = attemptCompactSend(title, body, stamp, retryAfterMs);
+        if (compactWireActive()) return result;
+        // The function refused token registration; this notification goes out as JSON
+    }
+
+    FCMJsonWriter payload(_payloadBuffer, sizeof(_payloadBuffer));
+    writePayloadStart(payload);
+    payload.escaped(title, strlen(title));
+    payload.raw("\",\"body\":\"");
+    payload.escaped(body, strlen(body));
+    writePayloadEnd(payload, stamp);
+    return postPayload(payload, retryAfterMs);
+}
+
+void PicoFCMNotifierClass::writePayloadStart(FCMJsonWriter &payload)
+{
+    if (_deliveryMode == FCM_DELIVERY_DIRECT_V1)
+    {
+        payload.raw("{\"message\":{\"token\":").string(_fcmToken);
+        payload.raw(",\"notification\":{\"title\":\"");
+    }
+    else
+    {
+        payload.raw("{\"token\":").string(_fcmToken);
+        payload.raw(",\"title\":\"");
+    }
+}
+
+void PicoFCMNotifierClass::writePayloadEnd(FCMJsonWriter &payload, const FCMNotificationStamp &stamp)
+{
+    if (_deliveryMode == FCM_DELIVERY_DIRECT_V1)
+    {
+        // FCM data values must be strings
+        payload.raw("\"},\"data\":{\"seq\":").number(stamp.seq, true);
+        if (stamp.timestampMs != 0) payload.raw(",\"ts\":").number(stamp.timestampMs, true);
+        payload.raw("}}}");
+    }
+    else
+    {
+        payload.raw("\",\"seq\":").number(stamp.seq);
+        if (stamp.timestampMs != 0) payload.raw(",\"ts\":").number(stamp.timestampMs);
+        payload.raw("}");
+    }
+}
+
+const FCMHttpPreparedHead *PicoFCMNotifierClass::sendHead()
+{
+    if (_sendHeadGeneration != _endpointGeneration)
+    {
+        bool prepared;
+        if (_deliveryMode == FCM_DELIVERY_DIRECT_V1)
+        {
+            char url[MAX_FCM_URL_LENGTH + MAX_FCM_PROJECT_ID_LENGTH + 32];
+            snprintf(url, sizeof(url), "%s/v1/projects/%s/messages:send", _fcmApiUrl, _projectId);
+            prepared = fcmHttpPrepareHead(url, "application/json", _sendHead);
+        }
+        else
+        {
+            prepared = fcmHttpPrepareHead(_fcmUrl, "application/json", _sendHead);
+        }
+        if (!prepared) return nullptr;
+        _sendHeadGeneration = _endpointGeneration;
+    }
+    return &_sendHead;
+}
+
+FCMSendResult PicoFCMNotifierClass::postPayload(const FCMJsonWriter &payload, uint32_t *retryAfterMs, FCMAttachmentStream *attachment)
+{
+    FCMSendResult result;
+    *retryAfterMs = 0;
+    unsigned long startedAt = millis();
+
     if (WiFi.status() != WL_CONNECTED)
     {
         Serial.println("Error: WiFi not connected.");
-        return false;
+        result = FCM_SEND_NO_WIFI;
     }
-    if (strlen(_fcmUrl) == 0 || strlen(_fcmToken) == 0)
+    else if (!payload.ok())
+    {
+        Serial.println("Error: notification payload too large.");
+        result = FCM_SEND_PAYLOAD_TOO_LARGE;
+    }
+    else if (_deliveryMode == FCM_DELIVERY_DIRECT_V1)
+    {
+        // The Cloud Function URL is not used in direct mode
+        if (attachment)
+        {
+            // FCM messages are limited to 4 KB; attachments need a Cloud Function to receive them
+            Serial.println("Error: attachments require Cloud Function mode.");
+            result = FCM_SEND_NOT_CONFIGURED;
+        }
+        else if (strlen(_fcmToken) == 0)
+        {
+            Serial.println("Error: FCM Token not configured.");
+            result = FCM_SEND_NOT_CONFIGURED;
+        }
+        else
+        {
+            result = sendDirectNotification(payload, retryAfterMs);
+        }
+    }
+    else if (strlen(_fcmUrl) == 0 || strlen(_fcmToken) == 0)
     {
         Serial.println("Error: FCM URL or Token not configured.");
-        return false;
+        result = FCM_SEND_NOT_CONFIGURED;
+    }
+    else
+    {
+        result = sendCloudFunctionNotification(payload, retryAfterMs, attachment);
     }
 
-    HTTPClient http;
-    WiFiClientSecure client;
-    client.setInsecure(); // For simplicity, don't validate server cert
-
-    http.begin(client, _fcmUrl);
-    http.addHeader("Content-Type", "application/json");
+    recordSendResult(result, startedAt);
+    return result;
+}
 
-    JsonDocument payload;
-    payload["token"] = _fcmToken;
-    payload["title"] = title;
-    payload["body"] = body;
+void PicoFCMNotifierClass::recordSendResult(FCMSendResult result, unsigned long startedAt)
+{
+    _sendStats.attempts++;
+    if (result == FCM_SEND_OK)
+    {
+        _sendStats.delivered++;
+        markBootPhase(FCM_BOOT_FIRST_NOTIFICATION);
+        fcmRecordLatency(_sendStats.sendLatency, millis() - startedAt);
+    }
+    else
+    {
+        _sendStats.failures[result]++;
+    }
+    _lastSendResult = result;
+}
 
-    String jsonPayload;
-    serializeJson(payload, jsonPayload);
+// POST the notification to the provisioned Cloud Function
+FCMSendResult PicoFCMNotifierClass::sendCloudFunctionNotification(const FCMJsonWriter &payload, uint32_t *retryAfterMs, FCMAttachmentStream *attachment)
+{
+    const FCMHttpPreparedHead *head = sendHead();
+    if (!head) return FCM_SEND_NOT_CONFIGURED;
 
-    int httpResponseCode = http.POST(jsonPayload);
+    char responseBody[256];
+    FCMHttpRequest request = {nullptr, nullptr, nullptr, (const uint8_t *)payload.c_str(), payload.length(), head};
+    if (attachment)
+    {
+        request.bodyReader = fcmAttachmentBodyReader;
+        request.bodyReaderContext = attachment;
+    }
+    // Commands are parsed as the body streams in, so they need not fit into responseBody
+    FCMCommandParser commands(_commandBuffer + _commandLength, sizeof(_commandBuffer) - _commandLength);
+    FCMHttpResponse response = {0, 0, responseBody, sizeof(responseBody), 0, FCMCommandParser::sink, &commands};
+    FCMSendResult result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+    acceptCommands(commands, result);
 
-    if (httpResponseCode > 0)
+    if (response.statusCode > 0)
     {
-        String response = http.getString();
         Serial.print("HTTP Response code: ");
-        Serial.println(httpResponseCode);
-        Serial.println(response);
+        Serial.println(response.statusCode);
+        Serial.println(responseBody);
     }
     else
     {
         Serial.print("Error on sending POST: ");
-        Serial.println(http.errorToString(httpResponseCode).c_str());
+        Serial.println(fcmSendResultToString(result));
     }
 
-    http.end();
-    return (httpResponseCode == 200);
-}
\ No newline at end of file
+    *retryAfterMs = response.retryAfterMs;
+    return result;
+}
@@ -0,0 +1,173 @@
+/**
+ * PicoFCMNotifierAttachment.cpp - Notifications with streamed attachments.
+ *
+ * The attachment is sent to the Cloud Function as a base64 "attachment"
+ * field next to the usual payload fields, using chunked transfer encoding
+ * so its length does not need to be known up front.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMAttachment.h"
+#include "FCMJson.h"
+
+enum
+{
+    STAGE_PREFIX,
+    STAGE_DATA,
+    STAGE_SUFFIX,
+    STAGE_DONE
+};
+
+static size_t encodeBase64(const uint8_t *data, size_t length, char *out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < length; i += 3)
+    {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < length) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) v |= data[i + 2];
+        out[o++] = alphabet[(v >> 18) & 0x3F];
+        out[o++] = alphabet[(v >> 12) & 0x3F];
+        out[o++] = i + 1 < length ? alphabet[(v >> 6) & 0x3F] : '=';
+        out[o++] = i + 2 < length ? alphabet[v & 0x3F] : '=';
+    }
+    return o;
+}
+
+void fcmAttachmentStreamInit(FCMAttachmentStream &stream, FCMAttachmentReader reader, void *context,
+                             const char *prefix, size_t prefixLength,
+                             uint8_t *raw, size_t rawSize, char *encoded)
+{
+    memset(&stream, 0, sizeof(stream));
+    stream.reader = reader;
+    stream.context = context;
+    stream.prefix = prefix;
+    stream.prefixLength = prefixLength;
+    stream.raw = raw;
+    stream.rawSize = rawSize - rawSize % 3;
+    stream.encoded = encoded;
+    stream.stage = STAGE_PREFIX;
+}
+
+int fcmAttachmentBodyReader(void *context, const uint8_t **data)
+{
+    FCMAttachmentStream &stream = *(FCMAttachmentStream *)context;
+    switch (stream.stage)
+    {
+    case STAGE_PREFIX:
+        stream.stage = STAGE_DATA;
+        *data = (const uint8_t *)stream.prefix;
+        return (int)stream.prefixLength;
+
+    case STAGE_DATA:
+        // Read until at least one full base64 group is available
+        for (;;)
+        {
+            memcpy(stream.raw, stream.carry, stream.carryLength);
+            int read = stream.reader(stream.context, stream.raw + stream.carryLength, stream.rawSize - stream.carryLength);
+            if (read < 0) return -1;
+
+            size_t available = stream.carryLength + (size_t)read;
+            if (read == 0)
+            {
+                // End of the attachment: flush the padded last group
+                stream.stage = STAGE_SUFFIX;
+                stream.carryLength = 0;
+                if (available == 0) break;
+                *data = (const uint8_t *)stream.encoded;
+                return (int)encodeBase64(stream.raw, available, stream.encoded);
+            }
+
+            stream.bytesRead += read;
+            size_t whole = available - available % 3;
+            stream.carryLength = (uint8_t)(available - whole);
+            memcpy(stream.carry, stream.raw + whole, stream.carryLength);
+            if (whole > 0)
+            {
+                *data = (const uint8_t *)stream.encoded;
+                return (int)encodeBase64(stream.raw, whole, stream.encoded);
+            }
+        }
+        // Fall through to the suffix after an empty final read
+
+    case STAGE_SUFFIX:
+        stream.stage = STAGE_DONE;
+        *data = (const uint8_t *)stream.suffix;
+        return (int)stream.suffixLength;
+
+    default:
+        return 0;
+    }
+}
+
+// Reader over an open LittleFS file
+static int readFile(void *context, uint8_t *buffer, size_t size)
+{
+    File &file = *(File *)context;
+    return file.read(buffer, size);
+}
+
+bool PicoFCMNotifierClass::sendNotificationWithAttachment(const char *title, const char *body, const char *path)
+{
+    File file = LittleFS.open(path, "r");
+    if (!file)
+    {
+        Serial.print("Error: cannot open attachment ");
+        Serial.println(path);
+        return false;
+    }
+
+    // Name the attachment after the file, without its directory
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    uint32_t retryAfterMs = 0;
+    FCMSendResult result = attemptAttachmentSend(title, body, name, readFile, &file, stampNotification(), &retryAfterMs);
+    file.close();
+    return result == FCM_SEND_OK;
+}
+
+bool PicoFCMNotifierClass::sendNotificationWithAttachment(const char *title, const char *body, const char *name,
+                                                          FCMAttachmentReader reader, void *context)
+{
+    if (!reader) return false;
+    uint32_t retryAfterMs = 0;
+    return attemptAttachmentSend(title, body, name ? name : "attachment", reader, context, stampNotification(), &retryAfterMs) == FCM_SEND_OK;
+}
+
+FCMSendResult PicoFCMNotifierClass::attemptAttachmentSend(const char *title, const char *body, const char *name,
+                                                          FCMAttachmentReader reader, void *context,
+                                                          const FCMNotificationStamp &stamp, uint32_t *retryAfterMs)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_SEND);
+    FCMJsonWriter payload(_payloadBuffer, sizeof(_payloadBuffer));
+    writePayloadStart(payload);
+    payload.escaped(title, strlen(title));
+    payload.raw("\",\"body\":\"");
+    payload.escaped(body, strlen(body));
+    payload.raw("\",\"attachment_name\":").string(name);
+    payload.raw(",\"attachment\":\"");
+
+    // The payload buffer is free again once the prefix is sent, so chunks are encoded into it
+    FCMAttachmentStream stream;
+    fcmAttachmentStreamInit(stream, reader, context, payload.c_str(), payload.length(),
+                            _attachmentBuffer, sizeof(_attachmentBuffer), _payloadBuffer);
+
+    // The payload ending starts by closing the attachment string
+    FCMJsonWriter suffix(stream.suffix, sizeof(stream.suffix));
+    writePayloadEnd(suffix, stamp);
+    stream.suffixLength = suffix.length();
+
+    unsigned long startedAt = millis();
+    FCMSendResult result = postPayload(payload, retryAfterMs, &stream);
+    if (result == FCM_SEND_OK)
+    {
+        Serial.print("Attachment sent: ");
+        Serial.print(stream.bytesRead);
+        Serial.print(" bytes in ");
+        Serial.print(millis() - startedAt);
+        Serial.println(" ms");
+    }
+    return result;
+}
@@ -0,0 +1,201 @@
+/**
+ * PicoFCMNotifierBonds.cpp - Persistent bonds for fast BLE reconnects.
+ *
+ * Keeps the bonding keys (LTK, IRK) of the most recently used phones in
+ * LittleFS and restores them into the BTstack device database at startup,
+ * so a returning phone resumes encryption from its stored LTK instead of
+ * running a new pairing exchange.
+ */
+
+#include "PicoFCMNotifier.h"
+#include <btstack.h>
+#include <ArduinoJson.h>
+#include "FCMJsonAllocator.h"
+
+static void toHex(const uint8_t *data, size_t length, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++)
+    {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0x0F];
+    }
+    out[2 * length] = '\0';
+}
+
+static bool fromHex(const char *hex, uint8_t *out, size_t length)
+{
+    if (!hex || strlen(hex) != 2 * length) return false;
+    for (size_t i = 0; i < 2 * length; i++)
+    {
+        char c = hex[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else return false;
+        out[i / 2] = (i % 2 == 0) ? (uint8_t)(nibble << 4) : (uint8_t)(out[i / 2] | nibble);
+    }
+    return true;
+}
+
+// Find the device database slot holding an address, or -1
+static int findDeviceDbIndex(int addrType, const uint8_t *addr)
+{
+    for (int i = 0; i < le_device_db_max_count(); i++)
+    {
+        int entryType = BD_ADDR_TYPE_UNKNOWN;
+        bd_addr_t entryAddr;
+        sm_key_t irk;
+        le_device_db_info(i, &entryType, entryAddr, irk);
+        if (entryType == addrType && memcmp(entryAddr, addr, sizeof(entryAddr)) == 0) return i;
+    }
+    return -1;
+}
+
+bool PicoFCMNotifierClass::loadBondsFromFlash()
+{
+    _bondCount = 0;
+    if (!LittleFS.exists(BOND_STORE_FILE)) return false;
+
+    File bondFile = LittleFS.open(BOND_STORE_FILE, "r");
+    if (!bondFile) return false;
+
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, bondFile);
+    bondFile.close();
+    if (error) return false;
+
+    for (JsonObject entry : doc["bonds"].as<JsonArray>())
+    {
+        if (_bondCount >= MAX_BONDED_PEERS) break;
+        FCMBondRecord &bond = _bonds[_bondCount];
+        memset(&bond, 0, sizeof(bond));
+        bond.addrType = entry["addr_type"] | 0;
+        bond.ediv = entry["ediv"] | 0;
+        bond.keySize = entry["key_size"] | 16;
+        bond.authenticated = entry["authenticated"] | false;
+        bond.authorized = entry["authorized"] | false;
+        bond.secureConnection = entry["sc"] | false;
+        if (!fromHex(entry["addr"], bond.addr, sizeof(bond.addr)) ||
+            !fromHex(entry["irk"], bond.irk, sizeof(bond.irk)) ||
+            !fromHex(entry["ltk"], bond.ltk, sizeof(bond.ltk)) ||
+            !fromHex(entry["rand"], bond.rand, sizeof(bond.rand)))
+        {
+            continue;
+        }
+
+        // The database may already hold the peer (BTstack keeps its own copy when it can)
+        int index = findDeviceDbIndex(bond.addrType, bond.addr);
+        if (index < 0) index = le_device_db_add(bond.addrType, bond.addr, bond.irk);
+        if (index < 0)
+        {
+            Serial.println("BLE device database full, bond not restored.");
+            continue;
+        }
+        le_device_db_encryption_set(index, bond.ediv, bond.rand, bond.ltk, bond.keySize,
+                                    bond.authenticated, bond.authorized, bond.secureConnection);
+        _bondCount++;
+    }
+
+    Serial.print("Restored ");
+    Serial.print(_bondCount);
+    Serial.println(" bonded peers from flash.");
+    return _bondCount > 0;
+}
+
+bool PicoFCMNotifierClass::saveBondsToFlash()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    JsonArray bonds = doc["bonds"].to<JsonArray>();
+    char hex[33];
+    for (int i = 0; i < _bondCount; i++)
+    {
+        const FCMBondRecord &bond = _bonds[i];
+        JsonObject entry = bonds.add<JsonObject>();
+        entry["addr_type"] = bond.addrType;
+        toHex(bond.addr, sizeof(bond.addr), hex);
+        entry["addr"] = hex;
+        toHex(bond.irk, sizeof(bond.irk), hex);
+        entry["irk"] = hex;
+        toHex(bond.ltk, sizeof(bond.ltk), hex);
+        entry["ltk"] = hex;
+        toHex(bond.rand, sizeof(bond.rand), hex);
+        entry["rand"] = hex;
+        entry["ediv"] = bond.ediv;
+        entry["key_size"] = bond.keySize;
+        entry["authenticated"] = bond.authenticated;
+        entry["authorized"] = bond.authorized;
+        entry["sc"] = bond.secureConnection;
+    }
+
+    File bondFile = LittleFS.open(BOND_STORE_FILE, "w");
+    if (!bondFile) return false;
+
+    bool ok = serializeJson(doc, bondFile) > 0;
+    bondFile.close();
+    return ok;
+}
+
+void PicoFCMNotifierClass::rememberBond(uint16_t conHandle)
+{
+    int index = sm_le_device_index(conHandle);
+    if (index < 0) return;
+
+    FCMBondRecord bond;
+    memset(&bond, 0, sizeof(bond));
+    int keySize = 0, authenticated = 0, authorized = 0, secureConnection = 0;
+    le_device_db_info(index, &bond.addrType, bond.addr, bond.irk);
+    le_device_db_encryption_get(index, &bond.ediv, bond.rand, bond.ltk, &keySize, &authenticated, &authorized, &secureConnection);
+    bond.keySize = (uint8_t)keySize;
+    bond.authenticated = authenticated;
+    bond.authorized = authorized;
+    bond.secureConnection = secureConnection;
+    if (bond.keySize == 0) return; // No LTK was distributed, nothing to resume from
+
+    int existing = -1;
+    for (int i = 0; i < _bondCount; i++)
+    {
+        if (_bonds[i].addrType == bond.addrType && memcmp(_bonds[i].addr, bond.addr, sizeof(bond.addr)) == 0)
+        {
+            existing = i;
+            break;
+        }
+    }
+    // Re-encryption of the most recent peer with unchanged keys needs no flash write
+    if (existing == 0 && memcmp(&_bonds[0], &bond, sizeof(bond)) == 0) return;
+
+    if (existing < 0)
+    {
+        if (_bondCount == MAX_BONDED_PEERS)
+        {
+            // Evict the least recently used phone from the database as well
+            int evicted = findDeviceDbIndex(_bonds[_bondCount - 1].addrType, _bonds[_bondCount - 1].addr);
+            if (evicted >= 0 && evicted != index) le_device_db_remove(evicted);
+            _bondCount--;
+        }
+        existing = _bondCount++;
+    }
+    memmove(&_bonds[1], &_bonds[0], existing * sizeof(FCMBondRecord));
+    _bonds[0] = bond;
+    saveBondsToFlash();
+}
+
+uint8_t PicoFCMNotifierClass::getBondedPeerCount() { return _bondCount; }
+
+void PicoFCMNotifierClass::clearBondedPeers()
+{
+    for (int i = 0; i < _bondCount; i++)
+    {
+        int index = findDeviceDbIndex(_bonds[i].addrType, _bonds[i].addr);
+        if (index >= 0) le_device_db_remove(index);
+    }
+    _bondCount = 0;
+    memset(_bonds, 0, sizeof(_bonds));
+    if (LittleFS.exists(BOND_STORE_FILE))
+    {
+        LittleFS.remove(BOND_STORE_FILE);
+    }
+}
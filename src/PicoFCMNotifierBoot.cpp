@@ -0,0 +1,67 @@
+/**
+ * PicoFCMNotifierBoot.cpp - Boot timeline of the notifier.
+ *
+ * Records micros() when each startup milestone is first reached, from
+ * begin() to the first delivered notification, so full and staged startup
+ * can be compared on the device.
+ */
+
+#include "PicoFCMNotifier.h"
+
+const char *fcmBootPhaseToString(FCMBootPhase phase)
+{
+    switch (phase)
+    {
+    case FCM_BOOT_BEGIN: return "begin";
+    case FCM_BOOT_STORAGE_MOUNTED: return "storage mounted";
+    case FCM_BOOT_CONFIG_LOADED: return "config loaded";
+    case FCM_BOOT_WIFI_STARTED: return "WiFi join started";
+    case FCM_BOOT_BLE_STARTED: return "BLE started";
+    case FCM_BOOT_ADVERTISING: return "advertising";
+    case FCM_BOOT_WIFI_CONNECTED: return "WiFi connected";
+    case FCM_BOOT_FIRST_NOTIFICATION: return "first notification";
+    default: return "unknown";
+    }
+}
+
+void PicoFCMNotifierClass::markBootPhase(FCMBootPhase phase)
+{
+    if (_bootTimeline[phase] != 0) return;
+    uint32_t now = micros();
+    _bootTimeline[phase] = now != 0 ? now : 1;
+}
+
+uint32_t PicoFCMNotifierClass::getBootPhaseUs(FCMBootPhase phase)
+{
+    if (phase >= FCM_BOOT_PHASE_COUNT) return 0;
+    return _bootTimeline[phase];
+}
+
+void PicoFCMNotifierClass::printBootTimeline()
+{
+    Serial.println("Boot timeline (us since boot, +us since the previous phase):");
+    // Print in the order reached; with staged startup BLE may come after WiFi
+    bool printed[FCM_BOOT_PHASE_COUNT] = {};
+    uint32_t previous = 0;
+    for (;;)
+    {
+        int next = -1;
+        for (int i = 0; i < FCM_BOOT_PHASE_COUNT; i++)
+        {
+            if (printed[i] || _bootTimeline[i] == 0) continue;
+            if (next < 0 || _bootTimeline[i] < _bootTimeline[next]) next = i;
+        }
+        if (next < 0) break;
+        printed[next] = true;
+
+        uint32_t at = _bootTimeline[next];
+        Serial.print("  ");
+        Serial.print(fcmBootPhaseToString((FCMBootPhase)next));
+        Serial.print(": ");
+        Serial.print(at);
+        Serial.print(" (+");
+        Serial.print(previous != 0 ? at - previous : 0);
+        Serial.println(")");
+        previous = at;
+    }
+}
@@ -0,0 +1,224 @@
+/**
+ * PicoFCMNotifierCompact.cpp - Compact MessagePack requests to the Cloud Function.
+ *
+ * Registers the FCM token with the Cloud Function once and then sends each
+ * notification as a small MessagePack map that names the token by the short
+ * ID the function assigned, without a Content-Type header. The ID is kept on
+ * LittleFS together with a CRC of the URL and token it was issued for, so it
+ * survives reboots and is renewed when either changes.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMHttp.h"
+#include "FCMMsgPack.h"
+#include "FCMCommands.h"
+#include "FCMJsonAllocator.h"
+#include "FCMProvision.h"
+
+// Status the reference function answers with when it no longer knows a token ID
+#define HTTP_PRECONDITION_FAILED 412
+
+void PicoFCMNotifierClass::setWireFormat(FCMWireFormat format)
+{
+    _wireFormat = format;
+    _compactRejectedGeneration = 0;
+}
+
+FCMWireFormat PicoFCMNotifierClass::getWireFormat() { return _wireFormat; }
+
+bool PicoFCMNotifierClass::compactWireActive()
+{
+    // Sends that cannot go out anyway take the JSON path, which reports why
+    return _wireFormat == FCM_WIRE_MSGPACK && _deliveryMode == FCM_DELIVERY_CLOUD_FUNCTION &&
+           _compactRejectedGeneration != _endpointGeneration && WiFi.status() == WL_CONNECTED &&
+           _fcmUrl[0] != '\0' && _fcmToken[0] != '\0';
+}
+
+uint32_t PicoFCMNotifierClass::tokenIdCrc()
+{
+    uint32_t crc = fcmCrc32((const uint8_t *)_fcmUrl, strlen(_fcmUrl));
+    return fcmCrc32((const uint8_t *)_fcmToken, strlen(_fcmToken), crc);
+}
+
+const FCMHttpPreparedHead *PicoFCMNotifierClass::compactHead()
+{
+    if (_compactHeadGeneration != _endpointGeneration)
+    {
+        // The function recognises MessagePack by its first byte, so no Content-Type is sent
+        if (!fcmHttpPrepareHead(_fcmUrl, nullptr, _compactHead)) return nullptr;
+        _compactHeadGeneration = _endpointGeneration;
+    }
+    return &_compactHead;
+}
+
+FCMSendResult PicoFCMNotifierClass::attemptCompactSend(const char *title, const char *body, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs)
+{
+    *retryAfterMs = 0;
+    unsigned long startedAt = millis();
+    const FCMHttpPreparedHead *head = compactHead();
+    if (!head)
+    {
+        recordSendResult(FCM_SEND_NOT_CONFIGURED, startedAt);
+        return FCM_SEND_NOT_CONFIGURED;
+    }
+
+    // An ID the function has forgotten gets one re-registration before giving up
+    FCMSendResult result = FCM_SEND_HTTP_4XX;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        result = ensureTokenId(retryAfterMs);
+        if (_compactRejectedGeneration == _endpointGeneration) return result; // Caller sends JSON instead
+        if (result != FCM_SEND_OK) break;
+
+        FCMMsgPackWriter payload((uint8_t *)_payloadBuffer, sizeof(_payloadBuffer));
+        payload.map(stamp.timestampMs != 0 ? 5 : 4);
+        payload.uint(FCM_WIRE_KEY_TOKEN_ID).uint(_tokenId);
+        payload.uint(FCM_WIRE_KEY_TITLE).str(title);
+        payload.uint(FCM_WIRE_KEY_BODY).str(body);
+        payload.uint(FCM_WIRE_KEY_SEQ).uint(stamp.seq);
+        if (stamp.timestampMs != 0) payload.uint(FCM_WIRE_KEY_TS).uint(stamp.timestampMs);
+        if (!payload.ok())
+        {
+            Serial.println("Error: notification payload too large.");
+            result = FCM_SEND_PAYLOAD_TOO_LARGE;
+            break;
+        }
+
+        char responseBody[128];
+        FCMHttpRequest request = {nullptr, nullptr, nullptr, payload.data(), payload.length(), head};
+        FCMCommandParser commands(_commandBuffer + _commandLength, sizeof(_commandBuffer) - _commandLength);
+        FCMHttpResponse response = {0, 0, responseBody, sizeof(responseBody), 0, FCMCommandParser::sink, &commands};
+        result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+        acceptCommands(commands, result);
+        *retryAfterMs = response.retryAfterMs;
+
+        if (response.statusCode > 0)
+        {
+            Serial.print("HTTP Response code: ");
+            Serial.println(response.statusCode);
+            if (response.bodyLength > 0) Serial.println(responseBody);
+        }
+        else
+        {
+            Serial.print("Error on sending POST: ");
+            Serial.println(fcmSendResultToString(result));
+        }
+
+        if (response.statusCode == HTTP_PRECONDITION_FAILED)
+        {
+            Serial.println("Cloud Function does not know the token ID, registering again.");
+            _tokenId = 0;
+            continue;
+        }
+        break;
+    }
+
+    recordSendResult(result, startedAt);
+    return result;
+}
+
+FCMSendResult PicoFCMNotifierClass::sendCompactHeartbeat(uint32_t *retryAfterMs)
+{
+    *retryAfterMs = 0;
+    FCMSendResult result = ensureTokenId(retryAfterMs);
+    if (result != FCM_SEND_OK) return result;
+    const FCMHttpPreparedHead *head = compactHead();
+    if (!head) return FCM_SEND_NOT_CONFIGURED;
+
+    FCMMsgPackWriter payload((uint8_t *)_payloadBuffer, sizeof(_payloadBuffer));
+    payload.map(2).uint(FCM_WIRE_KEY_TOKEN_ID).uint(_tokenId).uint(FCM_WIRE_KEY_HEARTBEAT).uint(1);
+
+    FCMHttpRequest request = {nullptr, nullptr, nullptr, payload.data(), payload.length(), head};
+    FCMCommandParser commands(_commandBuffer + _commandLength, sizeof(_commandBuffer) - _commandLength);
+    FCMHttpResponse response = {0, 0, nullptr, 0, 0, FCMCommandParser::sink, &commands};
+    result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+    acceptCommands(commands, result);
+    *retryAfterMs = response.retryAfterMs;
+    // The next heartbeat or notification registers again
+    if (response.statusCode == HTTP_PRECONDITION_FAILED) _tokenId = 0;
+    return result;
+}
+
+FCMSendResult PicoFCMNotifierClass::ensureTokenId(uint32_t *retryAfterMs)
+{
+    uint32_t crc = tokenIdCrc();
+    if (!_tokenIdLoaded)
+    {
+        loadTokenIdFromFlash();
+        _tokenIdLoaded = true;
+    }
+    if (_tokenId != 0 && _tokenIdCrc == crc) return FCM_SEND_OK;
+    _tokenId = 0;
+
+    FCMMsgPackWriter payload((uint8_t *)_payloadBuffer, sizeof(_payloadBuffer));
+    payload.map(1).uint(FCM_WIRE_KEY_TOKEN).str(_fcmToken);
+
+    char responseBody[128];
+    FCMHttpRequest request = {nullptr, nullptr, nullptr, payload.data(), payload.length(), compactHead()};
+    FCMHttpResponse response = {0, 0, responseBody, sizeof(responseBody), 0};
+    FCMSendResult result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+    *retryAfterMs = response.retryAfterMs;
+    if (result == FCM_SEND_HTTP_4XX)
+    {
+        // A function without compact support rejects the request; that will not change on retry
+        Serial.println("Cloud Function rejected token registration, sending JSON instead.");
+        _compactRejectedGeneration = _endpointGeneration;
+        return result;
+    }
+    if (result != FCM_SEND_OK)
+    {
+        Serial.print("Token registration failed: ");
+        Serial.println(fcmSendResultToString(result));
+        return result;
+    }
+
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, responseBody, response.bodyLength);
+    uint32_t tokenId = error ? 0 : (doc["tokenId"] | 0UL);
+    if (tokenId == 0)
+    {
+        Serial.println("Error: invalid token registration response, sending JSON instead.");
+        _compactRejectedGeneration = _endpointGeneration;
+        return FCM_SEND_HTTP_4XX;
+    }
+
+    _tokenId = tokenId;
+    _tokenIdCrc = crc;
+    saveTokenIdToFlash();
+    Serial.print("Registered FCM token as ID ");
+    Serial.println(_tokenId);
+    return FCM_SEND_OK;
+}
+
+bool PicoFCMNotifierClass::loadTokenIdFromFlash()
+{
+    if (!LittleFS.exists(FCM_TOKEN_ID_FILE)) return false;
+
+    File idFile = LittleFS.open(FCM_TOKEN_ID_FILE, "r");
+    if (!idFile) return false;
+
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, idFile);
+    idFile.close();
+    if (error) return false;
+
+    _tokenId = doc["id"] | 0UL;
+    _tokenIdCrc = doc["crc"] | 0UL;
+    return _tokenId != 0;
+}
+
+bool PicoFCMNotifierClass::saveTokenIdToFlash()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    doc["id"] = _tokenId;
+    doc["crc"] = _tokenIdCrc;
+
+    File idFile = LittleFS.open(FCM_TOKEN_ID_FILE, "w");
+    if (!idFile) return false;
+
+    bool ok = serializeJson(doc, idFile) > 0;
+    idFile.close();
+    return ok;
+}
@@ -0,0 +1,338 @@
+/**
+ * PicoFCMNotifierDirect.cpp - Direct FCM HTTP v1 delivery.
+ *
+ * Signs a service account JWT on the device, exchanges it for an OAuth
+ * access token and posts notifications straight to the FCM v1
+ * `messages:send` endpoint, skipping the Cloud Function hop. The access
+ * token is cached in RAM and on LittleFS until shortly before it expires.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMHttp.h"
+#include "FCMJson.h"
+#include "FCMJsonAllocator.h"
+#include <sys/time.h>
+
+// OAuth scope required by the FCM HTTP v1 API
+static const char *FCM_OAUTH_SCOPE = "https://www.googleapis.com/auth/firebase.messaging";
+
+// base64url("{\"alg\":\"RS256\",\"typ\":\"JWT\"}")
+static const char *JWT_HEADER_B64 = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9";
+
+// Lifetime requested for each JWT assertion (Google allows at most one hour)
+static const uint32_t JWT_LIFETIME_S = 3600;
+
+// Refresh the access token this long before it actually expires
+static const uint32_t ACCESS_TOKEN_REFRESH_MARGIN_S = 60;
+
+// Any earlier wall-clock time means SNTP has not synced yet
+static const time_t MIN_VALID_EPOCH = 1700000000;
+
+// Encode binary data as unpadded base64url. Returns the encoded length,
+// or 0 if the output buffer is too small.
+static size_t base64UrlEncode(const uint8_t *data, size_t len, char *out, size_t outSize)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    size_t needed = (len * 4 + 2) / 3;
+    if (needed + 1 > outSize) return 0;
+
+    size_t o = 0;
+    size_t i = 0;
+    while (i + 2 < len)
+    {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        out[o++] = alphabet[(v >> 18) & 0x3F];
+        out[o++] = alphabet[(v >> 12) & 0x3F];
+        out[o++] = alphabet[(v >> 6) & 0x3F];
+        out[o++] = alphabet[v & 0x3F];
+        i += 3;
+    }
+    if (i < len)
+    {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        out[o++] = alphabet[(v >> 18) & 0x3F];
+        out[o++] = alphabet[(v >> 12) & 0x3F];
+        if (i + 1 < len) out[o++] = alphabet[(v >> 6) & 0x3F];
+    }
+    out[o] = '\0';
+    return o;
+}
+
+void PicoFCMNotifierClass::setDeliveryMode(FCMDeliveryMode mode)
+{
+    _deliveryMode = mode;
+    _endpointGeneration++;
+    if (mode == FCM_DELIVERY_DIRECT_V1 && WiFi.status() == WL_CONNECTED) startTimeSync();
+}
+
+FCMDeliveryMode PicoFCMNotifierClass::getDeliveryMode() { return _deliveryMode; }
+
+bool PicoFCMNotifierClass::setServiceAccount(const char *projectId, const char *clientEmail, const char *privateKeyPem)
+{
+    if (!projectId || !clientEmail || !privateKeyPem) return false;
+    if (strlen(projectId) > MAX_FCM_PROJECT_ID_LENGTH || strlen(clientEmail) > MAX_SERVICE_ACCOUNT_EMAIL_LENGTH)
+    {
+        Serial.println("Error: service account project ID or email too long.");
+        return false;
+    }
+
+    // A different service account invalidates any cached token
+    if (strcmp(_clientEmail, clientEmail) != 0 && _clientEmail[0] != '\0')
+    {
+        invalidateAccessToken();
+    }
+    strncpy(_projectId, projectId, MAX_FCM_PROJECT_ID_LENGTH);
+    strncpy(_clientEmail, clientEmail, MAX_SERVICE_ACCOUNT_EMAIL_LENGTH);
+    _privateKeyPem = privateKeyPem;
+    _endpointGeneration++;
+    return true;
+}
+
+void PicoFCMNotifierClass::setDirectEndpoints(const char *tokenUrl, const char *fcmApiUrl)
+{
+    if (tokenUrl) strncpy(_oauthTokenUrl, tokenUrl, MAX_FCM_URL_LENGTH);
+    if (fcmApiUrl) strncpy(_fcmApiUrl, fcmApiUrl, MAX_FCM_URL_LENGTH);
+    _endpointGeneration++;
+}
+
+void PicoFCMNotifierClass::invalidateAccessToken()
+{
+    memset(_accessToken, 0, sizeof(_accessToken));
+    _accessTokenExpiry = 0;
+    if (LittleFS.exists(FCM_OAUTH_CACHE_FILE))
+    {
+        LittleFS.remove(FCM_OAUTH_CACHE_FILE);
+    }
+}
+
+uint64_t fcmWallClockMs()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec < MIN_VALID_EPOCH) return 0;
+    return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+void PicoFCMNotifierClass::startTimeSync()
+{
+    if (time(nullptr) >= MIN_VALID_EPOCH) return;
+    NTP.begin("pool.ntp.org", "time.nist.gov");
+    Serial.println("Started SNTP time sync.");
+}
+
+// Load a previously cached access token from flash
+bool PicoFCMNotifierClass::loadAccessTokenFromFlash()
+{
+    if (!LittleFS.exists(FCM_OAUTH_CACHE_FILE)) return false;
+
+    File cacheFile = LittleFS.open(FCM_OAUTH_CACHE_FILE, "r");
+    if (!cacheFile) return false;
+
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, cacheFile);
+    cacheFile.close();
+    if (error) return false;
+
+    // Only reuse a token minted for the currently configured service account
+    const char *email = doc["email"];
+    const char *token = doc["token"];
+    if (!email || !token || strcmp(email, _clientEmail) != 0) return false;
+    if (strlen(token) > MAX_OAUTH_TOKEN_LENGTH) return false;
+
+    strncpy(_accessToken, token, MAX_OAUTH_TOKEN_LENGTH);
+    _accessTokenExpiry = (time_t)(doc["expires"] | 0L);
+    Serial.println("Loaded cached OAuth access token from flash.");
+    return true;
+}
+
+// Cache the current access token on flash
+bool PicoFCMNotifierClass::saveAccessTokenToFlash()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    doc["email"] = _clientEmail;
+    doc["token"] = _accessToken;
+    doc["expires"] = (long)_accessTokenExpiry;
+
+    File cacheFile = LittleFS.open(FCM_OAUTH_CACHE_FILE, "w");
+    if (!cacheFile) return false;
+
+    bool ok = serializeJson(doc, cacheFile) > 0;
+    cacheFile.close();
+    return ok;
+}
+
+// Build "<header>.<claims>.<signature>" signed with the service account key
+bool PicoFCMNotifierClass::buildSignedJwt(char *out, size_t outSize)
+{
+    time_t now = time(nullptr);
+
+    char claims[384];
+    int claimsLen = snprintf(claims, sizeof(claims),
+                             "{\"iss\":\"%s\",\"scope\":\"%s\",\"aud\":\"%s\",\"iat\":%lu,\"exp\":%lu}",
+                             _clientEmail, FCM_OAUTH_SCOPE, _oauthTokenUrl,
+                             (unsigned long)now, (unsigned long)(now + JWT_LIFETIME_S));
+    if (claimsLen <= 0 || (size_t)claimsLen >= sizeof(claims)) return false;
+
+    size_t headerLen = strlen(JWT_HEADER_B64);
+    if (headerLen + 1 >= outSize) return false;
+    memcpy(out, JWT_HEADER_B64, headerLen);
+    out[headerLen] = '.';
+    size_t claimsB64Len = base64UrlEncode((const uint8_t *)claims, claimsLen, out + headerLen + 1, outSize - headerLen - 1);
+    if (claimsB64Len == 0) return false;
+    size_t signingInputLen = headerLen + 1 + claimsB64Len;
+
+    uint8_t hash[32];
+    br_sha256_context sha;
+    br_sha256_init(&sha);
+    br_sha256_update(&sha, out, signingInputLen);
+    br_sha256_out(&sha, hash);
+
+    BearSSL::PrivateKey key(_privateKeyPem);
+    if (!key.isRSA())
+    {
+        Serial.println("Error: service account key is not an RSA key.");
+        return false;
+    }
+    const br_rsa_private_key *rsa = key.getRSA();
+    uint8_t signature[512];
+    size_t signatureLen = (rsa->n_bitlen + 7) / 8;
+    if (signatureLen > sizeof(signature)) return false;
+
+    br_rsa_pkcs1_sign sign = br_rsa_pkcs1_sign_get_default();
+    if (!sign(BR_HASH_OID_SHA256, hash, sizeof(hash), rsa, signature))
+    {
+        Serial.println("Error: failed to sign JWT.");
+        return false;
+    }
+
+    if (signingInputLen + 1 >= outSize) return false;
+    out[signingInputLen] = '.';
+    size_t signatureB64Len = base64UrlEncode(signature, signatureLen, out + signingInputLen + 1, outSize - signingInputLen - 1);
+    return signatureB64Len > 0;
+}
+
+// Exchange a freshly signed JWT for an OAuth access token
+FCMSendResult PicoFCMNotifierClass::requestAccessToken(uint32_t *retryAfterMs)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_OAUTH);
+    static const char *formPrefix = "grant_type=urn%3Aietf%3Aparams%3Aoauth%3Agrant-type%3Ajwt-bearer&assertion=";
+    size_t prefixLen = strlen(formPrefix);
+
+    // The JWT is base64url, so it can be appended to the form without escaping
+    char form[1152];
+    memcpy(form, formPrefix, prefixLen);
+    if (!buildSignedJwt(form + prefixLen, sizeof(form) - prefixLen)) return FCM_SEND_NOT_CONFIGURED;
+
+    // Token responses are too large for the stack; this runs about once an hour
+    size_t responseSize = MAX_OAUTH_TOKEN_LENGTH + 256;
+    char *responseBody = (char *)malloc(responseSize);
+    if (!responseBody) return FCM_SEND_AUTH_FAILED;
+
+    FCMHttpRequest request = {_oauthTokenUrl, "application/x-www-form-urlencoded", nullptr, (const uint8_t *)form, strlen(form)};
+    FCMHttpResponse response = {0, 0, responseBody, responseSize, 0};
+    FCMSendResult result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+    *retryAfterMs = response.retryAfterMs;
+    if (result != FCM_SEND_OK)
+    {
+        Serial.print("OAuth token request failed: ");
+        Serial.println(fcmSendResultToString(result));
+        free(responseBody);
+        // A rejected assertion (bad key, clock skew) will not fix itself on retry
+        return (result == FCM_SEND_HTTP_4XX) ? FCM_SEND_AUTH_FAILED : result;
+    }
+
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, responseBody, response.bodyLength);
+    free(responseBody);
+    if (error)
+    {
+        Serial.print("Failed to parse OAuth response: ");
+        Serial.println(error.c_str());
+        return FCM_SEND_AUTH_FAILED;
+    }
+
+    const char *accessToken = doc["access_token"];
+    long expiresIn = doc["expires_in"] | 0L;
+    if (!accessToken || strlen(accessToken) > MAX_OAUTH_TOKEN_LENGTH || expiresIn <= 0)
+    {
+        Serial.println("Error: invalid OAuth token response.");
+        return FCM_SEND_AUTH_FAILED;
+    }
+
+    strncpy(_accessToken, accessToken, MAX_OAUTH_TOKEN_LENGTH);
+    _accessTokenExpiry = time(nullptr) + expiresIn;
+    saveAccessTokenToFlash();
+    Serial.println("Obtained new OAuth access token.");
+    return FCM_SEND_OK;
+}
+
+FCMSendResult PicoFCMNotifierClass::ensureAccessToken(uint32_t *retryAfterMs)
+{
+    time_t now = time(nullptr);
+    if (now < MIN_VALID_EPOCH)
+    {
+        startTimeSync();
+        Serial.println("Error: system time not set, cannot use direct FCM mode yet.");
+        return FCM_SEND_CLOCK_NOT_SET;
+    }
+    // Warm start from a token cached before the last reboot, read once LittleFS
+    // is mounted and the service account is known
+    if (_accessToken[0] == '\0' && !_accessTokenCacheChecked && _begun && _clientEmail[0] != '\0')
+    {
+        _accessTokenCacheChecked = true;
+        loadAccessTokenFromFlash();
+    }
+    if (_accessToken[0] != '\0' && now + (time_t)ACCESS_TOKEN_REFRESH_MARGIN_S < _accessTokenExpiry)
+    {
+        return FCM_SEND_OK;
+    }
+    if (_privateKeyPem == nullptr || _projectId[0] == '\0' || _clientEmail[0] == '\0')
+    {
+        Serial.println("Error: service account not configured.");
+        return FCM_SEND_NOT_CONFIGURED;
+    }
+    return requestAccessToken(retryAfterMs);
+}
+
+FCMSendResult PicoFCMNotifierClass::sendDirectNotification(const FCMJsonWriter &payload, uint32_t *retryAfterMs)
+{
+    const FCMHttpPreparedHead *head = sendHead();
+    if (!head) return FCM_SEND_NOT_CONFIGURED;
+
+    // A token revoked server-side gets one refresh before giving up
+    FCMSendResult result = FCM_SEND_AUTH_FAILED;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        result = ensureAccessToken(retryAfterMs);
+        if (result != FCM_SEND_OK) return result;
+
+        char responseBody[256];
+        FCMHttpRequest request = {nullptr, nullptr, _accessToken, (const uint8_t *)payload.c_str(), payload.length(), head};
+        FCMHttpResponse response = {0, 0, responseBody, sizeof(responseBody), 0};
+        result = fcmHttpPost(tlsClient(), request, response, &_dnsCache);
+        *retryAfterMs = response.retryAfterMs;
+
+        if (response.statusCode > 0)
+        {
+            Serial.print("HTTP Response code: ");
+            Serial.println(response.statusCode);
+            Serial.println(responseBody);
+        }
+        else
+        {
+            Serial.print("Error on sending POST: ");
+            Serial.println(fcmSendResultToString(result));
+        }
+
+        if (response.statusCode == 401)
+        {
+            invalidateAccessToken();
+            continue;
+        }
+        return result;
+    }
+    return result;
+}
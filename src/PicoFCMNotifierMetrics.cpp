@@ -0,0 +1,214 @@
+/**
+ * PicoFCMNotifierMetrics.cpp - Prometheus metrics endpoint.
+ *
+ * A single-connection HTTP server polled from loop(). Requests are read
+ * byte by byte as they arrive and the response is rendered straight into
+ * the socket through FCMMetricsWriter's fixed buffer, so a scrape neither
+ * blocks the loop while waiting for the client nor allocates heap.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMMetrics.h"
+
+static void writeToClient(void *context, const char *data, size_t length)
+{
+    static_cast<WiFiClient *>(context)->write((const uint8_t *)data, length);
+}
+
+bool PicoFCMNotifierClass::beginMetricsServer(uint16_t port)
+{
+    stopMetricsServer();
+    _metricsServer = new WiFiServer(port);
+    _metricsServer->begin();
+    Serial.print("Metrics server listening on port ");
+    Serial.println(port);
+    return true;
+}
+
+void PicoFCMNotifierClass::stopMetricsServer()
+{
+    if (!_metricsServer) return;
+    _metricsClient.stop();
+    _metricsServer->end();
+    delete _metricsServer;
+    _metricsServer = nullptr;
+}
+
+void PicoFCMNotifierClass::serviceMetricsServer()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_METRICS);
+    if (!_metricsClient)
+    {
+        _metricsClient = _metricsServer->accept();
+        if (!_metricsClient) return;
+        _metricsRequestStart = millis();
+        _metricsRequestLine[0] = '\0';
+        _metricsRequestLength = 0;
+        _metricsHeaderEndMatch = 0;
+    }
+
+    if (!_metricsClient.connected() || millis() - _metricsRequestStart > FCM_METRICS_REQUEST_TIMEOUT_MS)
+    {
+        _metricsClient.stop();
+        return;
+    }
+
+    // Keep the start of the request line; the headers are only scanned for their end
+    static const char headerEnd[] = "\r\n\r\n";
+    while (_metricsClient.available() && _metricsHeaderEndMatch < 4)
+    {
+        char c = (char)_metricsClient.read();
+        if (_metricsRequestLength < sizeof(_metricsRequestLine))
+        {
+            if (c == '\r' || c == '\n')
+            {
+                _metricsRequestLength = sizeof(_metricsRequestLine); // Request line complete
+            }
+            else if ((size_t)_metricsRequestLength + 1 < sizeof(_metricsRequestLine))
+            {
+                _metricsRequestLine[_metricsRequestLength++] = c;
+                _metricsRequestLine[_metricsRequestLength] = '\0';
+            }
+        }
+        _metricsHeaderEndMatch = (c == headerEnd[_metricsHeaderEndMatch]) ? _metricsHeaderEndMatch + 1 : (c == '\r' ? 1 : 0);
+    }
+    if (_metricsHeaderEndMatch < 4) return;
+
+    const char *path = "GET /metrics";
+    size_t pathLength = strlen(path);
+    char next = _metricsRequestLine[pathLength];
+    bool found = strncmp(_metricsRequestLine, path, pathLength) == 0 && (next == ' ' || next == '?' || next == '\0');
+
+    if (found)
+    {
+        _metricsClient.print("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+        FCMMetricsWriter writer(writeToClient, &_metricsClient);
+        writeMetrics(writer);
+        writer.flush();
+    }
+    else
+    {
+        _metricsClient.print("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+    _metricsClient.flush();
+    _metricsClient.stop();
+}
+
+void PicoFCMNotifierClass::writeMetrics(FCMMetricsWriter &writer)
+{
+    writer.family("pico_fcm_send_attempts_total", "counter", "Notification send attempts.");
+    writer.sample("pico_fcm_send_attempts_total", nullptr, nullptr, _sendStats.attempts);
+    writer.family("pico_fcm_delivered_total", "counter", "Notifications accepted by the server.");
+    writer.sample("pico_fcm_delivered_total", nullptr, nullptr, _sendStats.delivered);
+    writer.family("pico_fcm_retries_total", "counter", "Retries scheduled by the retry queue.");
+    writer.sample("pico_fcm_retries_total", nullptr, nullptr, _sendStats.retries);
+    writer.family("pico_fcm_dropped_total", "counter", "Notifications given up on or rejected by a full queue.");
+    writer.sample("pico_fcm_dropped_total", nullptr, nullptr, _sendStats.dropped);
+
+    writer.family("pico_fcm_send_failures_total", "counter", "Failed send attempts by failure class.");
+    char label[24];
+    for (int i = FCM_SEND_OK + 1; i < FCM_SEND_RESULT_COUNT; i++)
+    {
+        fcmMetricsLabel(fcmSendResultToString((FCMSendResult)i), label, sizeof(label));
+        writer.sample("pico_fcm_send_failures_total", "class", label, _sendStats.failures[i]);
+    }
+
+    writer.histogramMs("pico_fcm_queue_latency_seconds", "Time from enqueue to the delivering attempt.",
+                       _sendStats.queueLatency.buckets, FCM_LATENCY_BUCKETS,
+                       _sendStats.queueLatency.count, _sendStats.queueLatency.totalMs);
+    writer.histogramMs("pico_fcm_send_latency_seconds", "Time from the start of the delivering attempt to 2xx.",
+                       _sendStats.sendLatency.buckets, FCM_LATENCY_BUCKETS,
+                       _sendStats.sendLatency.count, _sendStats.sendLatency.totalMs);
+
+    writer.family("pico_fcm_queue_depth", "gauge", "Notifications waiting in the retry queue.");
+    writer.sample("pico_fcm_queue_depth", nullptr, nullptr, getQueueDepth());
+
+    bool wifiConnected = WiFi.status() == WL_CONNECTED;
+    writer.family("pico_fcm_wifi_connected", "gauge", "Whether WiFi is connected.");
+    writer.sample("pico_fcm_wifi_connected", nullptr, nullptr, wifiConnected ? 1 : 0);
+    writer.family("pico_fcm_wifi_reconnects_total", "counter", "WiFi connections after the first one.");
+    writer.sample("pico_fcm_wifi_reconnects_total", nullptr, nullptr, _wifiReconnects);
+    if (wifiConnected)
+    {
+        writer.family("pico_fcm_wifi_rssi_dbm", "gauge", "WiFi signal strength.");
+        writer.sampleSigned("pico_fcm_wifi_rssi_dbm", getRSSI());
+    }
+    FCMRoamingStats roaming = getRoamingStats();
+    writer.family("pico_fcm_wifi_disconnects_total", "counter", "Times the WiFi link went down after connecting.");
+    writer.sample("pico_fcm_wifi_disconnects_total", nullptr, nullptr, roaming.disconnects);
+    writer.family("pico_fcm_wifi_disconnected_seconds_total", "counter", "Time the WiFi link was down after connecting.");
+    writer.sampleFixed("pico_fcm_wifi_disconnected_seconds_total", roaming.disconnectedMs, 3);
+    if (_roamingEnabled)
+    {
+        writer.family("pico_fcm_wifi_rssi_smoothed_dbm", "gauge", "Averaged WiFi signal strength used for roaming.");
+        writer.sampleSigned("pico_fcm_wifi_rssi_smoothed_dbm", roaming.smoothedRssi);
+        writer.family("pico_fcm_wifi_roams_total", "counter", "Switches to a stronger network or access point.");
+        writer.sample("pico_fcm_wifi_roams_total", nullptr, nullptr, roaming.roams);
+        writer.family("pico_fcm_wifi_failed_roams_total", "counter", "Switches that did not connect.");
+        writer.sample("pico_fcm_wifi_failed_roams_total", nullptr, nullptr, roaming.failedRoams);
+        writer.family("pico_fcm_wifi_scans_total", "counter", "Background scans started by the roaming monitor.");
+        writer.sample("pico_fcm_wifi_scans_total", nullptr, nullptr, roaming.scans);
+    }
+    if (_heartbeatIntervalMs > 0 || _remoteCommandsEnabled)
+    {
+        writer.family("pico_fcm_heartbeats_total", "counter", "Heartbeats answered by the Cloud Function.");
+        writer.sample("pico_fcm_heartbeats_total", nullptr, nullptr, _remoteStats.heartbeats);
+        writer.family("pico_fcm_heartbeat_failures_total", "counter", "Heartbeats that were not answered.");
+        writer.sample("pico_fcm_heartbeat_failures_total", nullptr, nullptr, _remoteStats.heartbeatFailures);
+        writer.family("pico_fcm_remote_commands_total", "counter", "Downstream commands by outcome.");
+        writer.sample("pico_fcm_remote_commands_total", "outcome", "applied", _remoteStats.commandsApplied);
+        writer.sample("pico_fcm_remote_commands_total", "outcome", "rejected", _remoteStats.commandsRejected);
+        writer.sample("pico_fcm_remote_commands_total", "outcome", "dropped", _remoteStats.commandsDropped);
+    }
+
+    writer.family("pico_fcm_ble_connected", "gauge", "Whether a phone is connected over BLE.");
+    writer.sample("pico_fcm_ble_connected", nullptr, nullptr, _connectedDevice ? 1 : 0);
+
+    writer.family("pico_fcm_loop_iterations_total", "counter", "Calls to PicoFCMNotifier.loop().");
+    writer.sample("pico_fcm_loop_iterations_total", nullptr, nullptr, _loopCount);
+    writer.family("pico_fcm_loop_duration_seconds_total", "counter", "Total time spent in PicoFCMNotifier.loop().");
+    writer.sampleFixed("pico_fcm_loop_duration_seconds_total", _loopTotalUs, 6);
+    writer.family("pico_fcm_loop_duration_max_seconds", "gauge", "Longest loop() call since the previous scrape.");
+    writer.sampleFixed("pico_fcm_loop_duration_max_seconds", _loopMaxUs, 6);
+    _loopMaxUs = 0;
+
+    writer.family("pico_fcm_heap_free_bytes", "gauge", "Free heap.");
+    writer.sample("pico_fcm_heap_free_bytes", nullptr, nullptr, rp2040.getFreeHeap());
+    writer.family("pico_fcm_heap_free_min_bytes", "gauge", "Lowest free heap seen since boot.");
+    writer.sample("pico_fcm_heap_free_min_bytes", nullptr, nullptr, _heapFreeMin == UINT32_MAX ? 0 : _heapFreeMin);
+
+    writer.family("pico_fcm_uptime_seconds", "gauge", "Time since boot.");
+    writer.sampleFixed("pico_fcm_uptime_seconds", millis(), 3);
+    writer.family("pico_fcm_boot_phase_seconds", "gauge", "Time from boot to each startup phase reached.");
+    for (int i = 0; i < FCM_BOOT_PHASE_COUNT; i++)
+    {
+        uint32_t at = getBootPhaseUs((FCMBootPhase)i);
+        if (at == 0) continue;
+        fcmMetricsLabel(fcmBootPhaseToString((FCMBootPhase)i), label, sizeof(label));
+        writer.sampleFixed("pico_fcm_boot_phase_seconds", "phase", label, at, 6);
+    }
+
+    if (!fcmAllocTrackingEnabled()) return;
+    writer.family("pico_fcm_alloc_calls_total", "counter", "Tracked library calls by API.");
+    for (int i = 0; i < FCM_ALLOC_API_COUNT; i++)
+    {
+        writer.sample("pico_fcm_alloc_calls_total", "api", fcmAllocApiToString((FCMAllocApi)i), fcmGetAllocStats((FCMAllocApi)i).calls);
+    }
+    writer.family("pico_fcm_alloc_allocations_total", "counter", "Heap allocations made inside library calls by API.");
+    for (int i = 0; i < FCM_ALLOC_API_COUNT; i++)
+    {
+        writer.sample("pico_fcm_alloc_allocations_total", "api", fcmAllocApiToString((FCMAllocApi)i), fcmGetAllocStats((FCMAllocApi)i).allocations);
+    }
+    writer.family("pico_fcm_alloc_bytes_total", "counter", "Bytes allocated inside library calls by API.");
+    for (int i = 0; i < FCM_ALLOC_API_COUNT; i++)
+    {
+        writer.sample("pico_fcm_alloc_bytes_total", "api", fcmAllocApiToString((FCMAllocApi)i), fcmGetAllocStats((FCMAllocApi)i).bytesAllocated);
+    }
+    writer.family("pico_fcm_alloc_peak_heap_bytes", "gauge", "Highest heap in use seen during a library call by API.");
+    for (int i = 0; i < FCM_ALLOC_API_COUNT; i++)
+    {
+        writer.sample("pico_fcm_alloc_peak_heap_bytes", "api", fcmAllocApiToString((FCMAllocApi)i), fcmGetAllocStats((FCMAllocApi)i).peakHeapUsed);
+    }
+    writer.family("pico_fcm_alloc_violations_total", "counter", "Steady-state allocation check violations.");
+    writer.sample("pico_fcm_alloc_violations_total", nullptr, nullptr, fcmGetAllocViolations());
+}
@@ -0,0 +1,184 @@
+/**
+ * PicoFCMNotifierPrepared.cpp - Prepared notification templates.
+ *
+ * A template is escaped and wrapped in the payload JSON of the current
+ * delivery mode once. Sending only copies the cached fragments, splices in
+ * the slot values and appends the stamp.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMJson.h"
+
+// Slot n is stored as the byte SLOT_MARKER + n. Escaped JSON never contains
+// raw control characters, so the markers cannot clash with template text.
+#define SLOT_MARKER 0x01
+
+// Escape template text, replacing each {n} placeholder by its marker byte
+static void writeTemplateText(FCMJsonWriter &out, const char *text)
+{
+    const char *run = text;
+    while (*text)
+    {
+        if (text[0] == '{' && text[1] >= '0' && text[1] < '0' + MAX_PREPARED_SLOTS && text[2] == '}')
+        {
+            out.escaped(run, text - run);
+            char marker = SLOT_MARKER + (text[1] - '0');
+            out.raw(&marker, 1);
+            text += 3;
+            run = text;
+        }
+        else
+        {
+            text++;
+        }
+    }
+    out.escaped(run, text - run);
+}
+
+// Highest placeholder used plus one
+static uint8_t countSlots(const char *text)
+{
+    uint8_t count = 0;
+    for (; *text; text++)
+    {
+        if (text[0] == '{' && text[1] >= '0' && text[1] < '0' + MAX_PREPARED_SLOTS && text[2] == '}')
+        {
+            uint8_t slot = text[1] - '0' + 1;
+            if (slot > count) count = slot;
+        }
+    }
+    return count;
+}
+
+static void writeSlotValue(FCMJsonWriter &out, const FCMSlotValue &value)
+{
+    if (value.text)
+    {
+        out.escaped(value.text, strlen(value.text));
+        return;
+    }
+
+    uint32_t magnitude = value.number < 0 ? 0u - (uint32_t)value.number : (uint32_t)value.number;
+    uint8_t decimals = value.decimals > 9 ? 9 : value.decimals;
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+
+    if (value.number < 0) out.raw("-", 1);
+    out.number(magnitude / scale);
+    if (decimals > 0)
+    {
+        char fraction[10];
+        uint32_t remainder = magnitude % scale;
+        fraction[0] = '.';
+        for (uint8_t i = decimals; i > 0; i--)
+        {
+            fraction[i] = '0' + (char)(remainder % 10);
+            remainder /= 10;
+        }
+        out.raw(fraction, decimals + 1);
+    }
+}
+
+uint8_t PicoFCMNotifierClass::prepareNotification(const char *title, const char *body)
+{
+    if (!title || !body) return 0;
+    if (strlen(title) > MAX_NOTIFICATION_TITLE_LENGTH || strlen(body) > MAX_NOTIFICATION_BODY_LENGTH)
+    {
+        Serial.println("Error: notification template too long.");
+        return 0;
+    }
+
+    for (int i = 0; i < MAX_PREPARED_NOTIFICATIONS; i++)
+    {
+        FCMPreparedNotification &prepared = _prepared[i];
+        if (prepared.inUse) continue;
+
+        strcpy(prepared.title, title);
+        strcpy(prepared.body, body);
+        uint8_t titleSlots = countSlots(title);
+        uint8_t bodySlots = countSlots(body);
+        prepared.slotCount = titleSlots > bodySlots ? titleSlots : bodySlots;
+        if (!compilePreparedNotification(prepared))
+        {
+            Serial.println("Error: notification template does not fit FCM_PREPARED_FRAGMENT_SIZE.");
+            return 0;
+        }
+        prepared.inUse = true;
+        return i + 1;
+    }
+    Serial.println("Error: no free prepared notification slot.");
+    return 0;
+}
+
+void PicoFCMNotifierClass::releasePreparedNotification(uint8_t id)
+{
+    if (id == 0 || id > MAX_PREPARED_NOTIFICATIONS) return;
+    memset(&_prepared[id - 1], 0, sizeof(FCMPreparedNotification));
+}
+
+bool PicoFCMNotifierClass::compilePreparedNotification(FCMPreparedNotification &prepared)
+{
+    FCMJsonWriter out(prepared.fragments, sizeof(prepared.fragments));
+    writePayloadStart(out);
+    writeTemplateText(out, prepared.title);
+    out.raw("\",\"body\":\"");
+    writeTemplateText(out, prepared.body);
+    if (!out.ok())
+    {
+        prepared.oversizedGeneration = _endpointGeneration;
+        return false;
+    }
+    prepared.fragmentsLength = out.length();
+    prepared.generation = _endpointGeneration;
+    return true;
+}
+
+bool PicoFCMNotifierClass::sendPreparedNotification(uint8_t id, const FCMSlotValue *values, uint8_t count)
+{
+    if (id == 0 || id > MAX_PREPARED_NOTIFICATIONS || !_prepared[id - 1].inUse)
+    {
+        Serial.println("Error: unknown prepared notification.");
+        return false;
+    }
+    FCMPreparedNotification &prepared = _prepared[id - 1];
+    if (count < prepared.slotCount || (count > 0 && !values))
+    {
+        Serial.println("Error: missing prepared notification values.");
+        return false;
+    }
+
+    uint32_t retryAfterMs = 0;
+    return attemptPreparedSend(prepared, values, stampNotification(), &retryAfterMs) == FCM_SEND_OK;
+}
+
+FCMSendResult PicoFCMNotifierClass::attemptPreparedSend(FCMPreparedNotification &prepared, const FCMSlotValue *values, const FCMNotificationStamp &stamp, uint32_t *retryAfterMs)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_SEND);
+
+    // Rebuild when the token or delivery mode changed since the last send, once per change
+    if (prepared.generation != _endpointGeneration &&
+        (prepared.oversizedGeneration == _endpointGeneration || !compilePreparedNotification(prepared)))
+    {
+        Serial.println("Error: prepared notification does not fit with the current endpoint.");
+        recordSendResult(FCM_SEND_PAYLOAD_TOO_LARGE, millis());
+        return FCM_SEND_PAYLOAD_TOO_LARGE;
+    }
+
+    FCMJsonWriter payload(_payloadBuffer, sizeof(_payloadBuffer));
+
+    const char *run = prepared.fragments;
+    const char *end = prepared.fragments + prepared.fragmentsLength;
+    for (const char *p = run; p < end; p++)
+    {
+        uint8_t slot = (uint8_t)*p - SLOT_MARKER;
+        if (slot < MAX_PREPARED_SLOTS)
+        {
+            payload.raw(run, p - run);
+            writeSlotValue(payload, values[slot]);
+            run = p + 1;
+        }
+    }
+    payload.raw(run, end - run);
+    writePayloadEnd(payload, stamp);
+    return postPayload(payload, retryAfterMs);
+}
@@ -0,0 +1,130 @@
+/**
+ * PicoFCMNotifierProvision.cpp - Binary provisioning over a serial port.
+ *
+ * Lets a production line load the whole configuration over USB in one
+ * request/acknowledgement exchange instead of pairing a phone with each
+ * unit. Frames are stored through saveNetwork() and saveConfigToFlash(),
+ * the same path as the BLE save command.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMProvision.h"
+
+bool PicoFCMNotifierClass::beginSerialProvisioning(Stream &port)
+{
+    if (!_provisionReceiver) _provisionReceiver = new FCMProvisionReceiver();
+    _provisionReceiver->reset();
+    _provisionPort = &port;
+    Serial.println("Serial provisioning enabled.");
+    return true;
+}
+
+void PicoFCMNotifierClass::stopSerialProvisioning()
+{
+    _provisionPort = nullptr;
+    delete _provisionReceiver;
+    _provisionReceiver = nullptr;
+}
+
+void PicoFCMNotifierClass::serviceSerialProvisioning()
+{
+    if (_provisionReceiver->receiving() && millis() - _provisionFrameStart > FCM_PROVISION_FRAME_TIMEOUT_MS)
+    {
+        Serial.println("Serial provisioning frame timed out.");
+        _provisionReceiver->reset();
+    }
+
+    // Bounded so a stream of bytes cannot stall loop()
+    for (int n = 0; n < FCM_PROVISION_FRAME_SIZE && _provisionPort->available() > 0; n++)
+    {
+        bool wasReceiving = _provisionReceiver->receiving();
+        bool complete = _provisionReceiver->push((uint8_t)_provisionPort->read());
+        if (!wasReceiving && _provisionReceiver->receiving()) _provisionFrameStart = millis();
+        if (!complete) continue;
+
+        uint8_t flags = 0;
+        FCMProvisionStatus status = (FCMProvisionStatus)applyProvisionFrame(*_provisionReceiver, flags);
+        uint8_t ack[FCM_PROVISION_ACK_SIZE];
+        fcmEncodeProvisionAck(status, _networkCount, _provisionReceiver->frameCrc(), ack);
+        _provisionPort->write(ack, sizeof(ack));
+        _provisionPort->flush();
+        _provisionReceiver->reset();
+
+        Serial.print("Serial provisioning: ");
+        Serial.println(fcmProvisionStatusToString(status));
+        if (status == FCM_PROVISION_OK && (flags & FCM_PROVISION_CONNECT))
+        {
+            connectToStoredNetworks();
+        }
+        return;
+    }
+}
+
+// Fields are copied into C strings, so an embedded NUL would silently cut them short
+static bool hasNul(const char *field, size_t length) { return memchr(field, '\0', length) != nullptr; }
+
+static bool sameSsid(const char *ssid, size_t ssidLength, const FCMProvisionNetwork &network)
+{
+    return ssidLength == network.ssidLength && memcmp(ssid, network.ssid, ssidLength) == 0;
+}
+
+uint8_t PicoFCMNotifierClass::applyProvisionFrame(const FCMProvisionReceiver &receiver, uint8_t &flags)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_COMMAND);
+    FCMProvisionBlob blob;
+    FCMProvisionStatus status = receiver.parse(blob);
+    if (status != FCM_PROVISION_OK) return status;
+    flags = blob.flags;
+    bool replace = blob.flags & FCM_PROVISION_REPLACE;
+
+    // Check the whole frame first, so a rejected one leaves the stored config as it was
+    if (blob.fcmUrlLength > MAX_FCM_URL_LENGTH || blob.fcmTokenLength > MAX_FCM_TOKEN_LENGTH ||
+        hasNul(blob.fcmUrl, blob.fcmUrlLength) || hasNul(blob.fcmToken, blob.fcmTokenLength))
+    {
+        return FCM_PROVISION_INVALID_FIELD;
+    }
+    int newNetworks = 0;
+    for (uint8_t i = 0; i < blob.networkCount; i++)
+    {
+        const FCMProvisionNetwork &network = blob.networks[i];
+        if (network.ssidLength == 0 || network.ssidLength > MAX_SSID_LENGTH || network.passwordLength > MAX_PASSWORD_LENGTH ||
+            hasNul(network.ssid, network.ssidLength) || hasNul(network.password, network.passwordLength))
+        {
+            return FCM_PROVISION_INVALID_FIELD;
+        }
+
+        // A repeated SSID updates the same slot, whether it is stored already or earlier in this frame
+        bool stored = false;
+        for (int j = 0; j < _networkCount && !replace; j++)
+        {
+            stored = stored || sameSsid(_networks[j].ssid, strlen(_networks[j].ssid), network);
+        }
+        for (uint8_t j = 0; j < i; j++)
+        {
+            stored = stored || sameSsid(blob.networks[j].ssid, blob.networks[j].ssidLength, network);
+        }
+        if (!stored) newNetworks++;
+    }
+    if ((replace ? 0 : _networkCount) + newNetworks > MAX_WIFI_NETWORKS) return FCM_PROVISION_TOO_MANY_NETWORKS;
+
+    if (replace) clearNetworks();
+
+    // Stage in locals: the _received* buffers belong to a BLE session that may be in progress
+    for (uint8_t i = 0; i < blob.networkCount; i++)
+    {
+        const FCMProvisionNetwork &network = blob.networks[i];
+        char ssid[MAX_SSID_LENGTH + 1] = {0};
+        char password[MAX_PASSWORD_LENGTH + 1] = {0};
+        memcpy(ssid, network.ssid, network.ssidLength);
+        memcpy(password, network.password, network.passwordLength);
+        if (!saveNetwork(ssid, password)) return FCM_PROVISION_STORAGE_FAILED;
+    }
+
+    // A field the frame does not carry keeps the stored value
+    char fcmUrl[MAX_FCM_URL_LENGTH + 1] = {0};
+    char fcmToken[MAX_FCM_TOKEN_LENGTH + 1] = {0};
+    if (blob.fcmUrlLength > 0) memcpy(fcmUrl, blob.fcmUrl, blob.fcmUrlLength);
+    if (blob.fcmTokenLength > 0) memcpy(fcmToken, blob.fcmToken, blob.fcmTokenLength);
+    if (!saveConfigToFlash(fcmUrl, fcmToken)) return FCM_PROVISION_STORAGE_FAILED;
+    return FCM_PROVISION_OK;
+}
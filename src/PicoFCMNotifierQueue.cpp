@@ -0,0 +1,310 @@
+/**
+ * PicoFCMNotifierQueue.cpp - Non-blocking retry engine.
+ *
+ * Queued notifications are attempted from loop(), one attempt per call.
+ * Failures that can succeed later are rescheduled with exponential backoff
+ * and jitter (or the server's Retry-After), bounded by the notification's
+ * attempt limit and absolute deadline. A single timer on the wheel wakes
+ * the queue for the next retry or deadline. Nothing here ever calls delay().
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMMetrics.h"
+
+const char *fcmSendResultToString(FCMSendResult result)
+{
+    switch (result)
+    {
+    case FCM_SEND_OK: return "ok";
+    case FCM_SEND_NO_WIFI: return "no WiFi";
+    case FCM_SEND_NOT_CONFIGURED: return "not configured";
+    case FCM_SEND_CLOCK_NOT_SET: return "clock not set";
+    case FCM_SEND_DNS_FAILED: return "DNS failed";
+    case FCM_SEND_CONNECT_FAILED: return "connect failed";
+    case FCM_SEND_TLS_FAILED: return "TLS failed";
+    case FCM_SEND_CERT_REJECTED: return "certificate rejected";
+    case FCM_SEND_TIMEOUT: return "timeout";
+    case FCM_SEND_HTTP_429: return "HTTP 429";
+    case FCM_SEND_HTTP_5XX: return "HTTP 5xx";
+    case FCM_SEND_AUTH_FAILED: return "auth failed";
+    case FCM_SEND_HTTP_4XX: return "HTTP 4xx";
+    case FCM_SEND_DEADLINE_EXCEEDED: return "deadline exceeded";
+    case FCM_SEND_PAYLOAD_TOO_LARGE: return "payload too large";
+    case FCM_SEND_ATTACHMENT_FAILED: return "attachment failed";
+    default: return "unknown";
+    }
+}
+
+bool fcmIsRetryable(FCMSendResult result)
+{
+    switch (result)
+    {
+    case FCM_SEND_NO_WIFI:
+    case FCM_SEND_CLOCK_NOT_SET:
+    case FCM_SEND_DNS_FAILED:
+    case FCM_SEND_CONNECT_FAILED:
+    case FCM_SEND_TLS_FAILED:
+    case FCM_SEND_TIMEOUT:
+    case FCM_SEND_HTTP_429:
+    case FCM_SEND_HTTP_5XX:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void fcmRecordLatency(FCMLatencyHistogram &histogram, uint32_t ms)
+{
+    histogram.buckets[fcmLatencyBucket(ms, FCM_LATENCY_BUCKETS)]++;
+    histogram.count++;
+    histogram.totalMs += ms;
+    if (ms > histogram.maxMs) histogram.maxMs = ms;
+}
+
+uint32_t fcmLatencyPercentile(const FCMLatencyHistogram &histogram, uint8_t percentile)
+{
+    if (histogram.count == 0) return 0;
+    if (percentile > 100) percentile = 100;
+    uint32_t target = (uint32_t)(((uint64_t)histogram.count * percentile + 99) / 100);
+    if (target == 0) target = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < FCM_LATENCY_BUCKETS - 1; i++)
+    {
+        seen += histogram.buckets[i];
+        if (seen >= target)
+        {
+            uint32_t upper = 1UL << i;
+            return upper < histogram.maxMs ? upper : histogram.maxMs;
+        }
+    }
+    return histogram.maxMs;
+}
+
+// Spread a delay by +/- jitterPercent so many devices do not retry in lockstep
+static uint32_t applyJitter(uint32_t delayMs, uint8_t jitterPercent)
+{
+    if (jitterPercent == 0 || delayMs == 0) return delayMs;
+    if (jitterPercent > 100) jitterPercent = 100;
+    uint32_t spread = (uint32_t)(((uint64_t)delayMs * jitterPercent) / 100);
+    return delayMs - spread + (uint32_t)random(0, (long)(2 * spread) + 1);
+}
+
+uint32_t PicoFCMNotifierClass::queueNotification(const char *title, const char *body, const FCMRetryPolicy *policy)
+{
+    if (!title || !body) return 0;
+    if (strlen(title) > MAX_NOTIFICATION_TITLE_LENGTH || strlen(body) > MAX_NOTIFICATION_BODY_LENGTH)
+    {
+        Serial.println("Error: notification title or body too long to queue.");
+        return 0;
+    }
+
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        FCMQueuedNotification &entry = _queue[i];
+        if (entry.inUse) continue;
+
+        entry.id = _nextNotificationId++;
+        if (_nextNotificationId == 0) _nextNotificationId = 1;
+        strncpy(entry.title, title, MAX_NOTIFICATION_TITLE_LENGTH);
+        entry.title[MAX_NOTIFICATION_TITLE_LENGTH] = '\0';
+        strncpy(entry.body, body, MAX_NOTIFICATION_BODY_LENGTH);
+        entry.body[MAX_NOTIFICATION_BODY_LENGTH] = '\0';
+        entry.policy = policy ? *policy : _defaultRetryPolicy;
+        entry.stamp = stampNotification();
+        if (entry.policy.maxAttempts == 0) entry.policy.maxAttempts = 1;
+        entry.attempts = 0;
+        entry.backoffMs = entry.policy.baseBackoffMs;
+        entry.queuedAt = millis();
+        entry.nextAttemptAt = entry.queuedAt;
+        entry.inUse = true;
+        armQueueTimer();
+        return entry.id;
+    }
+
+    Serial.println("Error: notification queue full.");
+    _sendStats.dropped++;
+    return 0;
+}
+
+bool PicoFCMNotifierClass::cancelNotification(uint32_t id)
+{
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        if (_queue[i].inUse && _queue[i].id == id)
+        {
+            _queue[i].inUse = false;
+            armQueueTimer();
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t PicoFCMNotifierClass::getQueueDepth()
+{
+    uint8_t depth = 0;
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        if (_queue[i].inUse) depth++;
+    }
+    return depth;
+}
+
+void PicoFCMNotifierClass::setDefaultRetryPolicy(const FCMRetryPolicy &policy) { _defaultRetryPolicy = policy; }
+
+void PicoFCMNotifierClass::setQueueRateLimit(uint32_t minIntervalMs)
+{
+    _queueMinIntervalMs = minIntervalMs;
+    armQueueTimer();
+}
+
+void PicoFCMNotifierClass::flushQueue()
+{
+    unsigned long now = millis();
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        if (_queue[i].inUse) _queue[i].nextAttemptAt = now;
+    }
+    armQueueTimer();
+}
+
+uint32_t PicoFCMNotifierClass::queuePacingMs(unsigned long now)
+{
+    if (_queueMinIntervalMs == 0 || !_queueAttempted) return 0;
+    uint32_t sinceAttempt = now - _lastQueueAttemptAt;
+    return sinceAttempt < _queueMinIntervalMs ? _queueMinIntervalMs - sinceAttempt : 0;
+}
+void PicoFCMNotifierClass::setNotificationResultCallback(void (*callback)(uint32_t id, FCMSendResult result, uint8_t attempts)) { _notificationResultCallback = callback; }
+FCMSendResult PicoFCMNotifierClass::getLastSendResult() { return _lastSendResult; }
+const FCMSendStats &PicoFCMNotifierClass::getSendStats() { return _sendStats; }
+void PicoFCMNotifierClass::resetSendStats() { memset(&_sendStats, 0, sizeof(_sendStats)); }
+
+void PicoFCMNotifierClass::finishQueuedNotification(FCMQueuedNotification &entry, FCMSendResult result)
+{
+    entry.inUse = false;
+    if (result != FCM_SEND_OK)
+    {
+        _sendStats.dropped++;
+        Serial.print("Giving up on notification ");
+        Serial.print(entry.id);
+        Serial.print(": ");
+        Serial.println(fcmSendResultToString(result));
+    }
+    if (_notificationResultCallback)
+    {
+        _notificationResultCallback(entry.id, result, entry.attempts);
+    }
+}
+
+void PicoFCMNotifierClass::onQueueTimer(void *self)
+{
+    PicoFCMNotifierClass &notifier = *(PicoFCMNotifierClass *)self;
+    notifier.processNotificationQueue();
+    notifier.armQueueTimer();
+}
+
+void PicoFCMNotifierClass::armQueueTimer()
+{
+    unsigned long now = millis();
+    // Without WiFi only deadlines can end an entry; attempts wait for the link
+    bool linkUp = WiFi.status() == WL_CONNECTED;
+    uint32_t pacingMs = queuePacingMs(now);
+    uint32_t wakeMs = FCM_TIMER_NONE;
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        const FCMQueuedNotification &entry = _queue[i];
+        if (!entry.inUse) continue;
+        if (linkUp)
+        {
+            uint32_t untilAttempt = (long)(entry.nextAttemptAt - now) > 0 ? entry.nextAttemptAt - now : 0;
+            if (untilAttempt < pacingMs) untilAttempt = pacingMs;
+            if (untilAttempt < wakeMs) wakeMs = untilAttempt;
+        }
+        if (entry.policy.deadlineMs > 0)
+        {
+            uint32_t age = now - entry.queuedAt;
+            uint32_t untilDeadline = age < entry.policy.deadlineMs ? entry.policy.deadlineMs - age : 0;
+            if (untilDeadline < wakeMs) wakeMs = untilDeadline;
+        }
+    }
+
+    if (wakeMs == FCM_TIMER_NONE)
+    {
+        _timers.cancel(_queueTimer);
+        _queueTimer = 0;
+    }
+    else if (!_timers.reschedule(_queueTimer, now, wakeMs))
+    {
+        _queueTimer = _timers.schedule(now, wakeMs, onQueueTimer, this);
+    }
+}
+
+void PicoFCMNotifierClass::processNotificationQueue()
+{
+    unsigned long now = millis();
+
+    // Expire entries past their deadline, and pick the oldest one that is due
+    FCMQueuedNotification *due = nullptr;
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        FCMQueuedNotification &entry = _queue[i];
+        if (!entry.inUse) continue;
+
+        if (entry.policy.deadlineMs > 0 && now - entry.queuedAt >= entry.policy.deadlineMs)
+        {
+            finishQueuedNotification(entry, FCM_SEND_DEADLINE_EXCEEDED);
+            continue;
+        }
+        if ((long)(now - entry.nextAttemptAt) >= 0 && (!due || entry.id < due->id))
+        {
+            due = &entry;
+        }
+    }
+
+    // Attempts without WiFi cannot succeed; wait for the link instead of using them up
+    if (!due || WiFi.status() != WL_CONNECTED) return;
+    if (queuePacingMs(now) > 0) return;
+
+    uint32_t retryAfterMs = 0;
+    unsigned long startedAt = millis();
+    _lastQueueAttemptAt = startedAt;
+    _queueAttempted = true;
+    FCMSendResult result = attemptSend(due->title, due->body, due->stamp, &retryAfterMs);
+    due->attempts++;
+
+    if (result == FCM_SEND_OK)
+    {
+        fcmRecordLatency(_sendStats.queueLatency, startedAt - due->queuedAt);
+        finishQueuedNotification(*due, result);
+        return;
+    }
+    if (!fcmIsRetryable(result) || due->attempts >= due->policy.maxAttempts)
+    {
+        finishQueuedNotification(*due, result);
+        return;
+    }
+
+    uint32_t delayMs = applyJitter(due->backoffMs, due->policy.jitterPercent);
+    if (result == FCM_SEND_HTTP_429 && retryAfterMs > delayMs)
+    {
+        delayMs = retryAfterMs;
+    }
+
+    // Do not schedule a retry that could only happen after the deadline; the
+    // failure that caused it stays available from getLastSendResult()
+    now = millis();
+    if (due->policy.deadlineMs > 0 && (now + delayMs) - due->queuedAt >= due->policy.deadlineMs)
+    {
+        finishQueuedNotification(*due, FCM_SEND_DEADLINE_EXCEEDED);
+        return;
+    }
+
+    due->nextAttemptAt = now + delayMs;
+    due->backoffMs = (due->backoffMs > due->policy.maxBackoffMs / 2) ? due->policy.maxBackoffMs : due->backoffMs * 2;
+    _sendStats.retries++;
+    Serial.print("Retrying notification ");
+    Serial.print(due->id);
+    Serial.print(" in ");
+    Serial.print(delayMs);
+    Serial.println(" ms");
+}
@@ -0,0 +1,210 @@
+/**
+ * PicoFCMNotifierRemote.cpp - Downstream commands and heartbeats.
+ *
+ * The Cloud Function may piggyback a list of commands on the response to
+ * any request ({"cmd": ["rate 30000", "flush"]}). They are parsed while the
+ * body streams in, kept in a fixed buffer and applied from loop(). Devices
+ * that have nothing to send post a small heartbeat instead, so the function
+ * can reach them without a polling connection or an open socket.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMHttp.h"
+#include "FCMJson.h"
+#include "FCMCommands.h"
+#include "FCMJsonAllocator.h"
+
+void PicoFCMNotifierClass::enableRemoteCommands(bool enable) { _remoteCommandsEnabled = enable; }
+
+void PicoFCMNotifierClass::setRemoteCommandCallback(bool (*callback)(const char *name, const char *argument)) { _remoteCommandCallback = callback; }
+
+void PicoFCMNotifierClass::setHeartbeatInterval(uint32_t intervalMs)
+{
+    _heartbeatIntervalMs = intervalMs;
+    _timers.cancel(_heartbeatTimer);
+    _heartbeatTimer = intervalMs > 0 ? _timers.schedule(millis(), intervalMs, onHeartbeatTimer, this, intervalMs) : 0;
+}
+
+FCMRemoteStats PicoFCMNotifierClass::getRemoteStats() { return _remoteStats; }
+
+void PicoFCMNotifierClass::acceptCommands(const FCMCommandParser &commands, FCMSendResult result)
+{
+    if (result != FCM_SEND_OK) return;
+
+    // Any answered request reaches the function as well as a heartbeat would
+    if (_heartbeatTimer != 0) _timers.reschedule(_heartbeatTimer, millis(), _heartbeatIntervalMs);
+
+    if (!_remoteCommandsEnabled) return;
+    _remoteStats.commandsDropped += commands.dropped();
+    if (commands.count() == 0) return;
+    _commandLength += commands.length();
+    if (!_timers.pending(_commandTimer)) _commandTimer = _timers.schedule(millis(), 0, onCommandTimer, this);
+}
+
+void PicoFCMNotifierClass::onCommandTimer(void *self) { ((PicoFCMNotifierClass *)self)->applyRemoteCommands(); }
+
+void PicoFCMNotifierClass::applyRemoteCommands()
+{
+    // A command callback may send, which appends to the buffer; those wait for the next run
+    size_t batchLength = _commandLength;
+    size_t offset = 0;
+    while (offset < batchLength)
+    {
+        char *command = _commandBuffer + offset;
+        offset += strlen(command) + 1;
+        applyRemoteCommand(command);
+    }
+    memmove(_commandBuffer, _commandBuffer + batchLength, _commandLength - batchLength);
+    _commandLength -= batchLength;
+    if (_commandLength > 0) _commandTimer = _timers.schedule(millis(), 0, onCommandTimer, this);
+}
+
+// Parse a whole decimal argument
+static bool parseCommandNumber(const char *argument, uint32_t &value)
+{
+    char *end;
+    unsigned long parsed = strtoul(argument, &end, 10);
+    if (*argument < '0' || *argument > '9' || *end != '\0') return false;
+    value = parsed;
+    return true;
+}
+
+bool PicoFCMNotifierClass::applyRemoteCommand(char *command)
+{
+    // "name argument", the argument running to the end of the command
+    char *argument = strchr(command, ' ');
+    if (argument) *argument++ = '\0';
+    else argument = command + strlen(command);
+
+    bool applied = false;
+    uint32_t value;
+    FCMUrl url;
+    if (strcmp(command, "rate") == 0)
+    {
+        if (parseCommandNumber(argument, value))
+        {
+            setQueueRateLimit(value);
+            saveRemoteSetting("rate", value);
+            applied = true;
+        }
+    }
+    else if (strcmp(command, "heartbeat") == 0)
+    {
+        if (parseCommandNumber(argument, value) && (value == 0 || value >= FCM_MIN_REMOTE_HEARTBEAT_MS))
+        {
+            setHeartbeatInterval(value);
+            saveRemoteSetting("heartbeat", value);
+            applied = true;
+        }
+    }
+    else if (strcmp(command, "flush") == 0)
+    {
+        flushQueue();
+        applied = true;
+    }
+    else if (strcmp(command, "token") == 0 || strcmp(command, "url") == 0)
+    {
+        // Without verification anyone on the path could forge the response and
+        // redirect the notifications for good, so the endpoint stays as it is
+        size_t length = strlen(argument);
+        if (_tlsMode == FCM_TLS_INSECURE)
+        {
+            Serial.println("Endpoint commands need a verifying TLS mode");
+        }
+        else if (command[0] == 't')
+        {
+            applied = length > 0 && length <= MAX_FCM_TOKEN_LENGTH && saveEndpoint(nullptr, argument);
+        }
+        else
+        {
+            applied = length <= MAX_FCM_URL_LENGTH && fcmParseUrl(argument, url) && saveEndpoint(argument, nullptr);
+        }
+    }
+    else if (_remoteCommandCallback)
+    {
+        applied = _remoteCommandCallback(command, argument);
+    }
+
+    Serial.print(applied ? "Applied remote command: " : "Rejected remote command: ");
+    Serial.println(command);
+    if (applied) _remoteStats.commandsApplied++;
+    else _remoteStats.commandsRejected++;
+    return applied;
+}
+
+bool PicoFCMNotifierClass::saveEndpoint(const char *url, const char *token)
+{
+    // Not through the _received* buffers, which belong to a BLE session that may be in progress
+    return saveConfigToFlash(url, token);
+}
+
+void PicoFCMNotifierClass::onHeartbeatTimer(void *self)
+{
+    PicoFCMNotifierClass &notifier = *(PicoFCMNotifierClass *)self;
+    // Skipped while there is no Cloud Function to reach; the next period tries again
+    if (notifier._deliveryMode != FCM_DELIVERY_CLOUD_FUNCTION || WiFi.status() != WL_CONNECTED ||
+        notifier._fcmUrl[0] == '\0' || notifier._fcmToken[0] == '\0')
+    {
+        return;
+    }
+
+    if (notifier.sendHeartbeat() == FCM_SEND_OK) notifier._remoteStats.heartbeats++;
+    else notifier._remoteStats.heartbeatFailures++;
+}
+
+// Heartbeats are not notifications, so they stay out of the send statistics
+FCMSendResult PicoFCMNotifierClass::sendHeartbeat()
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_SEND);
+    uint32_t retryAfterMs = 0;
+    if (compactWireActive())
+    {
+        FCMSendResult result = sendCompactHeartbeat(&retryAfterMs);
+        if (compactWireActive()) return result;
+        // The function refused token registration; this heartbeat goes out as JSON
+    }
+
+    FCMJsonWriter payload(_payloadBuffer, sizeof(_payloadBuffer));
+    payload.raw("{\"token\":").string(_fcmToken).raw(",\"heartbeat\":true}");
+    if (!payload.ok()) return FCM_SEND_PAYLOAD_TOO_LARGE;
+    return sendCloudFunctionNotification(payload, &retryAfterMs, nullptr);
+}
+
+bool PicoFCMNotifierClass::loadRemoteConfigFromFlash()
+{
+    if (!LittleFS.exists(FCM_REMOTE_CONFIG_FILE)) return false;
+
+    File configFile = LittleFS.open(FCM_REMOTE_CONFIG_FILE, "r");
+    if (!configFile) return false;
+
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    DeserializationError error = deserializeJson(doc, configFile);
+    configFile.close();
+    if (error) return false;
+
+    if (doc["rate"].is<uint32_t>()) setQueueRateLimit(doc["rate"]);
+    if (doc["heartbeat"].is<uint32_t>()) setHeartbeatInterval(doc["heartbeat"]);
+    return true;
+}
+
+// Only settings a command changed are stored, so the sketch's own defaults can still change
+bool PicoFCMNotifierClass::saveRemoteSetting(const char *key, uint32_t value)
+{
+    FCM_ALLOC_SCOPE(FCM_ALLOC_API_STORAGE);
+    JsonDocument doc(FCMJsonAllocator::instance());
+    File configFile = LittleFS.open(FCM_REMOTE_CONFIG_FILE, "r");
+    if (configFile)
+    {
+        deserializeJson(doc, configFile);
+        configFile.close();
+    }
+    doc[key] = value;
+
+    configFile = LittleFS.open(FCM_REMOTE_CONFIG_FILE, "w");
+    if (!configFile) return false;
+
+    bool ok = serializeJson(doc, configFile) > 0;
+    configFile.close();
+    return ok;
+}
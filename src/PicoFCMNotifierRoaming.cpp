@@ -0,0 +1,170 @@
+/**
+ * PicoFCMNotifierRoaming.cpp - Proactive roaming between stored networks.
+ *
+ * Averages the RSSI of the current link, scans in the background once it
+ * gets weak (or the link is lost), and moves to a clearly stronger stored
+ * network or access point while nothing is being sent, instead of waiting
+ * for the link to drop.
+ */
+
+#include "PicoFCMNotifier.h"
+#include "FCMProvision.h"
+
+// Treated as the signal of a link that is down, so any candidate is better
+#define NO_SIGNAL_DBM -127
+
+void PicoFCMNotifierClass::enableRoaming(const FCMRoamingConfig *config)
+{
+    if (config) _roamingConfig = *config;
+    _roamingEnabled = true;
+    _roamRssiValid = false;
+    _roamCandidate = -1;
+    // Allow a scan right away if the signal is already weak
+    _lastRoamScan = millis() - _roamingConfig.scanIntervalMs;
+}
+
+void PicoFCMNotifierClass::disableRoaming()
+{
+    _roamingEnabled = false;
+    _roamCandidate = -1;
+    if (_roamScanRunning)
+    {
+        WiFi.scanDelete();
+        _roamScanRunning = false;
+    }
+}
+
+FCMRoamingStats PicoFCMNotifierClass::getRoamingStats()
+{
+    FCMRoamingStats stats = _roamingStats;
+    if (_wifiDownSince != 0) stats.disconnectedMs += millis() - _wifiDownSince;
+    stats.smoothedRssi = _roamRssiValid ? _roamRssiQ4 / 16 : 0;
+    return stats;
+}
+
+bool PicoFCMNotifierClass::roamingIsQuiet(unsigned long now)
+{
+    if (_connectedDevice != nullptr || _metricsClient) return false;
+    if (_provisionReceiver && _provisionReceiver->receiving()) return false;
+    for (int i = 0; i < MAX_QUEUED_NOTIFICATIONS; i++)
+    {
+        const FCMQueuedNotification &entry = _queue[i];
+        if (entry.inUse && (long)(entry.nextAttemptAt - now) < (long)_roamingConfig.quietMs) return false;
+    }
+    return true;
+}
+
+void PicoFCMNotifierClass::serviceRoaming()
+{
+    unsigned long now = millis();
+    bool linkUp = WiFi.status() == WL_CONNECTED;
+
+    // A roam that did not connect goes back to the network it left
+    if (_roamFromNetwork >= 0 && _status == PROVISION_FAILED)
+    {
+        WiFiNetworkConfig &previous = _networks[_roamFromNetwork];
+        _roamFromNetwork = -1;
+        _roamingStats.failedRoams++;
+        Serial.println("Roam failed, returning to the previous network.");
+        connectToNetwork(previous.ssid, previous.password);
+        return;
+    }
+    if (_status != PROVISION_CONNECTED) return;
+    if (linkUp) _roamFromNetwork = -1;
+
+    if (linkUp && (!_roamRssiValid || now - _lastRoamSample >= FCM_ROAM_RSSI_SAMPLE_MS))
+    {
+        _lastRoamSample = now;
+        int32_t sample = WiFi.RSSI() * 16;
+        if (!_roamRssiValid) _roamRssiQ4 = sample;
+        else _roamRssiQ4 += (sample - _roamRssiQ4) / FCM_ROAM_EWMA_WEIGHT;
+        _roamRssiValid = true;
+    }
+    int32_t smoothedRssi = linkUp ? _roamRssiQ4 / 16 : NO_SIGNAL_DBM;
+
+    if (_roamScanRunning)
+    {
+        finishRoamScan(smoothedRssi, linkUp);
+        return;
+    }
+
+    if (_roamCandidate >= 0)
+    {
+        if (now - _roamCandidateAt > FCM_ROAM_CANDIDATE_TTL_MS)
+        {
+            _roamCandidate = -1;
+        }
+        // Queued sends cannot go out while the link is down, so only a BLE session holds a reconnect back
+        else if (linkUp ? roamingIsQuiet(now) : _connectedDevice == nullptr)
+        {
+            // Remember where we came from in case the new network does not connect
+            _roamFromNetwork = -1;
+            for (int i = 0; i < _networkCount && linkUp; i++)
+            {
+                if (strcmp(_networks[i].ssid, WiFi.SSID()) == 0) _roamFromNetwork = i;
+            }
+
+            WiFiNetworkConfig &target = _networks[_roamCandidate];
+            Serial.print("Roaming to ");
+            Serial.println(target.ssid);
+            _roamingStats.roams++;
+            _roamCandidate = -1;
+            _roamRssiValid = false;
+            connectToNetwork(target.ssid, target.password, _roamCandidateBssid);
+        }
+        return;
+    }
+
+    uint32_t scanIntervalMs = linkUp ? _roamingConfig.scanIntervalMs : FCM_ROAM_LINK_DOWN_SCAN_MS;
+    if (smoothedRssi < _roamingConfig.scanThresholdDbm && now - _lastRoamScan >= scanIntervalMs)
+    {
+        _lastRoamScan = now;
+        if (WiFi.scanNetworks(true) < -1) return; // Could not start; try again next interval
+        _roamScanRunning = true;
+        _roamingStats.scans++;
+    }
+}
+
+void PicoFCMNotifierClass::finishRoamScan(int32_t smoothedRssi, bool linkUp)
+{
+    int found = WiFi.scanComplete();
+    if (found == -1) return; // Still scanning
+    _roamScanRunning = false;
+    if (found < 0) return;
+
+    uint8_t current[6];
+    bool haveCurrent = linkUp && WiFi.BSSID(current) != nullptr;
+    int best = -1;
+    int32_t bestRssi = NO_SIGNAL_DBM;
+    uint8_t bssid[6];
+    for (int i = 0; i < found; i++)
+    {
+        int network = -1;
+        for (int j = 0; j < _networkCount; j++)
+        {
+            if (_networks[j].enabled && strcmp(_networks[j].ssid, WiFi.SSID(i)) == 0) network = j;
+        }
+        if (network < 0 || WiFi.RSSI(i) <= bestRssi) continue;
+
+        // Another access point of the current network is a valid candidate, the current one is not
+        WiFi.BSSID(i, bssid);
+        if (haveCurrent && memcmp(bssid, current, sizeof(bssid)) == 0) continue;
+        best = network;
+        bestRssi = WiFi.RSSI(i);
+        memcpy(_roamCandidateBssid, bssid, sizeof(bssid));
+    }
+    WiFi.scanDelete();
+
+    if (best >= 0 && bestRssi >= smoothedRssi + _roamingConfig.minGainDb)
+    {
+        _roamCandidate = best;
+        _roamCandidateAt = millis();
+        Serial.print("Roam candidate: ");
+        Serial.print(_networks[best].ssid);
+        Serial.print(" at ");
+        Serial.print(bestRssi);
+        Serial.print(" dBm, current ");
+        Serial.print(smoothedRssi);
+        Serial.println(" dBm");
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * PicoFCMNotifierStatus.cpp - Device Status characteristic.
+ *
+ * Streams a compact binary status record to subscribed apps. After an
+ * initial full snapshot only the fields that changed are sent. The fields
+ * are sampled no more often than FCM_STATUS_MIN_INTERVAL_MS, so a chatty
+ * WiFi link cannot flood the BLE connection.
+ */
+
+#include "PicoFCMNotifier.h"
+
+uint16_t fcmEncodeDeviceStatus(const FCMDeviceStatus &status, uint8_t mask, uint8_t *out)
+{
+    uint16_t len = 0;
+    out[len++] = mask & FCM_STATUS_FIELD_ALL;
+    if (mask & FCM_STATUS_FIELD_PROVISIONING) out[len++] = status.provisioningStatus;
+    if (mask & FCM_STATUS_FIELD_WIFI) out[len++] = status.wifiStatus;
+    if (mask & FCM_STATUS_FIELD_RSSI) out[len++] = (uint8_t)status.rssi;
+    if (mask & FCM_STATUS_FIELD_IP)
+    {
+        // IPAddress stores the first octet in the lowest byte
+        out[len++] = status.ip & 0xFF;
+        out[len++] = (status.ip >> 8) & 0xFF;
+        out[len++] = (status.ip >> 16) & 0xFF;
+        out[len++] = (status.ip >> 24) & 0xFF;
+    }
+    if (mask & FCM_STATUS_FIELD_QUEUE) out[len++] = status.queueDepth;
+    if (mask & FCM_STATUS_FIELD_SEND_RESULT) out[len++] = status.lastSendResult;
+    return len;
+}
+
+void PicoFCMNotifierClass::collectDeviceStatus(FCMDeviceStatus &status)
+{
+    bool connected = WiFi.status() == WL_CONNECTED;
+    status.provisioningStatus = (uint8_t)_status;
+    if (connected) status.wifiStatus = STATUS_CONNECTED;
+    else if (_wifiStatusCode == STATUS_CONNECTED) status.wifiStatus = STATUS_IDLE; // Link lost since
+    else status.wifiStatus = _wifiStatusCode;
+    int32_t rssi = connected ? WiFi.RSSI() : 0;
+    status.rssi = (int8_t)constrain(rssi, -128, 0);
+    status.ip = connected ? (uint32_t)WiFi.localIP() : 0;
+    status.queueDepth = getQueueDepth();
+    status.lastSendResult = (uint8_t)_lastSendResult;
+}
+
+void PicoFCMNotifierClass::updateDeviceStatusCharacteristic()
+{
+    if (_connectedDevice == nullptr || !BLENotify.isSubscribed(_deviceStatusCharHandle)) return;
+
+    unsigned long now = millis();
+    // Sampling costs a CYW43 ioctl for the RSSI, so it is limited even when nothing changed
+    if (!_statusSnapshotRequested && now - _lastDeviceStatusChecked < FCM_STATUS_MIN_INTERVAL_MS) return;
+    _lastDeviceStatusChecked = now;
+
+    FCMDeviceStatus status;
+    collectDeviceStatus(status);
+
+    uint8_t mask;
+    if (_statusSnapshotRequested || !_deviceStatusSynced)
+    {
+        mask = FCM_STATUS_FIELD_ALL;
+    }
+    else
+    {
+        mask = 0;
+        if (status.provisioningStatus != _sentDeviceStatus.provisioningStatus) mask |= FCM_STATUS_FIELD_PROVISIONING;
+        if (status.wifiStatus != _sentDeviceStatus.wifiStatus) mask |= FCM_STATUS_FIELD_WIFI;
+        // Small RSSI wobble is noise; only report real movement
+        if (abs(status.rssi - _sentDeviceStatus.rssi) >= FCM_STATUS_RSSI_DELTA ||
+            (status.rssi == 0) != (_sentDeviceStatus.rssi == 0))
+        {
+            mask |= FCM_STATUS_FIELD_RSSI;
+        }
+        if (status.ip != _sentDeviceStatus.ip) mask |= FCM_STATUS_FIELD_IP;
+        if (status.queueDepth != _sentDeviceStatus.queueDepth) mask |= FCM_STATUS_FIELD_QUEUE;
+        if (status.lastSendResult != _sentDeviceStatus.lastSendResult) mask |= FCM_STATUS_FIELD_SEND_RESULT;
+        if (mask == 0) return;
+    }
+
+    uint8_t record[FCM_STATUS_RECORD_MAX_LENGTH];
+    uint16_t len = fcmEncodeDeviceStatus(status, mask, record);
+    BLENotify.notify(_deviceStatusCharHandle, record, len);
+
+    // Remember only what was sent, so unsent RSSI drift keeps accumulating
+    if (mask & FCM_STATUS_FIELD_PROVISIONING) _sentDeviceStatus.provisioningStatus = status.provisioningStatus;
+    if (mask & FCM_STATUS_FIELD_WIFI) _sentDeviceStatus.wifiStatus = status.wifiStatus;
+    if (mask & FCM_STATUS_FIELD_RSSI) _sentDeviceStatus.rssi = status.rssi;
+    if (mask & FCM_STATUS_FIELD_IP) _sentDeviceStatus.ip = status.ip;
+    if (mask & FCM_STATUS_FIELD_QUEUE) _sentDeviceStatus.queueDepth = status.queueDepth;
+    if (mask & FCM_STATUS_FIELD_SEND_RESULT) _sentDeviceStatus.lastSendResult = status.lastSendResult;
+    _deviceStatusSynced = true;
+    _statusSnapshotRequested = false;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Simulated BLE provisioning throughput for pico-fcm-notifier.
+
+Models how long a phone needs to write the provisioning characteristics
+(SSID, password, FCM URL, FCM token and the connect command) for a given
+connection interval and ATT MTU, and prints the effective bytes/sec.
+
+The model follows the ATT rules the phone apps use:
+
+  * values up to MTU-3 bytes go out as a single Write Request
+  * longer values use Prepare Write Requests of MTU-5 bytes each,
+    followed by an Execute Write Request
+  * every request waits for its response, which normally arrives one
+    connection event later (--events-per-request)
+  * ATT PDUs larger than the link layer payload (27 bytes without data
+    length extension) are split into several LL packets; up to
+    --packets-per-event of them fit into one connection event
+
+It is a host-side estimate for comparing parameter sets, not a radio
+measurement. Example:
+
+  python tools/ble_throughput_model.py
+  python tools/ble_throughput_model.py --token-length 180 --ll-payload 251
+"""
+
+import argparse
+import math
+
+# Maximum characteristic lengths from PicoFCMNotifier.h
+MAX_SSID_LENGTH = 32
+MAX_PASSWORD_LENGTH = 64
+MAX_FCM_URL_LENGTH = 256
+MAX_FCM_TOKEN_LENGTH = 256
+
+# ATT header sizes
+WRITE_REQUEST_HEADER = 3    # opcode + handle
+PREPARE_WRITE_HEADER = 5    # opcode + handle + offset
+EXECUTE_WRITE_PDU = 2
+L2CAP_HEADER = 4
+
+# (label, min interval ms, max interval ms, MTU)
+SCENARIOS = [
+    ("default (no negotiation)", 30.0, 50.0, 23),
+    ("Android typical default", 45.0, 45.0, 23),
+    ("MTU only", 30.0, 50.0, 247),
+    ("fast interval only", 15.0, 30.0, 23),
+    ("fast interval + MTU (library)", 15.0, 30.0, 247),
+    ("relaxed idle parameters", 100.0, 200.0, 247),
+]
+
+
+def ll_packets(att_pdu_len, ll_payload):
+    """Link layer packets needed for one ATT PDU."""
+    return math.ceil((att_pdu_len + L2CAP_HEADER) / ll_payload)
+
+
+def events_for_pdu(att_pdu_len, ll_payload, packets_per_event, events_per_request):
+    """Connection events spent on one acknowledged ATT request."""
+    send_events = math.ceil(ll_packets(att_pdu_len, ll_payload) / packets_per_event)
+    # The response is small and rides on the following event(s)
+    return send_events - 1 + events_per_request
+
+
+def events_for_value(value_len, mtu, ll_payload, packets_per_event, events_per_request):
+    """Connection events needed to write one characteristic value."""
+    if value_len <= mtu - WRITE_REQUEST_HEADER:
+        return events_for_pdu(value_len + WRITE_REQUEST_HEADER, ll_payload, packets_per_event, events_per_request)
+
+    events = 0
+    chunk = mtu - PREPARE_WRITE_HEADER
+    remaining = value_len
+    while remaining > 0:
+        part = min(chunk, remaining)
+        events += events_for_pdu(part + PREPARE_WRITE_HEADER, ll_payload, packets_per_event, events_per_request)
+        remaining -= part
+    events += events_for_pdu(EXECUTE_WRITE_PDU, ll_payload, packets_per_event, events_per_request)
+    return events
+
+
+def simulate(values, interval_ms, mtu, ll_payload, packets_per_event, events_per_request):
+    events = sum(events_for_value(v, mtu, ll_payload, packets_per_event, events_per_request) for v in values)
+    seconds = events * interval_ms / 1000.0
+    payload = sum(values)
+    return events, seconds, payload / seconds if seconds > 0 else float("inf")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Estimate BLE provisioning throughput")
+    parser.add_argument("--ssid-length", type=int, default=16)
+    parser.add_argument("--password-length", type=int, default=24)
+    parser.add_argument("--url-length", type=int, default=64)
+    parser.add_argument("--token-length", type=int, default=MAX_FCM_TOKEN_LENGTH)
+    parser.add_argument("--ll-payload", type=int, default=27,
+                        help="link layer payload bytes (27, or up to 251 with data length extension)")
+    parser.add_argument("--packets-per-event", type=int, default=4,
+                        help="LL packets the phone sends per connection event")
+    parser.add_argument("--events-per-request", type=int, default=2,
+                        help="connection events from request to response")
+    args = parser.parse_args()
+
+    for name, length, limit in (("SSID", args.ssid_length, MAX_SSID_LENGTH),
+                                ("password", args.password_length, MAX_PASSWORD_LENGTH),
+                                ("URL", args.url_length, MAX_FCM_URL_LENGTH),
+                                ("token", args.token_length, MAX_FCM_TOKEN_LENGTH)):
+        if not 0 < length <= limit:
+            parser.error(f"{name} length must be between 1 and {limit}")
+
+    # SSID, password, save command, URL, token, connect command
+    values = [args.ssid_length, args.password_length, 1, args.url_length, args.token_length, 1]
+
+    print(f"Payload: {sum(values)} bytes in {len(values)} writes, "
+          f"LL payload {args.ll_payload}, {args.packets_per_event} packets/event\n")
+    print(f"{'scenario':32} {'interval ms':>14} {'MTU':>5} {'events':>7} {'time s':>14} {'bytes/s':>16}")
+    for label, min_ms, max_ms, mtu in SCENARIOS:
+        best = simulate(values, min_ms, mtu, args.ll_payload, args.packets_per_event, args.events_per_request)
+        worst = simulate(values, max_ms, mtu, args.ll_payload, args.packets_per_event, args.events_per_request)
+        interval = f"{min_ms:g}" if min_ms == max_ms else f"{min_ms:g}-{max_ms:g}"
+        print(f"{label:32} {interval:>14} {mtu:5} {best[0]:7} "
+              f"{best[1]:6.2f}-{worst[1]:<6.2f} {worst[2]:7.0f}-{best[2]:<7.0f}")
+
+
+if __name__ == "__main__":
+    main()
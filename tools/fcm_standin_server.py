@@ -0,0 +1,436 @@
+#!/usr/bin/env python3
+"""Local stand-in for the FCM endpoints used by pico-fcm-notifier.
+
+Serves, over HTTPS, the three endpoints the library talks to so the device
+can be exercised without a Firebase project:
+
+  POST /token                                 OAuth JWT-bearer token exchange
+  POST /v1/projects/<project>/messages:send   FCM HTTP v1 send (Bearer auth)
+  POST /notify                                Cloud Function style send (JSON or
+                                              compact MessagePack with token IDs)
+
+Point the device at it with:
+
+  PicoFCMNotifier.setDirectEndpoints("https://<host>:8443/token",
+                                     "https://<host>:8443");
+
+and provision "https://<host>:8443/notify" as the FCM URL for the Cloud
+Function path. For load and soak runs (the Benchmarks example's soak item) the send
+endpoints can inject faults, each with its own probability per request:
+
+  --latency-ms 50 --latency-jitter-ms 30   delay every send response
+  --error-5xx-rate 0.02                    answer 503
+  --error-429-rate 0.01 --retry-after-s 1  answer 429 with Retry-After
+  --reset-rate 0.01                        reset the connection instead of answering
+  --slow-read-rate 0.05 --slow-read-ms 20  read the request body in small, delayed pieces
+
+Downstream commands given with --command (repeatable), or typed on stdin
+while the server runs, are returned in the "cmd" array of the next
+answered Cloud Function request, heartbeats included:
+
+  --command "rate 5000" --command flush
+
+Counts of handled requests and injected faults are printed every
+--report-s seconds and on exit. Generate a throwaway certificate with:
+
+  openssl req -x509 -newkey rsa:2048 -nodes -days 365 \\
+      -keyout key.pem -out cert.pem -subj "/CN=fcm-standin"
+"""
+
+import argparse
+import base64
+import binascii
+import json
+import random
+import secrets
+import socket
+import ssl
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs
+
+ACCESS_TOKEN_TTL_S = 3600
+
+# Compact request keys (keep in sync with src/FCMMsgPack.h)
+KEY_TOKEN, KEY_TOKEN_ID, KEY_TITLE, KEY_BODY, KEY_SEQ, KEY_TS, KEY_HEARTBEAT = range(7)
+
+
+def msgpack_decode(data):
+    """Decode the MessagePack subset the device sends (maps, uints, strings)."""
+    def read(pos, n):
+        if pos + n > len(data):
+            raise ValueError("truncated")
+        return data[pos:pos + n], pos + n
+
+    def value(pos):
+        (b,), pos = read(pos, 1)
+        if b < 0x80:
+            return b, pos
+        if 0x80 <= b <= 0x8F or b in (0xDE, 0xDF):
+            if b <= 0x8F:
+                count = b & 0x0F
+            else:
+                raw, pos = read(pos, 2 if b == 0xDE else 4)
+                count = int.from_bytes(raw, "big")
+            result = {}
+            for _ in range(count):
+                key, pos = value(pos)
+                result[key], pos = value(pos)
+            return result, pos
+        if 0xA0 <= b <= 0xBF or b in (0xD9, 0xDA, 0xDB):
+            if b <= 0xBF:
+                length = b & 0x1F
+            else:
+                raw, pos = read(pos, {0xD9: 1, 0xDA: 2, 0xDB: 4}[b])
+                length = int.from_bytes(raw, "big")
+            raw, pos = read(pos, length)
+            return raw.decode(), pos
+        if b in (0xCC, 0xCD, 0xCE, 0xCF):
+            raw, pos = read(pos, 1 << (b - 0xCC))
+            return int.from_bytes(raw, "big"), pos
+        raise ValueError("unsupported type 0x%02x" % b)
+
+    result, end = value(0)
+    if end != len(data):
+        raise ValueError("trailing bytes")
+    return result
+
+
+class Faults:
+    """Fault injection settings for the send endpoints."""
+
+    def __init__(self, args):
+        self.latency_ms = args.latency_ms
+        self.latency_jitter_ms = args.latency_jitter_ms
+        self.error_5xx_rate = args.error_5xx_rate
+        self.error_429_rate = args.error_429_rate
+        self.retry_after_s = args.retry_after_s
+        self.reset_rate = args.reset_rate
+        self.slow_read_rate = args.slow_read_rate
+        self.slow_read_ms = args.slow_read_ms
+        self.random = random.Random(args.seed)
+        self.lock = threading.Lock()
+
+    def roll(self, rate):
+        if rate <= 0:
+            return False
+        with self.lock:
+            return self.random.random() < rate
+
+    def delay_s(self):
+        with self.lock:
+            jitter = self.random.uniform(-self.latency_jitter_ms, self.latency_jitter_ms)
+        return max(0.0, self.latency_ms + jitter) / 1000.0
+
+
+class StandInState:
+    def __init__(self, cf_delay_ms, faults, commands):
+        self.lock = threading.Lock()
+        self.tokens = {}
+        self.cf_delay_ms = cf_delay_ms
+        self.faults = faults
+        self.counts = {"token": 0, "direct": 0, "cloud_function": 0, "heartbeat": 0, "commands": 0,
+                       "injected_5xx": 0, "injected_429": 0, "injected_reset": 0, "slow_reads": 0}
+        self.device_tokens = {}
+        self.device_token_ids = {}
+        self.commands = list(commands)
+
+    def add_command(self, command):
+        with self.lock:
+            self.commands.append(command)
+
+    def take_commands(self):
+        with self.lock:
+            commands, self.commands = self.commands, []
+            self.counts["commands"] += len(commands)
+        return commands
+
+    def register_device_token(self, token):
+        with self.lock:
+            if token not in self.device_token_ids:
+                token_id = len(self.device_tokens) + 1
+                self.device_tokens[token_id] = token
+                self.device_token_ids[token] = token_id
+            return self.device_token_ids[token]
+
+    def device_token(self, token_id):
+        with self.lock:
+            return self.device_tokens.get(token_id)
+
+    def issue_token(self):
+        token = "ya29.standin-" + secrets.token_urlsafe(32)
+        with self.lock:
+            self.tokens[token] = time.time() + ACCESS_TOKEN_TTL_S
+            self.counts["token"] += 1
+        return token
+
+    def token_valid(self, token):
+        with self.lock:
+            expiry = self.tokens.get(token)
+        return expiry is not None and expiry > time.time()
+
+    def count(self, key):
+        with self.lock:
+            self.counts[key] += 1
+            return self.counts[key]
+
+    def report(self):
+        with self.lock:
+            counts = dict(self.counts)
+        print("requests: token %(token)d, direct %(direct)d, cloud function %(cloud_function)d, "
+              "heartbeat %(heartbeat)d; commands sent %(commands)d; injected: 5xx %(injected_5xx)d, 429 %(injected_429)d, resets %(injected_reset)d, "
+              "slow reads %(slow_reads)d" % counts, flush=True)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    state = None
+
+    def log_message(self, fmt, *args):
+        print("%s %s" % (self.address_string(), fmt % args))
+
+    def _read_exactly(self, length, slow):
+        if not slow:
+            return self.rfile.read(length)
+        # A congested server: take the body in small pieces so the device's writes back up
+        data = bytearray()
+        while len(data) < length:
+            piece = self.rfile.read(min(256, length - len(data)))
+            if not piece:
+                break
+            data += piece
+            time.sleep(self.state.faults.slow_read_ms / 1000.0)
+        return bytes(data)
+
+    def _read_body(self, slow=False):
+        # Attachment sends stream their body with chunked transfer encoding
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            chunks = []
+            while True:
+                size = int(self.rfile.readline().split(b";")[0].strip(), 16)
+                if size == 0:
+                    self.rfile.readline()
+                    return b"".join(chunks)
+                chunks.append(self._read_exactly(size, slow))
+                self.rfile.readline()
+        length = int(self.headers.get("Content-Length", "0"))
+        return self._read_exactly(length, slow) if length else b""
+
+    def _reply(self, code, payload, headers=None):
+        body = json.dumps(payload).encode() if payload is not None else b""
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        if body:
+            self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def _reply_sent(self, payload):
+        """Answer a Cloud Function request, adding any pending commands."""
+        commands = self.state.take_commands()
+        if commands:
+            print("sending commands: %s" % ", ".join(commands))
+            payload = dict(payload or {}, cmd=commands)
+        self._reply(200, payload)
+
+    def _reset_connection(self):
+        # SO_LINGER with a zero timeout makes close() send a TCP reset
+        self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+        self.close_connection = True
+        self.connection.close()
+
+    def _inject_fault(self):
+        """Apply the configured faults to a send request. Returns True if it was answered."""
+        faults = self.state.faults
+        delay = faults.delay_s()
+        if delay:
+            time.sleep(delay)
+        if faults.roll(faults.reset_rate):
+            self.state.count("injected_reset")
+            self._reset_connection()
+            return True
+        if faults.roll(faults.error_429_rate):
+            self.state.count("injected_429")
+            self._reply(429, {"error": "injected rate limit"}, {"Retry-After": str(faults.retry_after_s)})
+            return True
+        if faults.roll(faults.error_5xx_rate):
+            self.state.count("injected_5xx")
+            self._reply(503, {"error": "injected server error"})
+            return True
+        return False
+
+    def do_POST(self):
+        is_send = self.path == "/notify" or self.path.startswith("/v1/projects/")
+        slow = is_send and self.state.faults.roll(self.state.faults.slow_read_rate)
+        if slow:
+            self.state.count("slow_reads")
+        body = self._read_body(slow)
+        if is_send and self._inject_fault():
+            return
+        if self.path == "/token":
+            self._handle_token(body)
+        elif self.path.startswith("/v1/projects/") and self.path.endswith("/messages:send"):
+            self._handle_direct(body)
+        elif self.path == "/notify":
+            self._handle_cloud_function(body)
+        else:
+            self._reply(404, {"error": "not found"})
+
+    def _handle_token(self, body):
+        form = parse_qs(body.decode())
+        grant = form.get("grant_type", [""])[0]
+        assertion = form.get("assertion", [""])[0]
+        if grant != "urn:ietf:params:oauth:grant-type:jwt-bearer" or assertion.count(".") != 2:
+            self._reply(400, {"error": "invalid_grant"})
+            return
+        # The signature is not verified; only the JWT shape is checked
+        self._reply(200, {
+            "access_token": self.state.issue_token(),
+            "expires_in": ACCESS_TOKEN_TTL_S,
+            "token_type": "Bearer",
+        })
+
+    def _log_receive_latency(self, seq, ts):
+        # Device timestamps are wall-clock ms from SNTP; skew shows up here too
+        if ts is None:
+            return
+        try:
+            latency = int(time.time() * 1000) - int(ts)
+        except (ValueError, TypeError):
+            return
+        print("seq %s received %d ms after enqueue" % (seq, latency))
+
+    def _handle_direct(self, body):
+        auth = self.headers.get("Authorization", "")
+        if not auth.startswith("Bearer ") or not self.state.token_valid(auth[7:]):
+            self._reply(401, {"error": {"code": 401, "status": "UNAUTHENTICATED"}})
+            return
+        try:
+            message = json.loads(body)["message"]
+            message["token"], message["notification"]
+        except (ValueError, KeyError, TypeError):
+            self._reply(400, {"error": {"code": 400, "status": "INVALID_ARGUMENT"}})
+            return
+        data = message.get("data") or {}
+        self._log_receive_latency(data.get("seq"), data.get("ts"))
+        n = self.state.count("direct")
+        self._reply(200, {"name": "projects/standin/messages/%d" % n})
+
+    def _handle_cloud_function(self, body):
+        # Emulate the extra hop (and cold starts) of a Cloud Function
+        if self.state.cf_delay_ms:
+            time.sleep(self.state.cf_delay_ms / 1000.0)
+        if body[:1] and (body[0] & 0xF0 == 0x80 or body[0] in (0xDE, 0xDF)):
+            self._handle_compact(body)
+            return
+        try:
+            payload = json.loads(body)
+            payload["token"]
+            if not payload.get("heartbeat"):
+                payload["title"], payload["body"]
+        except (ValueError, KeyError, TypeError):
+            self._reply(400, {"error": "bad request"})
+            return
+        if payload.get("heartbeat"):
+            self.state.count("heartbeat")
+            print("heartbeat: %d bytes of request body" % len(body))
+            self._reply_sent({"success": True})
+            return
+        if "attachment" in payload:
+            try:
+                attachment = base64.b64decode(payload["attachment"], validate=True)
+            except (binascii.Error, TypeError):
+                self._reply(400, {"error": "bad attachment"})
+                return
+            print("attachment %s: %d bytes (%d bytes of request body)"
+                  % (payload.get("attachment_name"), len(attachment), len(body)))
+        self._log_receive_latency(payload.get("seq"), payload.get("ts"))
+        n = self.state.count("cloud_function")
+        self._reply_sent({"success": True, "messageId": "projects/standin/messages/%d" % n})
+
+    def _handle_compact(self, body):
+        try:
+            payload = msgpack_decode(body)
+            if not isinstance(payload, dict):
+                raise ValueError("not a map")
+        except (ValueError, KeyError, UnicodeDecodeError) as error:
+            self._reply(400, {"error": "bad MessagePack body: %s" % error})
+            return
+        if KEY_TOKEN in payload:
+            token_id = self.state.register_device_token(payload[KEY_TOKEN])
+            print("token registered as ID %d (%d bytes of request body)" % (token_id, len(body)))
+            self._reply(200, {"tokenId": token_id})
+            return
+        if self.state.device_token(payload.get(KEY_TOKEN_ID)) is None:
+            self._reply(412, {"error": "unknown tokenId"})
+            return
+        if payload.get(KEY_HEARTBEAT):
+            self.state.count("heartbeat")
+            print("compact heartbeat: %d bytes of request body" % len(body))
+            self._reply_sent(None)
+            return
+        if KEY_TITLE not in payload or KEY_BODY not in payload:
+            self._reply(400, {"error": "bad request"})
+            return
+        print("compact notification: %d bytes of request body, Content-Type %s"
+              % (len(body), self.headers.get("Content-Type", "absent")))
+        self._log_receive_latency(payload.get(KEY_SEQ), payload.get(KEY_TS))
+        self.state.count("cloud_function")
+        self._reply_sent(None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", required=True, help="PEM certificate")
+    parser.add_argument("--key", required=True, help="PEM private key")
+    parser.add_argument("--cf-delay-ms", type=int, default=0,
+                        help="extra latency added to the Cloud Function endpoint")
+    faults = parser.add_argument_group("fault injection (send endpoints only)")
+    faults.add_argument("--latency-ms", type=float, default=0, help="delay before answering a send")
+    faults.add_argument("--latency-jitter-ms", type=float, default=0, help="+/- random spread of that delay")
+    faults.add_argument("--error-5xx-rate", type=float, default=0, help="probability of answering 503")
+    faults.add_argument("--error-429-rate", type=float, default=0, help="probability of answering 429")
+    faults.add_argument("--retry-after-s", type=int, default=1, help="Retry-After sent with injected 429s")
+    faults.add_argument("--reset-rate", type=float, default=0, help="probability of resetting the connection")
+    faults.add_argument("--slow-read-rate", type=float, default=0, help="probability of reading the body slowly")
+    faults.add_argument("--slow-read-ms", type=float, default=20, help="pause after each 256 bytes of a slow read")
+    faults.add_argument("--seed", type=int, default=None, help="random seed for reproducible fault sequences")
+    parser.add_argument("--command", action="append", default=[],
+                        help="downstream command for the next answered request (repeatable)")
+    parser.add_argument("--report-s", type=float, default=10, help="seconds between request count reports (0 = off)")
+    args = parser.parse_args()
+
+    Handler.state = StandInState(args.cf_delay_ms, Faults(args), args.command)
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(args.cert, args.key)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("FCM stand-in listening on https://%s:%d" % (args.host, args.port))
+
+    if args.report_s > 0:
+        def report():
+            while True:
+                time.sleep(args.report_s)
+                Handler.state.report()
+        threading.Thread(target=report, daemon=True).start()
+    def read_commands():
+        for line in sys.stdin:
+            if line.strip():
+                Handler.state.add_command(line.strip())
+    threading.Thread(target=read_commands, daemon=True).start()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    Handler.state.report()
+
+
+if __name__ == "__main__":
+    main()
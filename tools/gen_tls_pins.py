@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Generate flash-resident TLS pins for pico-fcm-notifier.
+
+Connects to an HTTPS endpoint, and writes a header with:
+
+  FCM_PINNED_KEY_DER    leaf certificate public key (DER SubjectPublicKeyInfo)
+                        for PicoFCMNotifier.setPinnedPublicKey()
+  FCM_TRUST_ANCHOR_DER  top certificate of the served chain (DER)
+                        for PicoFCMNotifier.setTrustAnchor()
+
+Both arrays are `constexpr`, so they stay in flash and the library parses
+them once at startup rather than on every handshake.
+
+Standalone:
+
+  python tools/gen_tls_pins.py my-function.cloudfunctions.net -o include/fcm_tls_pins.h
+
+As a PlatformIO pre-build script (regenerates only when the header is missing,
+or on every build with `custom_fcm_tls_refresh = yes`):
+
+  [env:rpipicow]
+  extra_scripts = pre:<path to>/tools/gen_tls_pins.py
+  custom_fcm_tls_host = my-function.cloudfunctions.net
+
+Requires the `openssl` command line tool.
+"""
+
+import argparse
+import base64
+import datetime
+import hashlib
+import os
+import re
+import subprocess
+import sys
+
+PEM_RE = re.compile(rb"-----BEGIN CERTIFICATE-----.+?-----END CERTIFICATE-----\n?", re.S)
+
+
+def openssl(args, stdin):
+    return subprocess.run(["openssl"] + args, input=stdin, stdout=subprocess.PIPE,
+                          stderr=subprocess.DEVNULL, check=True).stdout
+
+
+def fetch_chain(host, port):
+    out = openssl(["s_client", "-connect", "%s:%d" % (host, port), "-servername", host, "-showcerts"], b"")
+    chain = PEM_RE.findall(out)
+    if not chain:
+        raise RuntimeError("no certificates received from %s:%d" % (host, port))
+    return chain
+
+
+def spki_der(cert_pem):
+    pubkey_pem = openssl(["x509", "-pubkey", "-noout"], cert_pem)
+    return openssl(["pkey", "-pubin", "-outform", "DER"], pubkey_pem)
+
+
+def cert_der(cert_pem):
+    return openssl(["x509", "-outform", "DER"], cert_pem)
+
+
+def subject(cert_pem):
+    return openssl(["x509", "-noout", "-subject"], cert_pem).decode().strip()
+
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "constexpr uint8_t %s[] = {\n%s\n};\nconstexpr size_t %s_LEN = sizeof(%s);\n" % (
+        name, "\n".join(lines), name, name)
+
+
+def render(host, port):
+    chain = fetch_chain(host, port)
+    key = spki_der(chain[0])
+    anchor = cert_der(chain[-1])
+    spki_sha256 = base64.b64encode(hashlib.sha256(key).digest()).decode()
+    return "\n".join([
+        "// Generated by tools/gen_tls_pins.py for %s:%d on %s. Do not edit."
+        % (host, port, datetime.date.today().isoformat()),
+        "// Pinned key: %s" % subject(chain[0]),
+        "//   SPKI SHA-256: %s" % spki_sha256,
+        "// Trust anchor: %s" % subject(chain[-1]),
+        "",
+        "#ifndef FCM_TLS_PINS_H",
+        "#define FCM_TLS_PINS_H",
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        c_array("FCM_PINNED_KEY_DER", key),
+        c_array("FCM_TRUST_ANCHOR_DER", anchor),
+        "#endif // FCM_TLS_PINS_H",
+        "",
+    ])
+
+
+def split_host(value):
+    host, _, port = value.partition(":")
+    return host, int(port) if port else 443
+
+
+def run_platformio(env):
+    host = env.GetProjectOption("custom_fcm_tls_host", "")
+    if not host:
+        print("gen_tls_pins: custom_fcm_tls_host not set, skipping")
+        return
+    refresh = env.GetProjectOption("custom_fcm_tls_refresh", "no").lower() in ("1", "yes", "true")
+    output = os.path.join(env.subst("$PROJECT_INCLUDE_DIR"), "fcm_tls_pins.h")
+    if os.path.exists(output) and not refresh:
+        return
+    with open(output, "w") as f:
+        f.write(render(*split_host(host)))
+    print("gen_tls_pins: wrote %s" % output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", help="endpoint host, optionally host:port")
+    parser.add_argument("-o", "--output", help="header to write (default: stdout)")
+    args = parser.parse_args()
+
+    header = render(*split_host(args.host))
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(header)
+    else:
+        sys.stdout.write(header)
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO's SCons environment
+    run_platformio(env)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        main()
@@ -0,0 +1,93 @@
+/**
+ * metrics_check.cpp - Host check of the Prometheus histogram export.
+ *
+ * Records latency samples the way the library does, renders them with
+ * FCMMetricsWriter and checks that every le bucket counts exactly the
+ * samples at or below its bound. Build and run on the host from the
+ * repository root:
+ *
+ *   g++ -O2 -Isrc tools/metrics_check.cpp src/FCMMetrics.cpp -o metrics_check
+ *   ./metrics_check
+ *
+ * Exits with status 1 and prints the rendered histogram on a mismatch.
+ */
+
+#include "FCMMetrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int BUCKETS = 16; // FCM_LATENCY_BUCKETS
+
+typedef struct
+{
+    char text[4096];
+    size_t length;
+} Output;
+
+static void collect(void *context, const char *data, size_t length)
+{
+    Output *out = (Output *)context;
+    if (out->length + length >= sizeof(out->text)) return;
+    memcpy(out->text + out->length, data, length);
+    out->length += length;
+    out->text[out->length] = '\0';
+}
+
+// Check one sample set; returns the number of wrong lines
+static int check(const char *label, const uint32_t *samples, size_t sampleCount)
+{
+    uint32_t buckets[BUCKETS] = {};
+    uint64_t sumMs = 0;
+    for (size_t i = 0; i < sampleCount; i++)
+    {
+        buckets[fcmLatencyBucket(samples[i], BUCKETS)]++;
+        sumMs += samples[i];
+    }
+
+    Output out = {};
+    FCMMetricsWriter writer(collect, &out);
+    writer.histogramMs("t", "Test histogram.", buckets, BUCKETS, (uint32_t)sampleCount, sumMs);
+    writer.flush();
+
+    int errors = 0;
+    for (const char *line = strstr(out.text, "t_bucket{le=\""); line; line = strstr(line + 1, "t_bucket{le=\""))
+    {
+        const char *bound = line + strlen("t_bucket{le=\"");
+        unsigned long count = strtoul(strstr(bound, "} ") + 2, nullptr, 10);
+        unsigned long expected = 0;
+        for (size_t i = 0; i < sampleCount; i++)
+        {
+            // Bounds are seconds with three decimals, i.e. whole milliseconds
+            if (strncmp(bound, "+Inf", 4) == 0 || samples[i] <= strtod(bound, nullptr) * 1000 + 0.5) expected++;
+        }
+        if (count != expected)
+        {
+            printf("%s: le=\"%.*s\" counts %lu, expected %lu\n", label, (int)(strchr(bound, '"') - bound), bound, count,
+                   expected);
+            errors++;
+        }
+    }
+    if (errors) printf("%s", out.text);
+    return errors;
+}
+
+int main()
+{
+    static const uint32_t exact[] = {1, 1, 2, 4};
+    static const uint32_t edges[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 1023, 1024, 1025, 16384, 16385, 100000};
+
+    uint32_t random[2000];
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(random) / sizeof(random[0]); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        random[i] = (seed >> 8) % (1u << (seed % 18));
+    }
+
+    int errors = check("exact powers", exact, sizeof(exact) / sizeof(exact[0]));
+    errors += check("bucket edges", edges, sizeof(edges) / sizeof(edges[0]));
+    errors += check("random", random, sizeof(random) / sizeof(random[0]));
+    printf(errors ? "%d wrong bucket counts\n" : "all bucket counts match\n", errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Provision pico-fcm-notifier boards over USB serial, many at a time.
+
+Sends the whole configuration (WiFi networks, FCM URL and token) to each
+board in one binary frame and waits for its acknowledgement. Every port is
+handled in its own thread. The sketch must call
+PicoFCMNotifier.beginSerialProvisioning().
+
+The configuration is a JSON file:
+
+  {
+    "networks": [{"ssid": "factory", "password": "secret"}],
+    "fcm_url": "https://us-central1-my-project.cloudfunctions.net/sendNotification",
+    "fcm_token": "<device token>"
+  }
+
+Provision every attached Pico (USB vendor ID 2E8A), replacing what they
+have stored:
+
+  python tools/serial_provision.py config.json --replace
+
+or only the given ports:
+
+  python tools/serial_provision.py config.json /dev/ttyACM0 /dev/ttyACM1
+
+Requires pyserial (pip install pyserial).
+"""
+
+import argparse
+import json
+import struct
+import sys
+import threading
+import time
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+
+import serial
+from serial.tools import list_ports
+
+# Keep in sync with src/FCMProvision.h
+VERSION = 1
+REQUEST_MAGIC = b"PFCP"
+ACK_MAGIC = b"PFCA"
+ACK_SIZE = 10
+MAX_PAYLOAD = 1024
+FLAG_REPLACE = 0x01
+FLAG_CONNECT = 0x02
+STATUS = {
+    0: "ok",
+    1: "bad CRC",
+    2: "malformed frame",
+    3: "unsupported version",
+    4: "invalid field",
+    5: "too many networks",
+    6: "storage failed",
+}
+RASPBERRY_PI_VID = 0x2E8A
+
+print_lock = threading.Lock()
+
+
+def log(port, message):
+    with print_lock:
+        print("%s: %s" % (port, message), flush=True)
+
+
+def encode_request(config, flags):
+    networks = config.get("networks", [])
+    payload = bytearray([len(networks)])
+    for network in networks:
+        ssid = network["ssid"].encode()
+        password = network.get("password", "").encode()
+        payload += bytes([len(ssid)]) + ssid + bytes([len(password)]) + password
+    for key in ("fcm_url", "fcm_token"):
+        value = config.get(key, "").encode()
+        payload += struct.pack("<H", len(value)) + value
+    if len(payload) > MAX_PAYLOAD:
+        raise ValueError("configuration is %d bytes, the limit is %d" % (len(payload), MAX_PAYLOAD))
+
+    frame = REQUEST_MAGIC + struct.pack("<BBH", VERSION, flags, len(payload)) + payload
+    return frame + struct.pack("<I", zlib.crc32(frame))
+
+
+def wait_for_ack(link, request_crc, timeout):
+    """Scan the console output for the acknowledgement of our request."""
+    deadline = time.monotonic() + timeout
+    received = bytearray()
+    while time.monotonic() < deadline:
+        received += link.read(link.in_waiting or 1)
+        start = received.find(ACK_MAGIC)
+        while start >= 0 and len(received) >= start + ACK_SIZE:
+            status, count, crc = struct.unpack("<BBI", received[start + 4:start + ACK_SIZE])
+            if crc == request_crc:
+                return status, count
+            start = received.find(ACK_MAGIC, start + 1)
+    return None
+
+
+def provision(port, frame, timeout, retries):
+    request_crc = struct.unpack("<I", frame[-4:])[0]
+    try:
+        # Opening the port raises DTR, which the sketch may be waiting for
+        with serial.Serial(port, 115200, timeout=0.1) as link:
+            link.reset_input_buffer()
+            for attempt in range(1, retries + 1):
+                started = time.monotonic()
+                link.write(frame)
+                link.flush()
+                ack = wait_for_ack(link, request_crc, timeout)
+                if ack is None:
+                    log(port, "no acknowledgement (attempt %d/%d)" % (attempt, retries))
+                    continue
+                status, count = ack
+                if status == 1 and attempt < retries:
+                    log(port, "bad CRC, resending")
+                    continue
+                log(port, "%s, %d network(s) stored, %.0f ms"
+                    % (STATUS.get(status, "status %d" % status), count, (time.monotonic() - started) * 1000))
+                return status == 0
+    except serial.SerialException as error:
+        log(port, "error: %s" % error)
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("config", help="JSON configuration file")
+    parser.add_argument("ports", nargs="*", help="serial ports (default: every attached Pico)")
+    parser.add_argument("--replace", action="store_true", help="clear stored networks and FCM config first")
+    parser.add_argument("--connect", action="store_true", help="connect to WiFi after saving")
+    parser.add_argument("--timeout", type=float, default=3.0, help="seconds to wait for each acknowledgement")
+    parser.add_argument("--retries", type=int, default=3)
+    args = parser.parse_args()
+
+    with open(args.config) as f:
+        config = json.load(f)
+    flags = (FLAG_REPLACE if args.replace else 0) | (FLAG_CONNECT if args.connect else 0)
+    frame = encode_request(config, flags)
+
+    ports = args.ports or [p.device for p in list_ports.comports() if p.vid == RASPBERRY_PI_VID]
+    if not ports:
+        sys.exit("no boards found")
+
+    started = time.monotonic()
+    with ThreadPoolExecutor(max_workers=len(ports)) as pool:
+        results = list(pool.map(lambda port: provision(port, frame, args.timeout, args.retries), ports))
+    ok = sum(results)
+    print("%d of %d boards provisioned in %.1f s" % (ok, len(ports), time.monotonic() - started))
+    sys.exit(0 if ok == len(ports) else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,291 @@
+/**
+ * wire_format_benchmark.cpp - Host benchmark of the Cloud Function wire formats.
+ *
+ * Encodes the same notifications as the JSON request (full FCM token) and
+ * as the compact MessagePack request (token ID), decodes them again the way
+ * a receiver would, and reports request bytes (headers and body) and the
+ * time per encode and decode. Build and run on the host from the repository
+ * root:
+ *
+ *   g++ -O2 -Isrc tools/wire_format_benchmark.cpp src/FCMJson.cpp src/FCMMsgPack.cpp -o wire_format_benchmark
+ *   ./wire_format_benchmark [notifications] [url]
+ *
+ * Byte counts are exact for the device; times are for comparing the
+ * encoders and are typically 20-50x longer on an RP2040.
+ */
+
+#include "FCMJson.h"
+#include "FCMMsgPack.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t BUFFER_SIZE = 1024; // FCM_PAYLOAD_BUFFER_SIZE
+
+typedef struct
+{
+    char title[65];
+    char body[193];
+    uint32_t seq;
+    uint64_t ts;
+} Notification;
+
+// Fields recovered by the decoders
+typedef struct
+{
+    char token[257];
+    uint32_t tokenId;
+    char title[65];
+    char body[193];
+    uint64_t seq;
+    uint64_t ts;
+} Decoded;
+
+// Deterministic generator so runs are comparable
+static uint32_t nextRandom(uint32_t &seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+static void buildNotifications(Notification *notifications, size_t count)
+{
+    static const char *titles[] = {"Door", "Temperature", "Water leak", "Motion detected", "Battery low"};
+    static const char *bodies[] = {"Front door opened", "Freezer at -12.5 C, above the -15.0 C limit",
+                                   "Sensor 3 in the basement reports water", "Garage camera, zone 2",
+                                   "Remote sensor battery at 9%, replace soon"};
+    uint32_t seed = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        Notification &n = notifications[i];
+        snprintf(n.title, sizeof(n.title), "%s", titles[nextRandom(seed) % 5]);
+        snprintf(n.body, sizeof(n.body), "%s", bodies[nextRandom(seed) % 5]);
+        n.seq = (uint32_t)(i + 1);
+        n.ts = 1760000000000ULL + i * 1000;
+    }
+}
+
+// Same layout as writePayloadStart()/writePayloadEnd() in Cloud Function mode
+static size_t encodeJson(const char *token, const Notification &n, char *buffer)
+{
+    FCMJsonWriter payload(buffer, BUFFER_SIZE);
+    payload.raw("{\"token\":").string(token);
+    payload.raw(",\"title\":\"").escaped(n.title, strlen(n.title));
+    payload.raw("\",\"body\":\"").escaped(n.body, strlen(n.body));
+    payload.raw("\",\"seq\":").number(n.seq);
+    payload.raw(",\"ts\":").number(n.ts);
+    payload.raw("}");
+    return payload.ok() ? payload.length() : 0;
+}
+
+// Same layout as attemptCompactSend()
+static size_t encodeMsgPack(uint32_t tokenId, const Notification &n, uint8_t *buffer)
+{
+    FCMMsgPackWriter payload(buffer, BUFFER_SIZE);
+    payload.map(5);
+    payload.uint(FCM_WIRE_KEY_TOKEN_ID).uint(tokenId);
+    payload.uint(FCM_WIRE_KEY_TITLE).str(n.title);
+    payload.uint(FCM_WIRE_KEY_BODY).str(n.body);
+    payload.uint(FCM_WIRE_KEY_SEQ).uint(n.seq);
+    payload.uint(FCM_WIRE_KEY_TS).uint(n.ts);
+    return payload.ok() ? payload.length() : 0;
+}
+
+// Minimal decoder for the flat JSON object above
+static bool decodeJsonString(const char *&p, char *out, size_t size)
+{
+    if (*p++ != '"') return false;
+    size_t n = 0;
+    while (*p && *p != '"')
+    {
+        char c = *p++;
+        if (c == '\\')
+        {
+            c = *p++;
+            if (c == 'n') c = '\n';
+            else if (c == 'r') c = '\r';
+            else if (c == 't') c = '\t';
+            else if (c == 'u')
+            {
+                char hex[5] = {0};
+                strncpy(hex, p, 4);
+                c = (char)strtoul(hex, nullptr, 16);
+                p += strlen(hex);
+            }
+        }
+        if (n + 1 < size) out[n++] = c;
+    }
+    out[n] = '\0';
+    return *p++ == '"';
+}
+
+static bool decodeJson(const char *json, Decoded &out)
+{
+    const char *p = json;
+    if (*p++ != '{') return false;
+    while (*p && *p != '}')
+    {
+        char key[16];
+        if (!decodeJsonString(p, key, sizeof(key)) || *p++ != ':') return false;
+        if (strcmp(key, "token") == 0) { if (!decodeJsonString(p, out.token, sizeof(out.token))) return false; }
+        else if (strcmp(key, "title") == 0) { if (!decodeJsonString(p, out.title, sizeof(out.title))) return false; }
+        else if (strcmp(key, "body") == 0) { if (!decodeJsonString(p, out.body, sizeof(out.body))) return false; }
+        else
+        {
+            char *end;
+            uint64_t value = strtoull(p, &end, 10);
+            if (end == p) return false;
+            p = end;
+            if (strcmp(key, "seq") == 0) out.seq = value;
+            else if (strcmp(key, "ts") == 0) out.ts = value;
+        }
+        if (*p == ',') p++;
+    }
+    return *p == '}';
+}
+
+// Minimal decoder for the MessagePack map above
+static bool readUint(const uint8_t *&p, const uint8_t *end, uint64_t &value)
+{
+    if (p >= end) return false;
+    uint8_t type = *p++;
+    if (type < 0x80)
+    {
+        value = type;
+        return true;
+    }
+    if (type < 0xCC || type > 0xCF) return false;
+    int bytes = 1 << (type - 0xCC);
+    if (end - p < bytes) return false;
+    value = 0;
+    while (bytes--) value = (value << 8) | *p++;
+    return true;
+}
+
+static bool readStr(const uint8_t *&p, const uint8_t *end, char *out, size_t size)
+{
+    if (p >= end) return false;
+    uint8_t type = *p++;
+    size_t length;
+    if ((type & 0xE0) == 0xA0) length = type & 0x1F;
+    else if (type == 0xD9 && p < end) length = *p++;
+    else if (type == 0xDA && end - p >= 2) { length = (size_t)(p[0] << 8 | p[1]); p += 2; }
+    else return false;
+    if ((size_t)(end - p) < length || length >= size) return false;
+    memcpy(out, p, length);
+    out[length] = '\0';
+    p += length;
+    return true;
+}
+
+static bool decodeMsgPack(const uint8_t *data, size_t length, Decoded &out)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+    if (p >= end || (*p & 0xF0) != 0x80) return false;
+    int count = *p++ & 0x0F;
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key, value;
+        if (!readUint(p, end, key)) return false;
+        if (key == FCM_WIRE_KEY_TITLE) { if (!readStr(p, end, out.title, sizeof(out.title))) return false; }
+        else if (key == FCM_WIRE_KEY_BODY) { if (!readStr(p, end, out.body, sizeof(out.body))) return false; }
+        else if (key == FCM_WIRE_KEY_TOKEN) { if (!readStr(p, end, out.token, sizeof(out.token))) return false; }
+        else
+        {
+            if (!readUint(p, end, value)) return false;
+            if (key == FCM_WIRE_KEY_TOKEN_ID) out.tokenId = (uint32_t)value;
+            else if (key == FCM_WIRE_KEY_SEQ) out.seq = value;
+            else if (key == FCM_WIRE_KEY_TS) out.ts = value;
+        }
+    }
+    return p == end;
+}
+
+// Request line and headers as fcmHttpPrepareHead() writes them
+static size_t headBytes(const char *url, const char *contentType, size_t bodyLength)
+{
+    const char *host = strstr(url, "://") ? strstr(url, "://") + 3 : url;
+    const char *path = strchr(host, '/');
+    if (!path) path = "/";
+    size_t hostLength = strchr(host, '/') ? (size_t)(strchr(host, '/') - host) : strlen(host);
+    char head[768];
+    int n = snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: %.*s\r\n", path, (int)hostLength, host);
+    if (contentType) n += snprintf(head + n, sizeof(head) - n, "Content-Type: %s\r\n", contentType);
+    n += snprintf(head + n, sizeof(head) - n, "Connection: close\r\nContent-Length: %zu\r\n\r\n", bodyLength);
+    return (size_t)n;
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? (size_t)strtoul(argv[1], nullptr, 10) : 200000;
+    const char *url = argc > 2 ? argv[2] : "https://us-central1-my-project.cloudfunctions.net/sendNotification";
+    if (count == 0) return 1;
+
+    // Worst case token length the device stores
+    char token[257];
+    uint32_t seed = 7;
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_:";
+    for (int i = 0; i < 256; i++) token[i] = alphabet[nextRandom(seed) % (sizeof(alphabet) - 1)];
+    token[256] = '\0';
+    const uint32_t tokenId = 3735928559u; // IDs are hash-derived, so assume a full 32-bit one
+
+    Notification *notifications = new Notification[count];
+    buildNotifications(notifications, count);
+    char jsonBuffer[BUFFER_SIZE];
+    uint8_t msgpackBuffer[BUFFER_SIZE];
+    Decoded decoded;
+
+    size_t jsonBytes = 0, msgpackBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) jsonBytes += encodeJson(token, notifications[i], jsonBuffer);
+    double jsonEncodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) msgpackBytes += encodeMsgPack(tokenId, notifications[i], msgpackBuffer);
+    double msgpackEncodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // Decode one representative request repeatedly, checking the round trip on the way
+    const Notification &sample = notifications[count / 2];
+    size_t jsonLength = encodeJson(token, sample, jsonBuffer);
+    size_t msgpackLength = encodeMsgPack(tokenId, sample, msgpackBuffer);
+    bool jsonOk = true, msgpackOk = true;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        memset(&decoded, 0, sizeof(decoded));
+        jsonOk = decodeJson(jsonBuffer, decoded) && jsonOk;
+    }
+    double jsonDecodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    jsonOk = jsonOk && strcmp(decoded.token, token) == 0 && strcmp(decoded.body, sample.body) == 0 && decoded.ts == sample.ts;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        memset(&decoded, 0, sizeof(decoded));
+        msgpackOk = decodeMsgPack(msgpackBuffer, msgpackLength, decoded) && msgpackOk;
+    }
+    double msgpackDecodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    msgpackOk = msgpackOk && decoded.tokenId == tokenId && strcmp(decoded.body, sample.body) == 0 && decoded.ts == sample.ts;
+
+    // One-time registration request of the compact format
+    FCMMsgPackWriter registration(msgpackBuffer, BUFFER_SIZE);
+    registration.map(1).uint(FCM_WIRE_KEY_TOKEN).str(token);
+
+    double jsonBody = (double)jsonBytes / count, msgpackBody = (double)msgpackBytes / count;
+    size_t jsonHead = headBytes(url, "application/json", jsonLength);
+    size_t msgpackHead = headBytes(url, nullptr, msgpackLength);
+    printf("notifications: %zu, token: %zu characters\n", count, strlen(token));
+    printf("%-8s %10s %10s %10s %12s %12s %s\n", "format", "body B", "head B", "total B", "encode ns", "decode ns", "round trip");
+    printf("%-8s %10.1f %10zu %10.1f %12.1f %12.1f %s\n", "json", jsonBody, jsonHead, jsonBody + jsonHead,
+           jsonEncodeNs / count, jsonDecodeNs / count, jsonOk ? "ok" : "FAILED");
+    printf("%-8s %10.1f %10zu %10.1f %12.1f %12.1f %s\n", "msgpack", msgpackBody, msgpackHead, msgpackBody + msgpackHead,
+           msgpackEncodeNs / count, msgpackDecodeNs / count, msgpackOk ? "ok" : "FAILED");
+    printf("compact saves %.1f%% of request bytes; registration costs %zu body bytes once\n",
+           100.0 * (1.0 - (msgpackBody + msgpackHead) / (jsonBody + jsonHead)), registration.length());
+
+    delete[] notifications;
+    return jsonOk && msgpackOk ? 0 : 1;
+}